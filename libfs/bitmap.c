@@ -0,0 +1,203 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bitmap.h"
+
+#define bitmap_error(fmt, ...) \
+	fprintf(stderr, "%s: "fmt"\n", __func__, ##__VA_ARGS__)
+
+/* Bits per word */
+#define WORD_BITS 64
+
+/* Enough summary levels for 64^6 bits */
+#define BITMAP_LEVELS 6
+
+/* Bitmap description */
+struct bitmap {
+	/* Number of bits */
+	size_t nbits;
+	/* Number of bits set */
+	size_t weight;
+	/* Number of levels, the last one fits in a single word */
+	int nlevels;
+	/* Words of each level: bits of the bitmap, then summaries */
+	size_t nwords[BITMAP_LEVELS];
+	uint64_t *words[BITMAP_LEVELS];
+};
+
+static size_t words_for(size_t nbits)
+{
+	return (nbits + WORD_BITS - 1) / WORD_BITS;
+}
+
+struct bitmap *bitmap_create(size_t nbits)
+{
+	struct bitmap *bitmap;
+	size_t bits = nbits;
+	int l;
+
+	bitmap = calloc(1, sizeof(*bitmap));
+	if (!bitmap)
+		goto fail;
+	bitmap->nbits = nbits;
+
+	for (l = 0; l < BITMAP_LEVELS; l++) {
+		bitmap->nwords[l] = words_for(bits) ? words_for(bits) : 1;
+		bitmap->words[l] = calloc(bitmap->nwords[l], sizeof(uint64_t));
+		if (!bitmap->words[l])
+			goto fail;
+		bitmap->nlevels = l + 1;
+		if (bitmap->nwords[l] == 1)
+			return bitmap;
+		bits = bitmap->nwords[l];
+	}
+
+fail:
+	bitmap_error("cannot allocate %zu bits", nbits);
+	bitmap_destroy(bitmap);
+	return NULL;
+}
+
+void bitmap_destroy(struct bitmap *bitmap)
+{
+	int l;
+
+	if (!bitmap)
+		return;
+
+	for (l = 0; l < bitmap->nlevels; l++)
+		free(bitmap->words[l]);
+	free(bitmap);
+}
+
+int bitmap_grow(struct bitmap *bitmap, size_t nbits)
+{
+	struct bitmap *grown;
+	size_t bit;
+	int l;
+
+	if (nbits <= bitmap->nbits)
+		return 0;
+
+	grown = bitmap_create(nbits);
+	if (!grown)
+		return -1;
+	for (bit = bitmap_find_next(bitmap, 0); bit != BITMAP_NONE;
+	     bit = bitmap_find_next(bitmap, bit + 1))
+		bitmap_set(grown, bit);
+
+	for (l = 0; l < bitmap->nlevels; l++)
+		free(bitmap->words[l]);
+	*bitmap = *grown;
+	free(grown);
+
+	return 0;
+}
+
+void bitmap_set(struct bitmap *bitmap, size_t bit)
+{
+	int l;
+
+	if (bitmap_test(bitmap, bit))
+		return;
+	bitmap->weight++;
+
+	/* Stop climbing once a word was already marked in its summary */
+	for (l = 0; l < bitmap->nlevels; l++) {
+		uint64_t *word = &bitmap->words[l][bit / WORD_BITS];
+		int was_empty = !*word;
+
+		*word |= (uint64_t)1 << (bit % WORD_BITS);
+		if (!was_empty)
+			break;
+		bit /= WORD_BITS;
+	}
+}
+
+void bitmap_clear(struct bitmap *bitmap, size_t bit)
+{
+	int l;
+
+	if (!bitmap_test(bitmap, bit))
+		return;
+	bitmap->weight--;
+
+	/* Only a word that becomes empty changes the level above */
+	for (l = 0; l < bitmap->nlevels; l++) {
+		uint64_t *word = &bitmap->words[l][bit / WORD_BITS];
+
+		*word &= ~((uint64_t)1 << (bit % WORD_BITS));
+		if (*word)
+			break;
+		bit /= WORD_BITS;
+	}
+}
+
+int bitmap_test(const struct bitmap *bitmap, size_t bit)
+{
+	return (bitmap->words[0][bit / WORD_BITS] >> (bit % WORD_BITS)) & 1;
+}
+
+size_t bitmap_weight(const struct bitmap *bitmap)
+{
+	return bitmap->weight;
+}
+
+size_t bitmap_find_next(const struct bitmap *bitmap, size_t start)
+{
+	size_t pos = start, bit;
+	uint64_t word;
+	int l;
+
+	/* Climb until a level has a set bit after the position */
+	for (l = 0; l < bitmap->nlevels; l++) {
+		if (pos / WORD_BITS >= bitmap->nwords[l])
+			return BITMAP_NONE;
+		word = bitmap->words[l][pos / WORD_BITS] &
+			(~(uint64_t)0 << (pos % WORD_BITS));
+		if (word)
+			break;
+		pos = pos / WORD_BITS + 1;
+	}
+	if (l == bitmap->nlevels)
+		return BITMAP_NONE;
+
+	/* Then follow the first set bit of each summary down to the bits */
+	bit = pos / WORD_BITS * WORD_BITS + __builtin_ctzll(word);
+	while (l--)
+		bit = bit * WORD_BITS + __builtin_ctzll(bitmap->words[l][bit]);
+
+	return bit;
+}
+
+/* First clear bit at or after @start, or the size of the bitmap */
+static size_t bitmap_find_next_zero(const struct bitmap *bitmap, size_t start)
+{
+	size_t w = start / WORD_BITS, bit;
+	uint64_t word;
+
+	word = ~bitmap->words[0][w] & (~(uint64_t)0 << (start % WORD_BITS));
+	while (!word) {
+		if (++w == bitmap->nwords[0])
+			return bitmap->nbits;
+		word = ~bitmap->words[0][w];
+	}
+
+	bit = w * WORD_BITS + __builtin_ctzll(word);
+	return bit < bitmap->nbits ? bit : bitmap->nbits;
+}
+
+size_t bitmap_find_run(const struct bitmap *bitmap, size_t start, size_t len)
+{
+	size_t pos = start, end;
+
+	while ((pos = bitmap_find_next(bitmap, pos)) != BITMAP_NONE) {
+		end = bitmap_find_next_zero(bitmap, pos);
+		if (end - pos >= len)
+			return pos;
+		pos = end;
+	}
+
+	return BITMAP_NONE;
+}
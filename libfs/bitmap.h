@@ -0,0 +1,99 @@
+#ifndef _BITMAP_H
+#define _BITMAP_H
+
+#include <stddef.h> /* for size_t definition */
+
+/** Returned by the search functions when no bit is found */
+#define BITMAP_NONE ((size_t)-1)
+
+struct bitmap;
+
+/**
+ * bitmap_create - Create a bitmap
+ * @nbits: Number of bits
+ *
+ * Allocate a bitmap of @nbits bits, all clear. On top of the bits, each summary
+ * level holds one bit per word of the level below, set when that word has any
+ * bit set, so that searches skip 64 words of clear bits at a time per level.
+ *
+ * Return: NULL if the bitmap cannot be allocated. The new bitmap otherwise.
+ */
+struct bitmap *bitmap_create(size_t nbits);
+
+/**
+ * bitmap_destroy - Free a bitmap
+ * @bitmap: Bitmap to free, or NULL
+ */
+void bitmap_destroy(struct bitmap *bitmap);
+
+/**
+ * bitmap_grow - Enlarge a bitmap
+ * @bitmap: Bitmap
+ * @nbits: New number of bits, nothing happens if it is not more than now
+ *
+ * The new bits are clear, the others keep their value. Takes time proportional
+ * to the new size plus the number of bits set.
+ *
+ * Return: -1 if the larger bitmap cannot be allocated, @bitmap is then left
+ * unchanged. 0 otherwise.
+ */
+int bitmap_grow(struct bitmap *bitmap, size_t nbits);
+
+/**
+ * bitmap_set - Set a bit
+ * @bitmap: Bitmap
+ * @bit: Index of the bit, less than the size of the bitmap
+ */
+void bitmap_set(struct bitmap *bitmap, size_t bit);
+
+/**
+ * bitmap_clear - Clear a bit
+ * @bitmap: Bitmap
+ * @bit: Index of the bit, less than the size of the bitmap
+ */
+void bitmap_clear(struct bitmap *bitmap, size_t bit);
+
+/**
+ * bitmap_test - Test a bit
+ * @bitmap: Bitmap
+ * @bit: Index of the bit, less than the size of the bitmap
+ *
+ * Return: 1 if @bit is set. 0 otherwise.
+ */
+int bitmap_test(const struct bitmap *bitmap, size_t bit);
+
+/**
+ * bitmap_weight - Count the set bits
+ * @bitmap: Bitmap
+ *
+ * The count is maintained by bitmap_set() and bitmap_clear(), so this takes
+ * constant time.
+ *
+ * Return: The number of bits set.
+ */
+size_t bitmap_weight(const struct bitmap *bitmap);
+
+/**
+ * bitmap_find_next - Find the next set bit
+ * @bitmap: Bitmap
+ * @start: Index where the search starts
+ *
+ * Takes time proportional to the number of summary levels.
+ *
+ * Return: %BITMAP_NONE if no bit is set at or after @start. The index of the
+ * first set bit at or after @start otherwise.
+ */
+size_t bitmap_find_next(const struct bitmap *bitmap, size_t start);
+
+/**
+ * bitmap_find_run - Find a run of set bits
+ * @bitmap: Bitmap
+ * @start: Index where the search starts
+ * @len: Number of adjacent set bits wanted
+ *
+ * Return: %BITMAP_NONE if there is no run of @len set bits at or after @start.
+ * The index of the first bit of the first such run otherwise.
+ */
+size_t bitmap_find_run(const struct bitmap *bitmap, size_t start, size_t len);
+
+#endif /* _BITMAP_H */
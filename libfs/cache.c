@@ -0,0 +1,341 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cache.h"
+#include "disk.h"
+
+#define cache_error(fmt, ...) \
+	fprintf(stderr, "%s: "fmt"\n", __func__, ##__VA_ARGS__)
+
+/* End of a hash chain or of the free list */
+#define NO_SLOT -1
+
+/* Slot states */
+#define SLOT_VALID	0x1
+#define SLOT_DIRTY	0x2
+#define SLOT_REF	0x4
+#define SLOT_IO		0x8	/* Asynchronous read in flight */
+#define SLOT_RA		0x10	/* Read ahead and not used yet */
+#define SLOT_WB		0x20	/* Written back by cache_flush(), not yet waited */
+
+/* Block buffer cache description */
+struct cache {
+	/* Disk the cached blocks belong to */
+	struct disk *disk;
+	/* Number of slots, and bytes per slot: the block size of the disk */
+	size_t capacity;
+	size_t block_size;
+	/* Block contents */
+	char *data;
+	/* Block index held by each slot */
+	size_t *tags;
+	/* SLOT_* state of each slot */
+	uint8_t *state;
+	/* Hash chains: head slot per bucket and next slot per slot */
+	int *buckets;
+	int *next;
+	size_t bucket_mask;
+	/* CLOCK hand */
+	size_t hand;
+	/* Number of slots with an asynchronous read in flight */
+	size_t pending;
+	struct cache_stats stats;
+};
+
+struct cache *cache_create(struct disk *disk, size_t nblocks)
+{
+	struct cache *cache;
+	size_t nbuckets = 1, i;
+
+	if (!nblocks)
+		nblocks = 1;
+	while (nbuckets < nblocks)
+		nbuckets <<= 1;
+
+	cache = calloc(1, sizeof(*cache));
+	if (!cache) {
+		cache_error("cannot allocate %zu blocks", nblocks);
+		return NULL;
+	}
+	cache->disk = disk;
+	cache->block_size = disk_block_size(disk);
+
+	if (posix_memalign((void **)&cache->data, BLOCK_SIZE,
+			   nblocks * cache->block_size)) {
+		cache->data = NULL;
+		goto fail;
+	}
+	cache->tags = malloc(nblocks * sizeof(*cache->tags));
+	cache->state = calloc(nblocks, sizeof(*cache->state));
+	cache->next = malloc(nblocks * sizeof(*cache->next));
+	cache->buckets = malloc(nbuckets * sizeof(*cache->buckets));
+	if (!cache->tags || !cache->state || !cache->next || !cache->buckets)
+		goto fail;
+
+	for (i = 0; i < nbuckets; i++)
+		cache->buckets[i] = NO_SLOT;
+
+	cache->bucket_mask = nbuckets - 1;
+	cache->capacity = cache->stats.capacity = nblocks;
+
+	return cache;
+
+fail:
+	cache_error("cannot allocate %zu blocks", nblocks);
+	cache_destroy(cache);
+	return NULL;
+}
+
+static void cache_wait_io(struct cache *cache);
+
+void cache_destroy(struct cache *cache)
+{
+	if (!cache)
+		return;
+
+	/* Slots may not be freed under in-flight reads */
+	cache_wait_io(cache);
+
+	free(cache->data);
+	free(cache->tags);
+	free(cache->state);
+	free(cache->next);
+	free(cache->buckets);
+	free(cache);
+}
+
+static int *cache_chain(struct cache *cache, size_t block)
+{
+	return &cache->buckets[block & cache->bucket_mask];
+}
+
+static int cache_find(struct cache *cache, size_t block)
+{
+	int slot;
+
+	for (slot = *cache_chain(cache, block); slot != NO_SLOT;
+	     slot = cache->next[slot])
+		if (cache->tags[slot] == block)
+			return slot;
+
+	return NO_SLOT;
+}
+
+static void cache_unlink(struct cache *cache, int slot)
+{
+	int *link = cache_chain(cache, cache->tags[slot]);
+
+	if (cache->state[slot] & SLOT_RA)
+		cache->stats.readahead_waste++;
+
+	while (*link != slot)
+		link = &cache->next[*link];
+	*link = cache->next[slot];
+	cache->state[slot] = 0;
+}
+
+static void cache_link(struct cache *cache, int slot, size_t block,
+		       uint8_t state)
+{
+	int *chain = cache_chain(cache, block);
+
+	cache->tags[slot] = block;
+	cache->next[slot] = *chain;
+	*chain = slot;
+	cache->state[slot] = state;
+}
+
+/* Wait for the reads started by cache_prefetch(), dropping failed ones */
+static void cache_wait_io(struct cache *cache)
+{
+	size_t slot;
+	int ret;
+
+	if (!cache->pending)
+		return;
+
+	ret = disk_wait(cache->disk);
+	for (slot = 0; slot < cache->capacity; slot++) {
+		if (!(cache->state[slot] & SLOT_IO))
+			continue;
+		cache->state[slot] &= ~SLOT_IO;
+		/* Cannot tell which read failed: none of them can be trusted */
+		if (ret) {
+			cache->state[slot] &= ~SLOT_RA;
+			cache_unlink(cache, slot);
+		}
+	}
+	cache->pending = 0;
+}
+
+static char *slot_data(struct cache *cache, int slot)
+{
+	return cache->data + (size_t)slot * cache->block_size;
+}
+
+/* Pick a slot with the CLOCK policy, writing back its block if dirty */
+static int cache_evict(struct cache *cache)
+{
+	int slot;
+
+	for (;;) {
+		slot = cache->hand;
+		cache->hand = (cache->hand + 1) % cache->capacity;
+
+		if (!(cache->state[slot] & SLOT_VALID))
+			return slot;
+
+		if (cache->state[slot] & SLOT_IO) {
+			cache_wait_io(cache);
+			if (!(cache->state[slot] & SLOT_VALID))
+				return slot;
+		}
+
+		if (cache->state[slot] & SLOT_REF) {
+			/* Second chance */
+			cache->state[slot] &= ~SLOT_REF;
+			continue;
+		}
+
+		if (cache->state[slot] & SLOT_DIRTY) {
+			if (disk_write(cache->disk, cache->tags[slot],
+				       slot_data(cache, slot)))
+				return NO_SLOT;
+			cache->stats.writebacks++;
+		}
+		cache->stats.evictions++;
+		cache_unlink(cache, slot);
+
+		return slot;
+	}
+}
+
+void *cache_lookup(struct cache *cache, size_t block, int flags)
+{
+	int slot = cache_find(cache, block);
+
+	if (slot != NO_SLOT && (cache->state[slot] & SLOT_IO)) {
+		cache_wait_io(cache);
+		slot = cache_find(cache, block);
+	}
+
+	if (slot == NO_SLOT)
+		return NULL;
+
+	if (cache->state[slot] & SLOT_RA) {
+		cache->state[slot] &= ~SLOT_RA;
+		cache->stats.readahead_hits++;
+	}
+
+	cache->stats.hits++;
+	cache->state[slot] |= SLOT_REF;
+	if (flags & CACHE_WRITE)
+		cache->state[slot] |= SLOT_DIRTY;
+
+	return slot_data(cache, slot);
+}
+
+void *cache_block(struct cache *cache, size_t block, int flags)
+{
+	uint8_t state = SLOT_VALID | SLOT_REF;
+	void *data;
+	int slot;
+
+	if ((data = cache_lookup(cache, block, flags)))
+		return data;
+
+	cache->stats.misses++;
+	if ((slot = cache_evict(cache)) == NO_SLOT)
+		return NULL;
+
+	if ((flags & CACHE_READ) &&
+	    disk_read(cache->disk, block, slot_data(cache, slot)))
+		return NULL;
+
+	if (flags & CACHE_WRITE)
+		state |= SLOT_DIRTY;
+	cache_link(cache, slot, block, state);
+
+	return slot_data(cache, slot);
+}
+
+int cache_prefetch(struct cache *cache, size_t block)
+{
+	int slot;
+
+	if (cache_find(cache, block) != NO_SLOT)
+		return 0;
+
+	if ((slot = cache_evict(cache)) == NO_SLOT)
+		return -1;
+
+	if (disk_submit_read(cache->disk, block, slot_data(cache, slot), 1))
+		return -1;
+
+	cache_link(cache, slot, block,
+		   SLOT_VALID | SLOT_REF | SLOT_IO | SLOT_RA);
+	cache->pending++;
+	cache->stats.readahead++;
+
+	return 0;
+}
+
+void cache_invalidate(struct cache *cache, size_t block)
+{
+	int slot = cache_find(cache, block);
+
+	if (slot != NO_SLOT && (cache->state[slot] & SLOT_IO)) {
+		cache_wait_io(cache);
+		slot = cache_find(cache, block);
+	}
+
+	if (slot != NO_SLOT)
+		cache_unlink(cache, slot);
+}
+
+int cache_flush(struct cache *cache)
+{
+	int ret = 0;
+	size_t slot;
+
+	/* Reap pending reads first so disk_wait() below only reports writes */
+	cache_wait_io(cache);
+
+	/* Queue all dirty blocks at once and let the engine overlap them */
+	for (slot = 0; slot < cache->capacity; slot++) {
+		if (!(cache->state[slot] & SLOT_DIRTY))
+			continue;
+		if (disk_submit_write(cache->disk, cache->tags[slot],
+				      slot_data(cache, slot), 1)) {
+			ret = -1;
+			continue;
+		}
+		cache->state[slot] |= SLOT_WB;
+	}
+
+	/*
+	 * Blocks are only clean once their writes are known to have succeeded,
+	 * otherwise they all stay dirty for the next flush to retry
+	 */
+	if (disk_wait(cache->disk))
+		ret = -1;
+
+	for (slot = 0; slot < cache->capacity; slot++) {
+		if (!(cache->state[slot] & SLOT_WB))
+			continue;
+		cache->state[slot] &= ~SLOT_WB;
+		if (ret)
+			continue;
+		cache->state[slot] &= ~SLOT_DIRTY;
+		cache->stats.writebacks++;
+	}
+
+	return ret;
+}
+
+void cache_get_stats(struct cache *cache, struct cache_stats *stats)
+{
+	*stats = cache->stats;
+}
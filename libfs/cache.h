@@ -0,0 +1,128 @@
+#ifndef _CACHE_H
+#define _CACHE_H
+
+#include <stddef.h> /* for size_t definition */
+
+struct cache;
+struct disk;
+
+/** Flags for cache_block() */
+#define CACHE_READ	0x1	/* Fill the block from disk on a miss */
+#define CACHE_WRITE	0x2	/* Mark the block dirty */
+
+/** Cache counters, see cache_get_stats() */
+struct cache_stats {
+	/* Number of block slots */
+	size_t capacity;
+	/* Lookups served from the cache */
+	size_t hits;
+	/* Lookups that needed a free slot */
+	size_t misses;
+	/* Valid blocks dropped to make room */
+	size_t evictions;
+	/* Dirty blocks written back to disk */
+	size_t writebacks;
+	/* Blocks read ahead with cache_prefetch() */
+	size_t readahead;
+	/* Blocks read ahead that were used before leaving the cache */
+	size_t readahead_hits;
+	/* Blocks read ahead that left the cache without being used */
+	size_t readahead_waste;
+};
+
+/**
+ * cache_create - Create a block buffer cache
+ * @disk: Disk whose blocks are cached
+ * @nblocks: Number of slots, each holding a block of @disk
+ *
+ * Allocate a write-back cache of @nblocks blocks (at least one) in front of
+ * @disk. Blocks are replaced with the CLOCK policy. Every other function takes
+ * the returned cache as its first argument.
+ *
+ * Return: NULL if the cache cannot be allocated. The new cache otherwise.
+ */
+struct cache *cache_create(struct disk *disk, size_t nblocks);
+
+/**
+ * cache_destroy - Drop a block buffer cache
+ * @cache: Cache to free, or NULL
+ *
+ * Free the cache without writing anything back; cache_flush() should be called
+ * first.
+ */
+void cache_destroy(struct cache *cache);
+
+/**
+ * cache_block - Get the cached copy of a block
+ * @cache: Cache
+ * @block: Index of the block
+ * @flags: Combination of %CACHE_READ and %CACHE_WRITE
+ *
+ * Return a pointer to the cached content of virtual disk's block @block,
+ * evicting another block if needed. On a miss, the content is read from disk
+ * if @flags has %CACHE_READ and is left undefined otherwise. With
+ * %CACHE_WRITE, the block is written back to disk when evicted or flushed. The
+ * pointer is valid until the next call to a cache function.
+ *
+ * Return: NULL if the block cannot be read or a slot cannot be freed. A pointer
+ * to a block of data otherwise.
+ */
+void *cache_block(struct cache *cache, size_t block, int flags);
+
+/**
+ * cache_lookup - Get the cached copy of a block if present
+ * @cache: Cache
+ * @block: Index of the block
+ * @flags: %CACHE_WRITE to mark the block dirty, 0 otherwise
+ *
+ * Same as cache_block() but never performs any disk I/O nor evicts anything.
+ *
+ * Return: NULL if @block is not cached. A pointer to a block of data
+ * otherwise.
+ */
+void *cache_lookup(struct cache *cache, size_t block, int flags);
+
+/**
+ * cache_prefetch - Start reading a block into the cache
+ * @cache: Cache
+ * @block: Index of the block
+ *
+ * Queue an asynchronous read of @block into a cache slot, unless the block is
+ * already cached. Later lookups of the block wait for the read to complete.
+ * Call disk_kick() once the prefetched blocks are queued.
+ *
+ * Return: -1 if a slot cannot be freed or the read cannot be queued. 0
+ * otherwise.
+ */
+int cache_prefetch(struct cache *cache, size_t block);
+
+/**
+ * cache_invalidate - Forget a block
+ * @cache: Cache
+ * @block: Index of the block
+ *
+ * Drop the cached copy of @block, if any, without writing it back. Used when
+ * the block is freed.
+ */
+void cache_invalidate(struct cache *cache, size_t block);
+
+/**
+ * cache_flush - Write back every dirty block
+ * @cache: Cache
+ *
+ * Blocks only become clean once the disk reports their writes done. If any
+ * write fails, every block written back stays dirty, for the next flush to
+ * write again.
+ *
+ * Return: -1 if writing any of the dirty blocks fails. 0 otherwise.
+ */
+int cache_flush(struct cache *cache);
+
+/**
+ * cache_get_stats - Get the cache counters
+ * @cache: Cache
+ * @stats: Counters to fill
+ */
+void cache_get_stats(struct cache *cache, struct cache_stats *stats);
+
+#endif /* _CACHE_H */
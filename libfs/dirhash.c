@@ -0,0 +1,179 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dirhash.h"
+
+#define dirhash_error(fmt, ...) \
+	fprintf(stderr, "%s: "fmt"\n", __func__, ##__VA_ARGS__)
+
+/* Initial number of buckets, a power of two */
+#define DIRHASH_MIN_BUCKETS 256
+
+/* Bucket of the table, free when its entry is -1 */
+struct bucket {
+	uint32_t hash;
+	long dir;
+	long entry;
+	char name[DIRHASH_NAME_LEN];
+};
+
+/* Index description */
+struct dirhash {
+	/* Number of buckets, a power of two, and of names in them */
+	size_t nbuckets;
+	size_t count;
+	struct bucket *buckets;
+};
+
+static uint32_t hash_name(long dir, const char *name)
+{
+	uint32_t hash = 2166136261u;
+	int i;
+
+	/* Same names in different directories land in different buckets */
+	for (i = 0; i < (int)sizeof(dir); i++) {
+		hash ^= (uint8_t)(dir >> (8 * i));
+		hash *= 16777619u;
+	}
+	for (i = 0; i < DIRHASH_NAME_LEN && name[i]; i++) {
+		hash ^= (uint8_t)name[i];
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+static struct bucket *alloc_buckets(size_t nbuckets)
+{
+	struct bucket *buckets;
+	size_t i;
+
+	buckets = malloc(nbuckets * sizeof(*buckets));
+	if (!buckets)
+		return NULL;
+	for (i = 0; i < nbuckets; i++)
+		buckets[i].entry = -1;
+
+	return buckets;
+}
+
+/*
+ * Bucket holding @name of directory @dir, or the free bucket ending its probe
+ * sequence. Linear probing, the table is never more than half full.
+ */
+static size_t find_bucket(const struct dirhash *dirhash, long dir,
+			  const char *name, uint32_t hash)
+{
+	size_t mask = dirhash->nbuckets - 1, i = hash & mask;
+	struct bucket *b;
+
+	for (;; i = (i + 1) & mask) {
+		b = &dirhash->buckets[i];
+		if (b->entry == -1 || (b->hash == hash && b->dir == dir &&
+		    !strncmp(b->name, name, DIRHASH_NAME_LEN)))
+			return i;
+	}
+}
+
+static int grow(struct dirhash *dirhash)
+{
+	struct bucket *old = dirhash->buckets;
+	size_t nold = dirhash->nbuckets, i;
+
+	dirhash->buckets = alloc_buckets(nold * 2);
+	if (!dirhash->buckets) {
+		dirhash_error("cannot grow to %zu buckets", nold * 2);
+		dirhash->buckets = old;
+		return -1;
+	}
+	dirhash->nbuckets = nold * 2;
+
+	for (i = 0; i < nold; i++)
+		if (old[i].entry != -1)
+			dirhash->buckets[find_bucket(dirhash, old[i].dir,
+						     old[i].name,
+						     old[i].hash)] = old[i];
+	free(old);
+
+	return 0;
+}
+
+struct dirhash *dirhash_create(void)
+{
+	struct dirhash *dirhash;
+
+	dirhash = calloc(1, sizeof(*dirhash));
+	if (!dirhash)
+		return NULL;
+
+	dirhash->nbuckets = DIRHASH_MIN_BUCKETS;
+	dirhash->buckets = alloc_buckets(dirhash->nbuckets);
+	if (!dirhash->buckets) {
+		free(dirhash);
+		return NULL;
+	}
+
+	return dirhash;
+}
+
+void dirhash_destroy(struct dirhash *dirhash)
+{
+	if (!dirhash)
+		return;
+
+	free(dirhash->buckets);
+	free(dirhash);
+}
+
+long dirhash_lookup(const struct dirhash *dirhash, long dir, const char *name)
+{
+	return dirhash->buckets[find_bucket(dirhash, dir, name,
+					    hash_name(dir, name))].entry;
+}
+
+int dirhash_insert(struct dirhash *dirhash, long dir, const char *name,
+		   long entry)
+{
+	uint32_t hash = hash_name(dir, name);
+	struct bucket *b;
+
+	if (2 * (dirhash->count + 1) > dirhash->nbuckets && grow(dirhash))
+		return -1;
+
+	b = &dirhash->buckets[find_bucket(dirhash, dir, name, hash)];
+	if (b->entry == -1)
+		dirhash->count++;
+	b->hash = hash;
+	b->dir = dir;
+	b->entry = entry;
+	strncpy(b->name, name, DIRHASH_NAME_LEN);
+
+	return 0;
+}
+
+void dirhash_remove(struct dirhash *dirhash, long dir, const char *name)
+{
+	size_t mask = dirhash->nbuckets - 1, i, j, home;
+
+	i = find_bucket(dirhash, dir, name, hash_name(dir, name));
+	if (dirhash->buckets[i].entry == -1)
+		return;
+	dirhash->count--;
+
+	/*
+	 * Backward shift: move later names of the probe sequence into the hole
+	 * when their home bucket doesn't lie between the hole and them, so that
+	 * no tombstone is needed
+	 */
+	for (j = (i + 1) & mask; dirhash->buckets[j].entry != -1;
+	     j = (j + 1) & mask) {
+		home = dirhash->buckets[j].hash & mask;
+		if (((j - home) & mask) >= ((j - i) & mask)) {
+			dirhash->buckets[i] = dirhash->buckets[j];
+			i = j;
+		}
+	}
+	dirhash->buckets[i].entry = -1;
+}
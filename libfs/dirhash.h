@@ -0,0 +1,60 @@
+#ifndef _DIRHASH_H
+#define _DIRHASH_H
+
+#include <stddef.h> /* for size_t definition */
+
+/** Longest name, including the NULL character */
+#define DIRHASH_NAME_LEN 16
+
+struct dirhash;
+
+/**
+ * dirhash_create - Create a filename index
+ *
+ * Allocate an empty open-addressing hash table mapping filenames, each within
+ * a directory, to directory entry numbers. The same name can be indexed once
+ * per directory. The table doubles whenever it becomes half full, so lookups,
+ * insertions and removals take constant time however many entries it holds.
+ *
+ * Return: NULL if the index cannot be allocated. The new index otherwise.
+ */
+struct dirhash *dirhash_create(void);
+
+/**
+ * dirhash_destroy - Free a filename index
+ * @dirhash: Index to free, or NULL
+ */
+void dirhash_destroy(struct dirhash *dirhash);
+
+/**
+ * dirhash_lookup - Find a filename
+ * @dirhash: Index
+ * @dir: Directory holding @name
+ * @name: Filename, at most %DIRHASH_NAME_LEN bytes are compared
+ *
+ * Return: -1 if @name is not in the index for @dir. Its entry number
+ * otherwise.
+ */
+long dirhash_lookup(const struct dirhash *dirhash, long dir, const char *name);
+
+/**
+ * dirhash_insert - Add a filename
+ * @dirhash: Index
+ * @dir: Directory holding @name
+ * @name: Filename, not in the index for @dir yet
+ * @entry: Entry number of @name
+ *
+ * Return: -1 if the index cannot grow. 0 otherwise.
+ */
+int dirhash_insert(struct dirhash *dirhash, long dir, const char *name,
+		   long entry);
+
+/**
+ * dirhash_remove - Remove a filename
+ * @dirhash: Index
+ * @dir: Directory holding @name
+ * @name: Filename, nothing happens if it is not in the index for @dir
+ */
+void dirhash_remove(struct dirhash *dirhash, long dir, const char *name);
+
+#endif /* _DIRHASH_H */
@@ -1,10 +1,20 @@
+#include <errno.h>
 #include <fcntl.h>
+#include <linux/io_uring.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
+/* <linux/io_uring.h> pulls in the kernel's own BLOCK_SIZE */
+#undef BLOCK_SIZE
 #include "disk.h"
 
 #define block_error(fmt, ...) \
@@ -13,32 +23,101 @@
 /* Invalid file descriptor */
 #define INVALID_FD -1
 
+/* Maximum number of blocks transferred by one vectored system call */
+#define BLOCK_RUN_MAX 1024
+
+/* Maximum number of asynchronous requests in flight */
+#define AIO_DEPTH 64
+
+/* Number of requests queued before they are handed to io_uring */
+#define AIO_SUBMIT_BATCH 16
+
+/* Number of workers of the thread pool engine */
+#define AIO_THREADS 4
+
+/* Asynchronous request on a run of adjacent blocks */
+struct aio_req {
+	int write;
+	size_t block;
+	char *buf;
+	size_t nblocks;
+};
+
+/* io_uring engine: rings shared with the kernel and request slots */
+struct aio_ring {
+	int fd;
+	void *sq_ptr, *cq_ptr;
+	size_t sq_size, cq_size, sqes_size;
+	unsigned *sq_tail, *sq_mask, *sq_array;
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	/* Requests prepared in the SQ ring but not submitted yet */
+	unsigned queued;
+	/* Requests submitted but whose completion was not reaped yet */
+	unsigned inflight;
+	struct aio_req reqs[AIO_DEPTH];
+	unsigned free_slots[AIO_DEPTH];
+	unsigned nfree;
+};
+
+/* Thread pool engine: workers serving a queue of requests with pread() */
+struct aio_pool {
+	pthread_t threads[AIO_THREADS];
+	int nthreads;
+	pthread_mutex_t lock;
+	/* Signaled when requests are queued or when stopping */
+	pthread_cond_t work;
+	/* Signaled when a request completes */
+	pthread_cond_t done;
+	struct aio_req queue[AIO_DEPTH];
+	unsigned head, count;
+	/* Requests currently served by a worker */
+	unsigned busy;
+	int stop;
+};
+
 /* Disk instance description */
 struct disk {
-	/* File descriptor */
-	int fd;
-	/* Block count */
+	/* Backend serving the disk (NULL when no disk is open) */
+	const struct disk_backend *backend;
+	/* Backend private context */
+	void *ctx;
+	/* Block count, and block size in bytes, a multiple of the %BLOCK_SIZE
+	 * blocks the backend counts in */
 	size_t bcount;
+	size_t block_size;
+	/* Requested asynchronous engine */
+	int engine;
+	/* Asynchronous engine in use while the disk is open */
+	int aio;
+	/* File descriptor the asynchronous engines work on */
+	int aio_fd;
+	struct aio_ring ring;
+	struct aio_pool pool;
+	/* Whether an asynchronous request failed since the last block_wait() */
+	int aio_error;
 };
 
-/* Currently open virtual disk (invalid by default) */
-static struct disk disk = { .fd = INVALID_FD };
+/* Default disk served by the block_*() interface (none by default) */
+static struct disk *default_disk;
 
-int block_disk_open(const char *diskname)
+/* Asynchronous engine requested for the default disk */
+static int default_engine = DISK_ENGINE_AUTO;
+
+static int aio_start(struct disk *disk);
+static void aio_stop(struct disk *disk);
+
+/*
+ * Image files
+ */
+
+/* Open image file @diskname and get its block count */
+static int image_open(const char *diskname, size_t *bcount)
 {
 	int fd;
 	struct stat st;
 
-	if (!diskname) {
-		block_error("invalid file diskname");
-		return -1;
-	}
-
-	if (disk.fd != INVALID_FD) {
-		block_error("disk already open");
-		return -1;
-	}
-
 	if ((fd = open(diskname, O_RDWR, 0644)) < 0) {
 		perror("open");
 		return -1;
@@ -46,6 +125,7 @@ int block_disk_open(const char *diskname)
 
 	if (fstat(fd, &st)) {
 		perror("fstat");
+		close(fd);
 		return -1;
 	}
 
@@ -53,92 +133,1166 @@ int block_disk_open(const char *diskname)
 	if (st.st_size % BLOCK_SIZE != 0) {
 		block_error("size '%zu' is not multiple of '%d'",
 			    st.st_size, BLOCK_SIZE);
+		close(fd);
+		return -1;
+	}
+
+	*bcount = st.st_size / BLOCK_SIZE;
+
+	return fd;
+}
+
+/*
+ * Transfer a run of physically adjacent blocks starting at @block, described
+ * by @iov, from or to image file @fd with as few system calls as possible
+ */
+static int image_xfer(int fd, int write, size_t block,
+		      const struct iovec *iov, int iovcnt)
+{
+	struct iovec left[BLOCK_RUN_MAX], *cur = left;
+	off_t pos = block * BLOCK_SIZE;
+	ssize_t ret;
+
+	if (iovcnt > BLOCK_RUN_MAX) {
+		block_error("too many buffers (%d/%d)", iovcnt, BLOCK_RUN_MAX);
 		return -1;
 	}
+	memcpy(left, iov, iovcnt * sizeof(*iov));
 
-	disk.fd = fd;
-	disk.bcount = st.st_size / BLOCK_SIZE;
+	while (iovcnt) {
+		if (write)
+			ret = pwritev(fd, cur, iovcnt, pos);
+		else
+			ret = preadv(fd, cur, iovcnt, pos);
+
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			perror(write ? "pwritev" : "preadv");
+			return -1;
+		}
+		if (ret == 0) {
+			block_error("unexpected end of disk at block %zu",
+				    (size_t)(pos / BLOCK_SIZE));
+			return -1;
+		}
+
+		/* Short transfer: skip what was done and resume from there */
+		pos += ret;
+		while (iovcnt && (size_t)ret >= cur->iov_len) {
+			ret -= cur->iov_len;
+			cur++;
+			iovcnt--;
+		}
+		if (ret) {
+			cur->iov_base = (char *)cur->iov_base + ret;
+			cur->iov_len -= ret;
+		}
+	}
 
 	return 0;
 }
 
-int block_disk_close(void)
+/* Copy a run of blocks starting at @block between @mem and @iov */
+static void mem_xfer(char *mem, int write, size_t block,
+		     const struct iovec *iov, int iovcnt)
 {
-	if (disk.fd == INVALID_FD) {
+	char *pos = mem + block * BLOCK_SIZE;
+
+	for (; iovcnt; pos += iov->iov_len, iov++, iovcnt--) {
+		if (write)
+			memcpy(pos, iov->iov_base, iov->iov_len);
+		else
+			memcpy(iov->iov_base, pos, iov->iov_len);
+	}
+}
+
+/*
+ * File backend: pread()/pwrite() on the image file
+ */
+struct file_disk {
+	int fd;
+	size_t bcount;
+};
+
+static void *file_open(const char *diskname)
+{
+	struct file_disk *fdisk = malloc(sizeof(*fdisk));
+
+	if (!fdisk)
+		return NULL;
+
+	if ((fdisk->fd = image_open(diskname, &fdisk->bcount)) < 0) {
+		free(fdisk);
+		return NULL;
+	}
+
+	return fdisk;
+}
+
+static int file_close(void *ctx)
+{
+	struct file_disk *fdisk = ctx;
+
+	close(fdisk->fd);
+	free(fdisk);
+
+	return 0;
+}
+
+static size_t file_count(void *ctx)
+{
+	return ((struct file_disk *)ctx)->bcount;
+}
+
+static int file_read(void *ctx, size_t block, const struct iovec *iov,
+		     int iovcnt)
+{
+	return image_xfer(((struct file_disk *)ctx)->fd, 0, block, iov, iovcnt);
+}
+
+static int file_write(void *ctx, size_t block, const struct iovec *iov,
+		      int iovcnt)
+{
+	return image_xfer(((struct file_disk *)ctx)->fd, 1, block, iov, iovcnt);
+}
+
+static int file_flush(void *ctx)
+{
+	if (fsync(((struct file_disk *)ctx)->fd)) {
+		perror("fsync");
+		return -1;
+	}
+
+	return 0;
+}
+
+static int file_fd(void *ctx)
+{
+	return ((struct file_disk *)ctx)->fd;
+}
+
+const struct disk_backend disk_file_backend = {
+	.name = "file",
+	.open = file_open,
+	.close = file_close,
+	.count = file_count,
+	.read = file_read,
+	.write = file_write,
+	.flush = file_flush,
+	.fd = file_fd,
+};
+
+/*
+ * Mmap backend: memcpy() from/to a shared mapping of the image file
+ */
+struct mmap_disk {
+	int fd;
+	size_t bcount;
+	char *map;
+};
+
+static void *mmap_open(const char *diskname)
+{
+	struct mmap_disk *mdisk = malloc(sizeof(*mdisk));
+
+	if (!mdisk)
+		return NULL;
+
+	if ((mdisk->fd = image_open(diskname, &mdisk->bcount)) < 0) {
+		free(mdisk);
+		return NULL;
+	}
+
+	mdisk->map = NULL;
+	if (mdisk->bcount) {
+		mdisk->map = mmap(NULL, mdisk->bcount * BLOCK_SIZE,
+				  PROT_READ | PROT_WRITE, MAP_SHARED,
+				  mdisk->fd, 0);
+		if (mdisk->map == MAP_FAILED) {
+			perror("mmap");
+			close(mdisk->fd);
+			free(mdisk);
+			return NULL;
+		}
+	}
+
+	return mdisk;
+}
+
+static int mmap_flush(void *ctx)
+{
+	struct mmap_disk *mdisk = ctx;
+
+	if (mdisk->map &&
+	    msync(mdisk->map, mdisk->bcount * BLOCK_SIZE, MS_SYNC)) {
+		perror("msync");
+		return -1;
+	}
+
+	return 0;
+}
+
+static int mmap_close(void *ctx)
+{
+	struct mmap_disk *mdisk = ctx;
+	int ret;
+
+	/* Make sure the image file holds every write before unmapping */
+	ret = mmap_flush(mdisk);
+	if (mdisk->map)
+		munmap(mdisk->map, mdisk->bcount * BLOCK_SIZE);
+	close(mdisk->fd);
+	free(mdisk);
+
+	return ret;
+}
+
+static size_t mmap_count(void *ctx)
+{
+	return ((struct mmap_disk *)ctx)->bcount;
+}
+
+static int mmap_read(void *ctx, size_t block, const struct iovec *iov,
+		     int iovcnt)
+{
+	mem_xfer(((struct mmap_disk *)ctx)->map, 0, block, iov, iovcnt);
+	return 0;
+}
+
+static int mmap_write(void *ctx, size_t block, const struct iovec *iov,
+		      int iovcnt)
+{
+	mem_xfer(((struct mmap_disk *)ctx)->map, 1, block, iov, iovcnt);
+	return 0;
+}
+
+const struct disk_backend disk_mmap_backend = {
+	.name = "mmap",
+	.open = mmap_open,
+	.close = mmap_close,
+	.count = mmap_count,
+	.read = mmap_read,
+	.write = mmap_write,
+	.flush = mmap_flush,
+};
+
+/*
+ * RAM backend: whole image loaded in memory, modified blocks saved back
+ */
+struct ram_disk {
+	int fd;
+	size_t bcount;
+	char *data;
+	/* One byte per block, set when the block differs from the image file */
+	uint8_t *dirty;
+};
+
+static void *ram_open(const char *diskname)
+{
+	struct ram_disk *rdisk = calloc(1, sizeof(*rdisk));
+	struct iovec iov;
+	size_t block;
+
+	if (!rdisk)
+		return NULL;
+
+	if ((rdisk->fd = image_open(diskname, &rdisk->bcount)) < 0) {
+		free(rdisk);
+		return NULL;
+	}
+
+	if (posix_memalign((void **)&rdisk->data, BLOCK_SIZE,
+			   rdisk->bcount * BLOCK_SIZE + 1))
+		rdisk->data = NULL;
+	rdisk->dirty = calloc(rdisk->bcount + 1, 1);
+	if (!rdisk->data || !rdisk->dirty) {
+		block_error("cannot allocate %zu blocks", rdisk->bcount);
+		goto fail;
+	}
+
+	/* Load the image, BLOCK_RUN_MAX blocks at a time */
+	for (block = 0; block < rdisk->bcount; block += BLOCK_RUN_MAX) {
+		iov.iov_base = rdisk->data + block * BLOCK_SIZE;
+		iov.iov_len = BLOCK_SIZE * (rdisk->bcount - block < BLOCK_RUN_MAX ?
+					    rdisk->bcount - block : BLOCK_RUN_MAX);
+		if (image_xfer(rdisk->fd, 0, block, &iov, 1))
+			goto fail;
+	}
+
+	return rdisk;
+
+fail:
+	free(rdisk->data);
+	free(rdisk->dirty);
+	close(rdisk->fd);
+	free(rdisk);
+	return NULL;
+}
+
+/* Save every modified block to the image file, one run at a time */
+static int ram_flush(void *ctx)
+{
+	struct ram_disk *rdisk = ctx;
+	struct iovec iov;
+	size_t block = 0, n;
+
+	while (block < rdisk->bcount) {
+		if (!rdisk->dirty[block]) {
+			block++;
+			continue;
+		}
+		for (n = 0; block + n < rdisk->bcount && n < BLOCK_RUN_MAX &&
+			    rdisk->dirty[block + n]; n++)
+			rdisk->dirty[block + n] = 0;
+
+		iov.iov_base = rdisk->data + block * BLOCK_SIZE;
+		iov.iov_len = n * BLOCK_SIZE;
+		if (image_xfer(rdisk->fd, 1, block, &iov, 1)) {
+			memset(rdisk->dirty + block, 1, n);
+			return -1;
+		}
+		block += n;
+	}
+
+	if (fsync(rdisk->fd)) {
+		perror("fsync");
+		return -1;
+	}
+
+	return 0;
+}
+
+static int ram_close(void *ctx)
+{
+	struct ram_disk *rdisk = ctx;
+	int ret;
+
+	ret = ram_flush(rdisk);
+	free(rdisk->data);
+	free(rdisk->dirty);
+	close(rdisk->fd);
+	free(rdisk);
+
+	return ret;
+}
+
+static size_t ram_count(void *ctx)
+{
+	return ((struct ram_disk *)ctx)->bcount;
+}
+
+static int ram_read(void *ctx, size_t block, const struct iovec *iov,
+		    int iovcnt)
+{
+	mem_xfer(((struct ram_disk *)ctx)->data, 0, block, iov, iovcnt);
+	return 0;
+}
+
+static int ram_write(void *ctx, size_t block, const struct iovec *iov,
+		     int iovcnt)
+{
+	struct ram_disk *rdisk = ctx;
+	size_t len = 0;
+	int i;
+
+	for (i = 0; i < iovcnt; i++)
+		len += iov[i].iov_len;
+	/*
+	 * Copy before marking the blocks dirty: a flush running at the same
+	 * time may save a partial copy, but then leaves the blocks dirty
+	 */
+	mem_xfer(rdisk->data, 1, block, iov, iovcnt);
+	memset(rdisk->dirty + block, 1, len / BLOCK_SIZE);
+
+	return 0;
+}
+
+const struct disk_backend disk_ram_backend = {
+	.name = "ram",
+	.open = ram_open,
+	.close = ram_close,
+	.count = ram_count,
+	.read = ram_read,
+	.write = ram_write,
+	.flush = ram_flush,
+};
+
+/*
+ * Disk instances
+ */
+static int engine_valid(int engine)
+{
+	if (engine != DISK_ENGINE_AUTO && engine != DISK_ENGINE_URING &&
+	    engine != DISK_ENGINE_THREADS) {
+		block_error("invalid asynchronous engine '%d'", engine);
+		return 0;
+	}
+
+	return 1;
+}
+
+struct disk *disk_open(const char *diskname,
+		       const struct disk_backend *backend, int engine)
+{
+	struct disk *disk;
+	void *ctx;
+
+	if (!diskname) {
+		block_error("invalid file diskname");
+		return NULL;
+	}
+
+	if (!engine_valid(engine))
+		return NULL;
+
+	if (!backend)
+		backend = &disk_file_backend;
+
+	if (!(ctx = backend->open(diskname)))
+		return NULL;
+
+	disk = calloc(1, sizeof(*disk));
+	if (!disk) {
+		perror("calloc");
+		backend->close(ctx);
+		return NULL;
+	}
+
+	disk->backend = backend;
+	disk->ctx = ctx;
+	disk->bcount = backend->count(ctx);
+	disk->block_size = BLOCK_SIZE;
+	disk->engine = engine;
+
+	if (aio_start(disk)) {
+		backend->close(ctx);
+		free(disk);
+		return NULL;
+	}
+
+	return disk;
+}
+
+int disk_create(const char *diskname, size_t count)
+{
+	int fd, ret = 0;
+
+	if (!diskname) {
+		block_error("invalid file diskname");
+		return -1;
+	}
+
+	fd = open(diskname, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		perror("open");
+		return -1;
+	}
+
+	/* Leave every block as a hole, which reads as zeros */
+	if (ftruncate(fd, (off_t)count * BLOCK_SIZE) < 0) {
+		perror("ftruncate");
+		ret = -1;
+	}
+
+	close(fd);
+	return ret;
+}
+
+int disk_sync(struct disk *disk)
+{
+	if (!disk) {
+		block_error("no disk currently open");
+		return -1;
+	}
+
+	return disk->backend->flush(disk->ctx);
+}
+
+int disk_close(struct disk *disk)
+{
+	int ret;
+
+	if (!disk) {
+		block_error("no disk currently open");
+		return -1;
+	}
+
+	aio_stop(disk);
+
+	ret = disk->backend->close(disk->ctx);
+	free(disk);
+
+	return ret;
+}
+
+int disk_count(struct disk *disk)
+{
+	if (!disk) {
 		block_error("no disk currently open");
 		return -1;
 	}
 
-	close(disk.fd);
+	return disk->bcount;
+}
+
+int disk_set_block_size(struct disk *disk, size_t block_size)
+{
+	size_t scale, count;
+
+	if (!disk) {
+		block_error("no disk currently open");
+		return -1;
+	}
 
-	disk.fd = INVALID_FD;
+	scale = block_size / BLOCK_SIZE;
+	if (block_size < BLOCK_SIZE || block_size & (block_size - 1)) {
+		block_error("invalid block size %zu", block_size);
+		return -1;
+	}
 
+	count = disk->backend->count(disk->ctx);
+	if (count % scale) {
+		block_error("disk size not a multiple of the block size (%zu)",
+			    block_size);
+		return -1;
+	}
+
+	disk->bcount = count / scale;
+	disk->block_size = block_size;
 	return 0;
 }
 
-int block_disk_count(void)
+size_t disk_block_size(struct disk *disk)
+{
+	return disk->block_size;
+}
+
+/* Transfer a run of physically adjacent blocks through the backend, which
+ * counts in %BLOCK_SIZE blocks */
+static int block_xfer_run(struct disk *disk, int write, size_t block,
+			  const struct iovec *iov, int iovcnt)
 {
-	if (disk.fd == INVALID_FD) {
+	block *= disk->block_size / BLOCK_SIZE;
+	if (write)
+		return disk->backend->write(disk->ctx, block, iov, iovcnt);
+	return disk->backend->read(disk->ctx, block, iov, iovcnt);
+}
+
+int disk_write(struct disk *disk, size_t block, const void *buf)
+{
+	struct iovec iov = { .iov_base = (void *)buf };
+
+	if (!disk) {
 		block_error("no disk currently open");
 		return -1;
 	}
+	iov.iov_len = disk->block_size;
 
-	return disk.bcount;
+	if (block >= disk->bcount) {
+		block_error("block index out of bounds (%zu/%zu)",
+			    block, disk->bcount);
+		return -1;
+	}
+
+	/* Perform the actual write into the disk */
+	return block_xfer_run(disk, 1, block, &iov, 1);
 }
 
-int block_write(size_t block, const void *buf)
+int disk_read(struct disk *disk, size_t block, void *buf)
 {
-	if (disk.fd == INVALID_FD) {
+	struct iovec iov = { .iov_base = buf };
+
+	if (!disk) {
 		block_error("no disk currently open");
 		return -1;
 	}
+	iov.iov_len = disk->block_size;
 
-	if (block >= disk.bcount) {
+	if (block >= disk->bcount) {
 		block_error("block index out of bounds (%zu/%zu)",
-			    block, disk.bcount);
+			    block, disk->bcount);
 		return -1;
 	}
 
-	/* Move to the specified block number */
-	if (lseek(disk.fd, block * BLOCK_SIZE, SEEK_SET) < 0) {
-		perror("lseek");
+	/* Perform the actual read from the disk */
+	return block_xfer_run(disk, 0, block, &iov, 1);
+}
+
+static int block_xferv(struct disk *disk, int write, const size_t *blocks,
+		       void *const *bufs, size_t count)
+{
+	struct iovec iov[BLOCK_RUN_MAX];
+	size_t i, n;
+
+	if (!disk) {
+		block_error("no disk currently open");
 		return -1;
 	}
 
-	/* Perform the actual write into the disk image */
-	if (write(disk.fd, buf, BLOCK_SIZE) < 0) {
-		perror("write");
+	for (i = 0; i < count; i += n) {
+		/* Gather the longest run of adjacent blocks starting at i */
+		for (n = 0; i + n < count && n < BLOCK_RUN_MAX; n++) {
+			if (blocks[i + n] >= disk->bcount) {
+				block_error("block index out of bounds (%zu/%zu)",
+					    blocks[i + n], disk->bcount);
+				return -1;
+			}
+			if (n && blocks[i + n] != blocks[i] + n)
+				break;
+			iov[n].iov_base = bufs[i + n];
+			iov[n].iov_len = disk->block_size;
+		}
+
+		if (block_xfer_run(disk, write, blocks[i], iov, n))
+			return -1;
+	}
+
+	return 0;
+}
+
+int disk_writev(struct disk *disk, const size_t *blocks,
+		const void *const *bufs, size_t count)
+{
+	return block_xferv(disk, 1, blocks, (void *const *)bufs, count);
+}
+
+int disk_readv(struct disk *disk, const size_t *blocks, void *const *bufs,
+	       size_t count)
+{
+	return block_xferv(disk, 0, blocks, bufs, count);
+}
+
+/* Synchronously perform (the rest of) an asynchronous request */
+static int aio_req_xfer(struct disk *disk, struct aio_req *req, size_t done)
+{
+	struct iovec iov = {
+		.iov_base = req->buf + done,
+		.iov_len = req->nblocks * disk->block_size - done,
+	};
+
+	/* Resuming io_uring's partial transfer in the middle of a block */
+	if (done % disk->block_size) {
+		off_t pos = req->block * disk->block_size + done;
+		ssize_t ret;
+
+		while (iov.iov_len) {
+			if (req->write)
+				ret = pwrite(disk->aio_fd, iov.iov_base,
+					     iov.iov_len, pos);
+			else
+				ret = pread(disk->aio_fd, iov.iov_base,
+					    iov.iov_len, pos);
+			if (ret < 0 && errno == EINTR)
+				continue;
+			if (ret <= 0) {
+				perror(req->write ? "pwrite" : "pread");
+				return -1;
+			}
+			iov.iov_base = (char *)iov.iov_base + ret;
+			iov.iov_len -= ret;
+			pos += ret;
+		}
+		return 0;
+	}
+
+	return block_xfer_run(disk, req->write,
+			      req->block + done / disk->block_size, &iov, 1);
+}
+
+/*
+ * io_uring engine
+ */
+static int uring_enter(struct disk *disk, unsigned to_submit,
+		       unsigned min_complete)
+{
+	int ret;
+
+	do {
+		ret = syscall(__NR_io_uring_enter, disk->ring.fd, to_submit,
+			      min_complete,
+			      min_complete ? IORING_ENTER_GETEVENTS : 0,
+			      NULL, 0);
+	} while (ret < 0 && errno == EINTR);
+
+	if (ret < 0) {
+		perror("io_uring_enter");
 		return -1;
 	}
 
+	disk->ring.queued -= ret;
+	disk->ring.inflight += ret;
+
 	return 0;
 }
 
-int block_read(size_t block, void *buf)
+/* Reap every completion currently posted in the CQ ring */
+static void uring_reap(struct disk *disk)
+{
+	struct aio_ring *r = &disk->ring;
+	unsigned head = *r->cq_head;
+	unsigned tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+
+	for (; head != tail; head++) {
+		struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+		struct aio_req *req = &r->reqs[cqe->user_data];
+
+		if (cqe->res < 0) {
+			block_error("%s of block %zu failed: %s",
+				    req->write ? "write" : "read", req->block,
+				    strerror(-cqe->res));
+			disk->aio_error = 1;
+		} else if ((size_t)cqe->res < req->nblocks * disk->block_size) {
+			if (aio_req_xfer(disk, req, cqe->res))
+				disk->aio_error = 1;
+		}
+
+		r->free_slots[r->nfree++] = cqe->user_data;
+		r->inflight--;
+	}
+
+	__atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+}
+
+static int uring_submit(struct disk *disk, struct aio_req *req)
+{
+	struct aio_ring *r = &disk->ring;
+	struct io_uring_sqe *sqe;
+	unsigned tail, idx, slot;
+
+	/* Make room by waiting for at least one request to complete */
+	while (!r->nfree) {
+		if (uring_enter(disk, r->queued, 1))
+			return -1;
+		uring_reap(disk);
+	}
+
+	slot = r->free_slots[--r->nfree];
+	r->reqs[slot] = *req;
+
+	tail = *r->sq_tail;
+	idx = tail & *r->sq_mask;
+	sqe = &r->sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = req->write ? IORING_OP_WRITE : IORING_OP_READ;
+	sqe->fd = disk->aio_fd;
+	sqe->addr = (unsigned long)req->buf;
+	sqe->len = req->nblocks * disk->block_size;
+	sqe->off = req->block * disk->block_size;
+	sqe->user_data = slot;
+	r->sq_array[idx] = idx;
+	__atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	r->queued++;
+
+	if (r->queued >= AIO_SUBMIT_BATCH)
+		return uring_enter(disk, r->queued, 0);
+
+	return 0;
+}
+
+static int uring_wait(struct disk *disk)
+{
+	struct aio_ring *r = &disk->ring;
+
+	while (r->queued || r->inflight) {
+		if (uring_enter(disk, r->queued, r->queued + r->inflight))
+			return -1;
+		uring_reap(disk);
+	}
+
+	return 0;
+}
+
+static void uring_teardown(struct disk *disk)
+{
+	struct aio_ring *r = &disk->ring;
+
+	if (r->sqes)
+		munmap(r->sqes, r->sqes_size);
+	if (r->cq_ptr)
+		munmap(r->cq_ptr, r->cq_size);
+	if (r->sq_ptr)
+		munmap(r->sq_ptr, r->sq_size);
+	close(r->fd);
+	memset(r, 0, sizeof(*r));
+}
+
+static int uring_setup(struct disk *disk)
+{
+	struct aio_ring *r = &disk->ring;
+	struct io_uring_params p;
+	unsigned i;
+
+	memset(r, 0, sizeof(*r));
+	memset(&p, 0, sizeof(p));
+	r->fd = syscall(__NR_io_uring_setup, AIO_DEPTH, &p);
+	if (r->fd < 0)
+		return -1;
+
+	r->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	r->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+
+	r->sq_ptr = mmap(NULL, r->sq_size, PROT_READ | PROT_WRITE,
+			 MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+	r->cq_ptr = mmap(NULL, r->cq_size, PROT_READ | PROT_WRITE,
+			 MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+	r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE,
+		       MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+	if (r->sq_ptr == MAP_FAILED || r->cq_ptr == MAP_FAILED ||
+	    r->sqes == MAP_FAILED) {
+		if (r->sq_ptr == MAP_FAILED)
+			r->sq_ptr = NULL;
+		if (r->cq_ptr == MAP_FAILED)
+			r->cq_ptr = NULL;
+		if (r->sqes == MAP_FAILED)
+			r->sqes = NULL;
+		uring_teardown(disk);
+		return -1;
+	}
+
+	r->sq_tail = (unsigned *)((char *)r->sq_ptr + p.sq_off.tail);
+	r->sq_mask = (unsigned *)((char *)r->sq_ptr + p.sq_off.ring_mask);
+	r->sq_array = (unsigned *)((char *)r->sq_ptr + p.sq_off.array);
+	r->cq_head = (unsigned *)((char *)r->cq_ptr + p.cq_off.head);
+	r->cq_tail = (unsigned *)((char *)r->cq_ptr + p.cq_off.tail);
+	r->cq_mask = (unsigned *)((char *)r->cq_ptr + p.cq_off.ring_mask);
+	r->cqes = (struct io_uring_cqe *)((char *)r->cq_ptr + p.cq_off.cqes);
+
+	for (i = 0; i < AIO_DEPTH; i++)
+		r->free_slots[r->nfree++] = i;
+
+	return 0;
+}
+
+/*
+ * Thread pool engine
+ */
+static void *pool_worker(void *arg)
+{
+	struct disk *disk = arg;
+	struct aio_pool *pool = &disk->pool;
+	struct aio_req req;
+	int ret;
+
+	pthread_mutex_lock(&pool->lock);
+	for (;;) {
+		while (!pool->count && !pool->stop)
+			pthread_cond_wait(&pool->work, &pool->lock);
+		if (!pool->count)
+			break;
+
+		req = pool->queue[pool->head];
+		pool->head = (pool->head + 1) % AIO_DEPTH;
+		pool->count--;
+		pool->busy++;
+		pthread_mutex_unlock(&pool->lock);
+
+		ret = aio_req_xfer(disk, &req, 0);
+
+		pthread_mutex_lock(&pool->lock);
+		if (ret)
+			disk->aio_error = 1;
+		pool->busy--;
+		pthread_cond_broadcast(&pool->done);
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	return NULL;
+}
+
+static int pool_submit(struct disk *disk, struct aio_req *req)
+{
+	struct aio_pool *pool = &disk->pool;
+
+	pthread_mutex_lock(&pool->lock);
+	while (pool->count == AIO_DEPTH)
+		pthread_cond_wait(&pool->done, &pool->lock);
+	pool->queue[(pool->head + pool->count) % AIO_DEPTH] = *req;
+	pool->count++;
+	pthread_cond_signal(&pool->work);
+	pthread_mutex_unlock(&pool->lock);
+
+	return 0;
+}
+
+static int pool_wait(struct disk *disk)
+{
+	struct aio_pool *pool = &disk->pool;
+
+	pthread_mutex_lock(&pool->lock);
+	while (pool->count || pool->busy)
+		pthread_cond_wait(&pool->done, &pool->lock);
+	pthread_mutex_unlock(&pool->lock);
+
+	return 0;
+}
+
+static void pool_teardown(struct disk *disk)
+{
+	struct aio_pool *pool = &disk->pool;
+	int i;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->stop = 1;
+	pthread_cond_broadcast(&pool->work);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (i = 0; i < pool->nthreads; i++)
+		pthread_join(pool->threads[i], NULL);
+
+	pthread_cond_destroy(&pool->done);
+	pthread_cond_destroy(&pool->work);
+	pthread_mutex_destroy(&pool->lock);
+}
+
+static int pool_setup(struct disk *disk)
 {
-	if (disk.fd == INVALID_FD) {
+	struct aio_pool *pool = &disk->pool;
+
+	memset(pool, 0, sizeof(*pool));
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->work, NULL);
+	pthread_cond_init(&pool->done, NULL);
+
+	for (; pool->nthreads < AIO_THREADS; pool->nthreads++) {
+		if (pthread_create(&pool->threads[pool->nthreads], NULL,
+				   pool_worker, disk)) {
+			block_error("cannot create worker thread");
+			pool_teardown(disk);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Asynchronous engine selection
+ */
+static int aio_start(struct disk *disk)
+{
+	disk->aio = DISK_ENGINE_AUTO;
+	disk->aio_error = 0;
+
+	/* Backends without a file descriptor are served synchronously */
+	disk->aio_fd = disk->backend->fd ? disk->backend->fd(disk->ctx) :
+		INVALID_FD;
+	if (disk->aio_fd == INVALID_FD)
+		return 0;
+
+	if (disk->engine != DISK_ENGINE_THREADS && !uring_setup(disk)) {
+		disk->aio = DISK_ENGINE_URING;
+		return 0;
+	}
+
+	if (disk->engine == DISK_ENGINE_URING) {
+		block_error("io_uring is not available");
+		return -1;
+	}
+
+	if (pool_setup(disk))
+		return -1;
+	disk->aio = DISK_ENGINE_THREADS;
+
+	return 0;
+}
+
+static void aio_stop(struct disk *disk)
+{
+	if (disk->aio == DISK_ENGINE_URING) {
+		uring_wait(disk);
+		uring_teardown(disk);
+	} else if (disk->aio == DISK_ENGINE_THREADS) {
+		pool_wait(disk);
+		pool_teardown(disk);
+	}
+	disk->aio = DISK_ENGINE_AUTO;
+}
+
+static int block_submit(struct disk *disk, struct aio_req *req)
+{
+	if (!disk) {
 		block_error("no disk currently open");
 		return -1;
 	}
 
-	if (block >= disk.bcount) {
-		block_error("block index out of bounds (%zu/%zu)",
-			    block, disk.bcount);
+	if (!req->nblocks || req->block >= disk->bcount ||
+	    req->nblocks > disk->bcount - req->block) {
+		block_error("block run out of bounds (%zu+%zu/%zu)",
+			    req->block, req->nblocks, disk->bcount);
 		return -1;
 	}
 
-	/* Move to the specified block number */
-	if (lseek(disk.fd, block * BLOCK_SIZE, SEEK_SET) < 0) {
-		perror("lseek");
+	if (disk->aio == DISK_ENGINE_URING)
+		return uring_submit(disk, req);
+	if (disk->aio == DISK_ENGINE_THREADS)
+		return pool_submit(disk, req);
+
+	/* No engine: complete the request right away */
+	if (aio_req_xfer(disk, req, 0))
+		disk->aio_error = 1;
+
+	return 0;
+}
+
+int disk_submit_write(struct disk *disk, size_t block, const void *buf,
+		      size_t nblocks)
+{
+	struct aio_req req = {
+		.write = 1,
+		.block = block,
+		.buf = (char *)buf,
+		.nblocks = nblocks,
+	};
+
+	return block_submit(disk, &req);
+}
+
+int disk_submit_read(struct disk *disk, size_t block, void *buf,
+		     size_t nblocks)
+{
+	struct aio_req req = {
+		.write = 0,
+		.block = block,
+		.buf = buf,
+		.nblocks = nblocks,
+	};
+
+	return block_submit(disk, &req);
+}
+
+int disk_kick(struct disk *disk)
+{
+	if (!disk) {
+		block_error("no disk currently open");
+		return -1;
+	}
+
+	if (disk->aio == DISK_ENGINE_URING && disk->ring.queued)
+		return uring_enter(disk, disk->ring.queued, 0);
+
+	return 0;
+}
+
+int disk_wait(struct disk *disk)
+{
+	int ret = 0;
+
+	if (!disk) {
+		block_error("no disk currently open");
 		return -1;
 	}
 
-	/* Perform the actual read from the disk image */
-	if (read(disk.fd, buf, BLOCK_SIZE) < 0) {
-		perror("read");
+	if (disk->aio == DISK_ENGINE_URING)
+		ret = uring_wait(disk);
+	else if (disk->aio == DISK_ENGINE_THREADS)
+		ret = pool_wait(disk);
+
+	if (disk->aio_error)
+		ret = -1;
+	disk->aio_error = 0;
+
+	return ret;
+}
+
+/*
+ * Default disk
+ */
+int block_disk_set_engine(int engine)
+{
+	if (!engine_valid(engine))
+		return -1;
+
+	if (default_disk) {
+		block_error("disk already open");
 		return -1;
 	}
 
+	default_engine = engine;
+
 	return 0;
 }
 
+int block_disk_open_backend(const char *diskname,
+			    const struct disk_backend *backend)
+{
+	if (default_disk) {
+		block_error("disk already open");
+		return -1;
+	}
+
+	default_disk = disk_open(diskname, backend, default_engine);
+
+	return default_disk ? 0 : -1;
+}
+
+int block_disk_open(const char *diskname)
+{
+	return block_disk_open_backend(diskname, &disk_file_backend);
+}
+
+int block_disk_sync(void)
+{
+	return disk_sync(default_disk);
+}
+
+int block_disk_close(void)
+{
+	int ret;
+
+	if (!default_disk) {
+		block_error("no disk currently open");
+		return -1;
+	}
+
+	ret = disk_close(default_disk);
+	default_disk = NULL;
+
+	return ret;
+}
+
+int block_disk_count(void)
+{
+	return disk_count(default_disk);
+}
+
+int block_write(size_t block, const void *buf)
+{
+	return disk_write(default_disk, block, buf);
+}
+
+int block_read(size_t block, void *buf)
+{
+	return disk_read(default_disk, block, buf);
+}
+
+int block_writev(const size_t *blocks, const void *const *bufs, size_t count)
+{
+	return disk_writev(default_disk, blocks, bufs, count);
+}
+
+int block_readv(const size_t *blocks, void *const *bufs, size_t count)
+{
+	return disk_readv(default_disk, blocks, bufs, count);
+}
+
+int block_submit_write(size_t block, const void *buf, size_t nblocks)
+{
+	return disk_submit_write(default_disk, block, buf, nblocks);
+}
+
+int block_submit_read(size_t block, void *buf, size_t nblocks)
+{
+	return disk_submit_read(default_disk, block, buf, nblocks);
+}
+
+int block_kick(void)
+{
+	return disk_kick(default_disk);
+}
+
+int block_wait(void)
+{
+	return disk_wait(default_disk);
+}
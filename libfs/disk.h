@@ -3,9 +3,77 @@
 
 #include <stddef.h> /* for size_t definition */
 
-/** Size of a disk block in bytes */
+/**
+ * Size of a disk block in bytes. Backends always count in blocks of this size,
+ * disk instances can use larger blocks, see disk_set_block_size().
+ */
 #define BLOCK_SIZE 4096
 
+struct iovec;
+
+/**
+ * struct disk_backend - Block device backend
+ * @name: Name of the backend
+ * @open: Open device @diskname and return a private context, or NULL on
+ *        failure
+ * @close: Make every write durable and release the context
+ * @count: Return the number of blocks of the device
+ * @read: Read the run of adjacent blocks starting at @block into the @iovcnt
+ *        buffers of @iov, whose lengths are multiples of %BLOCK_SIZE. Return
+ *        -1 on failure, 0 otherwise
+ * @write: Write the buffers of @iov in the run of adjacent blocks starting at
+ *         @block. Return -1 on failure, 0 otherwise
+ * @flush: Make every write durable. Return -1 on failure, 0 otherwise
+ * @fd: Optional. Return a file descriptor on which positional I/O at offset
+ *      block * %BLOCK_SIZE is equivalent to @read and @write, which lets the
+ *      asynchronous engines serve requests directly, or -1
+ *
+ * Blocks are checked against @count before reaching @read or @write, which
+ * may be called from several threads at once on different blocks. Backends
+ * without @fd complete asynchronous requests synchronously.
+ */
+struct disk_backend {
+	const char *name;
+	void *(*open)(const char *diskname);
+	int (*close)(void *ctx);
+	size_t (*count)(void *ctx);
+	int (*read)(void *ctx, size_t block, const struct iovec *iov,
+		    int iovcnt);
+	int (*write)(void *ctx, size_t block, const struct iovec *iov,
+		     int iovcnt);
+	int (*flush)(void *ctx);
+	int (*fd)(void *ctx);
+};
+
+/** Image file accessed with pread()/pwrite() (default backend) */
+extern const struct disk_backend disk_file_backend;
+
+/** Image file mapped in memory, flushed with msync() */
+extern const struct disk_backend disk_mmap_backend;
+
+/** Image file loaded in memory, modified blocks saved back on flush/close */
+extern const struct disk_backend disk_ram_backend;
+
+/** Asynchronous engines, see block_disk_set_engine() */
+#define DISK_ENGINE_AUTO	0	/* io_uring, or thread pool if missing */
+#define DISK_ENGINE_URING	1	/* io_uring only */
+#define DISK_ENGINE_THREADS	2	/* thread pool running pread()/pwrite() */
+
+/**
+ * block_disk_set_engine - Select the asynchronous engine
+ * @engine: Asynchronous engine
+ *
+ * Select the engine serving block_submit_read() and block_submit_write() for
+ * the next virtual disk file opened with block_disk_open(), if its backend
+ * provides a file descriptor. The default,
+ * %DISK_ENGINE_AUTO, uses io_uring when the kernel provides it and falls back
+ * to a pool of worker threads otherwise.
+ *
+ * Return: -1 if @engine is invalid or if a virtual disk file is currently
+ * open. 0 otherwise.
+ */
+int block_disk_set_engine(int engine);
+
 /**
  * block_disk_open - Open virtual disk file
  * @diskname: Name of the virtual disk file
@@ -19,6 +87,19 @@
  */
 int block_disk_open(const char *diskname);
 
+/**
+ * block_disk_open_backend - Open virtual disk with a given backend
+ * @diskname: Name of the virtual disk
+ * @backend: Backend serving the disk, or NULL for %disk_file_backend
+ *
+ * Same as block_disk_open(), with the disk served by @backend.
+ *
+ * Return: -1 if @diskname is invalid, if the backend cannot open it or if a
+ * virtual disk is already open. 0 otherwise.
+ */
+int block_disk_open_backend(const char *diskname,
+			    const struct disk_backend *backend);
+
 /**
  * block_disk_close - Close virtual disk file
  *
@@ -26,6 +107,17 @@ int block_disk_open(const char *diskname);
  */
 int block_disk_close(void);
 
+/**
+ * block_disk_sync - Flush virtual disk file
+ *
+ * Make sure that every block written so far has reached the virtual disk file,
+ * through the flush operation of the disk's backend.
+ *
+ * Return: -1 if there was no virtual disk file opened or if flushing fails. 0
+ * otherwise.
+ */
+int block_disk_sync(void);
+
 /**
  * block_disk_count - Get disk's block count
  *
@@ -60,5 +152,180 @@ int block_write(size_t block, const void *buf);
  */
 int block_read(size_t block, void *buf);
 
+/**
+ * block_writev - Write multiple blocks to disk
+ * @blocks: Array of indexes of the blocks to write to
+ * @bufs: Array of data buffers, one per block
+ * @count: Number of entries in @blocks and @bufs
+ *
+ * Write the content of each buffer @bufs[i] (%BLOCK_SIZE bytes) in the virtual
+ * disk's block @blocks[i]. Runs of physically adjacent blocks are sent to the
+ * disk with a single vectored write.
+ *
+ * Return: -1 if any block is out of bounds or inaccessible, or if a writing
+ * operation fails. 0 otherwise.
+ */
+int block_writev(const size_t *blocks, const void *const *bufs, size_t count);
+
+/**
+ * block_readv - Read multiple blocks from disk
+ * @blocks: Array of indexes of the blocks to read from
+ * @bufs: Array of data buffers to be filled, one per block
+ * @count: Number of entries in @blocks and @bufs
+ *
+ * Read the content of each virtual disk's block @blocks[i] (%BLOCK_SIZE bytes)
+ * into buffer @bufs[i]. Runs of physically adjacent blocks are fetched from
+ * the disk with a single vectored read.
+ *
+ * Return: -1 if any block is out of bounds or inaccessible, or if a reading
+ * operation fails. 0 otherwise.
+ */
+int block_readv(const size_t *blocks, void *const *bufs, size_t count);
+
+/**
+ * block_submit_write - Queue an asynchronous write of adjacent blocks
+ * @block: Index of the first block to write to
+ * @buf: Data buffer of @nblocks * %BLOCK_SIZE bytes to write in the blocks
+ * @nblocks: Number of adjacent blocks to write
+ *
+ * Queue the write of buffer @buf in the virtual disk's blocks @block to
+ * @block + @nblocks - 1. Up to 64 requests are kept in flight at once. The
+ * request may not have completed when the function returns: @buf must stay
+ * untouched until the next call to block_wait().
+ *
+ * Return: -1 if the blocks are out of bounds or inaccessible, or if the request
+ * cannot be queued. 0 otherwise.
+ */
+int block_submit_write(size_t block, const void *buf, size_t nblocks);
+
+/**
+ * block_submit_read - Queue an asynchronous read of adjacent blocks
+ * @block: Index of the first block to read from
+ * @buf: Data buffer of @nblocks * %BLOCK_SIZE bytes to be filled
+ * @nblocks: Number of adjacent blocks to read
+ *
+ * Queue the read of the virtual disk's blocks @block to @block + @nblocks - 1
+ * into buffer @buf. The content of @buf is only valid after the next call to
+ * block_wait().
+ *
+ * Return: -1 if the blocks are out of bounds or inaccessible, or if the request
+ * cannot be queued. 0 otherwise.
+ */
+int block_submit_read(size_t block, void *buf, size_t nblocks);
+
+/**
+ * block_kick - Start queued asynchronous requests
+ *
+ * Requests queued with block_submit_read() or block_submit_write() may be held
+ * back so that they reach the kernel in batches. Hand all of them to the
+ * engine now, without waiting for their completion.
+ *
+ * Return: -1 if there was no virtual disk file opened, or if the requests
+ * cannot be started. 0 otherwise.
+ */
+int block_kick(void);
+
+/**
+ * block_wait - Wait for the completion of asynchronous requests
+ *
+ * Wait until every request queued with block_submit_read() or
+ * block_submit_write() has completed.
+ *
+ * Return: -1 if there was no virtual disk file opened, or if any of the
+ * requests completed since the previous call failed. 0 otherwise.
+ */
+int block_wait(void);
+
+/**
+ * struct disk - Open virtual disk
+ *
+ * The block_*() functions above operate on a single default disk. Several
+ * disks can be open at the same time through the disk_*() functions below,
+ * which take the disk as their first argument and otherwise behave like their
+ * block_*() counterparts. Each disk has its own asynchronous engine, so
+ * different disks can be driven from different threads. The synchronous
+ * transfers of a given disk, disk_read(), disk_write(), disk_readv() and
+ * disk_writev(), are positional and can run in several threads at once; its
+ * asynchronous requests must be submitted and waited for by one thread at a
+ * time.
+ */
+struct disk;
+
+/**
+ * disk_open - Open a virtual disk instance
+ * @diskname: Name of the virtual disk
+ * @backend: Backend serving the disk, or NULL for %disk_file_backend
+ * @engine: Asynchronous engine, see block_disk_set_engine()
+ *
+ * Return: NULL if @diskname or @engine is invalid, or if the backend cannot
+ * open the disk. The new disk otherwise.
+ */
+struct disk *disk_open(const char *diskname,
+		       const struct disk_backend *backend, int engine);
+
+/**
+ * disk_create - Create an empty virtual disk
+ * @diskname: Name of the virtual disk file
+ * @count: Number of blocks of %BLOCK_SIZE bytes
+ *
+ * Create the image file @diskname, or truncate it if it exists, to hold @count
+ * blocks. Every block reads as zeros; none is written, so the file stays
+ * sparse on file systems that support it.
+ *
+ * Return: -1 if @diskname is invalid or the file cannot be created or resized.
+ * 0 otherwise.
+ */
+int disk_create(const char *diskname, size_t count);
+
+/**
+ * disk_close - Close a virtual disk instance
+ * @disk: Disk returned by disk_open()
+ *
+ * Wait for the disk's asynchronous requests, close it and free @disk.
+ *
+ * Return: -1 if @disk is NULL or if its backend fails to close it. 0
+ * otherwise.
+ */
+int disk_close(struct disk *disk);
+
+/**
+ * disk_set_block_size - Change the block size of a virtual disk instance
+ * @disk: Disk returned by disk_open()
+ * @block_size: New block size in bytes, a power of two no smaller than
+ *              %BLOCK_SIZE
+ *
+ * Make every other disk_*() function of @disk count and transfer blocks of
+ * @block_size bytes, and buffers hold @block_size bytes per block. Disks are
+ * opened with blocks of %BLOCK_SIZE bytes. Must not be called while
+ * asynchronous requests are pending.
+ *
+ * Return: -1 if @block_size is invalid, or if the size of the disk is not a
+ * multiple of it. 0 otherwise.
+ */
+int disk_set_block_size(struct disk *disk, size_t block_size);
+
+/**
+ * disk_block_size - Get the block size of a virtual disk instance
+ * @disk: Disk returned by disk_open()
+ *
+ * Return: Size of the blocks of @disk in bytes.
+ */
+size_t disk_block_size(struct disk *disk);
+
+int disk_sync(struct disk *disk);
+int disk_count(struct disk *disk);
+int disk_write(struct disk *disk, size_t block, const void *buf);
+int disk_read(struct disk *disk, size_t block, void *buf);
+int disk_writev(struct disk *disk, const size_t *blocks,
+		const void *const *bufs, size_t count);
+int disk_readv(struct disk *disk, const size_t *blocks, void *const *bufs,
+	       size_t count);
+int disk_submit_write(struct disk *disk, size_t block, const void *buf,
+		      size_t nblocks);
+int disk_submit_read(struct disk *disk, size_t block, void *buf,
+		     size_t nblocks);
+int disk_kick(struct disk *disk);
+int disk_wait(struct disk *disk);
+
 #endif /* _DISK_H */
 
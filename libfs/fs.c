@@ -1,15 +1,54 @@
 #include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
 #include <stdbool.h>
+#include <time.h>
+#include <sys/uio.h>
 
+#include "bitmap.h"
+#include "cache.h"
+#include "dirhash.h"
 #include "disk.h"
 #include "fs.h"
+#include "journal.h"
 
-#define FAT_EOC 0xFFFF
-#define fat_length(fat_amount) ((fat_amount)*BLOCK_SIZE/2)
+//end of a fat chain, as fat entries and first blocks read whatever their width on disk
+#define FAT_EOC 0xFFFFFFFF
+//super block signatures, of images with 16-bit fat entries and of wide images
+//with 32-bit fat entries and block counts
+#define SIGNATURE "ECS150FS"
+#define WIDE_SIGNATURE "ECS150FW"
+//maximum number of blocks queued before they are sent to the disk
+#define IO_BATCH 1024
+//initial readahead window in blocks once a descriptor reads sequentially
+#define READAHEAD_MIN 4
+//smallest default cache, in blocks, however large they are
+#define CACHE_MIN_BLOCKS 8
+//"JRNL", in the super block of images with a journal
+#define JOURNAL_SIGNATURE 0x4c4e524a
+//journal records: a run of fat entries or a root entry, with their new values
+//wide images log runs of fat entries as JREC_WIDE_FAT records, with 32-bit first
+//entry and count, as a fat block of large blocks holds more than 65535 entries
+#define JREC_FAT 1
+#define JREC_ROOT 2
+#define JREC_DIRENT 3
+#define JREC_WIDE_FAT 4
+#define JREC_ROOT_SIZE (2 + sizeof(root_entry))
+#define JREC_DIRENT_SIZE (5 + sizeof(root_entry))
+//"DIRX", in the super block of images whose directory spans several blocks
+#define DIR_SIGNATURE 0x58524944
+//"FREE", in the super block of wide images unmounted cleanly, along with their free block count
+#define FREE_SIGNATURE 0x45455246
+//root entry types, entries of images without subdirectories are all files
+#define ENTRY_FILE 0
+#define ENTRY_DIR 1
+//directory number of the root directory, the directory of root entry i is number i + 1
+#define ROOT_DIR 0
 
 //super block structure definition
 typedef struct superblock{
@@ -19,17 +58,68 @@ typedef struct superblock{
     uint16_t data_idx;
     uint16_t data_amount;
     uint8_t FAT_amount;
-    uint8_t padding[4079];
+    //journal region, zero on images without a journal
+    uint32_t journal_signature;
+    uint16_t journal_start;
+    uint16_t journal_blocks;
+    //first block chained after the root block, on images with an extended directory
+    uint32_t dir_signature;
+    uint16_t dir_start;
+    uint8_t padding[4065];
 }__attribute__((__packed__)) superblock;
 
-typedef uint16_t* FAT;
+//super block of wide images, the same fields with 32-bit block numbers and counts
+typedef struct wide_superblock{
+    uint64_t signature;
+    uint32_t total_amount;
+    uint32_t root_idx;
+    uint32_t data_idx;
+    uint32_t data_amount;
+    uint32_t FAT_amount;
+    uint32_t journal_signature;
+    uint32_t journal_start;
+    uint32_t journal_blocks;
+    uint32_t dir_signature;
+    uint32_t dir_start;
+    //size of every block including this one, 0 for BLOCK_SIZE
+    uint32_t block_size;
+    //free data blocks, only valid with the signature
+    uint32_t free_signature;
+    uint32_t free_blocks;
+    uint8_t padding[4036];
+}__attribute__((__packed__)) wide_superblock;
+
+//fields of the super block, whichever format it has on disk
+typedef struct geometry{
+    size_t total_amount;
+    size_t root_idx;
+    size_t data_idx;
+    size_t data_amount;
+    size_t FAT_amount;
+    uint32_t journal_signature;
+    size_t journal_start;
+    size_t journal_blocks;
+    uint32_t dir_signature;
+    size_t dir_start;
+    uint32_t free_signature;
+    size_t free_blocks;
+}geometry;
+
+//fat entries as read from disk, 16 or 32 bits each
+typedef void* FAT;
 
 //root entry structure definition
 typedef struct root_entry{
     uint8_t filename[16];
     uint32_t filesize;
     uint16_t data_start;
-    uint8_t padding[10];
+    //ENTRY_FILE or ENTRY_DIR, and directory number of the directory holding the entry
+    uint8_t type;
+    uint32_t parent;
+    //high bits of filesize and data_start on wide images
+    uint16_t filesize_high;
+    uint16_t data_start_high;
+    uint8_t padding[1];
 }__attribute__((__packed__)) root_entry;
 
 //file descriptor definition
@@ -37,81 +127,407 @@ typedef struct file_descriptor{
     int root_idx;
     size_t offset;
     //record the block index where the offset locates
-    uint16_t block_idx;
+    size_t block_idx;
     bool invalid_block;
+    //offset where the previous read ended, a read starting there is sequential
+    size_t ra_offset;
+    //number of blocks to read ahead, grows on sequential reads and shrinks otherwise
+    int ra_window;
+    //block the last readahead started from, reads within it don't start another one
+    size_t ra_block;
+    //slot of the lock of the file in file_locks
+    int lock_idx;
 }file_descriptor;
 
+//reader/writer lock of an open file, shared by the descriptors open on it
+typedef struct file_lock{
+    int root_idx;
+    int refs;
+    pthread_rwlock_t lock;
+}file_lock;
+
 typedef root_entry* root_dir;
 
-//global super block structure
-superblock super_block;
+//offset-to-block index of a file: the blocks of its chain in order, filled lazily
+//only the end of a chain ever changes, so the recorded prefix stays valid on appends
+typedef struct block_index{
+    uint32_t* blocks;
+    size_t count;
+    size_t capacity;
+}block_index;
+
+//blocks queued for asynchronous disk requests, adjacent blocks share a request
+typedef struct io_batch{
+    size_t blocks[IO_BATCH];
+    void* bufs[IO_BATCH];
+    size_t count;
+    bool write;
+    //whether submitting any of the requests failed
+    bool error;
+}io_batch;
 
-//global fat table
-FAT fat_array = NULL;
+//position of a transfer in the buffers of the caller, which is one buffer
+//unless the transfer is vectored
+typedef struct io_cursor{
+    const struct iovec* iov;
+    int iovcnt;
+    //buffer the transfer is at, and offset in it
+    int seg;
+    size_t seg_offset;
+}io_cursor;
 
-//global root entry array
-root_dir root;
+//file system instance, everything a mounted disk needs
+struct fs{
+    //disk holding the file system and cache in front of it
+    struct disk* disk;
+    struct cache* cache;
+    
+    //super block as read from disk, and its fields
+    superblock super_raw;
+    geometry super_block;
+    
+    //size of the blocks of the disk, always BLOCK_SIZE unless the image is wide,
+    //and root entries per directory block
+    size_t block_size;
+    size_t root_per_block;
+    //a block to write the super block from when blocks are larger than it, zeroed past it
+    char* super_buf;
+    
+    //fat table, with the size of its entries in bytes and the number of entries per block
+    FAT fat_array;
+    size_t fat_entry;
+    size_t fat_per_block;
+    //when the fat is read lazily, the fat blocks read so far (NULL once they all are),
+    //how many of them were read in order from the first one, and the free entries
+    //of the other blocks, known from the super block
+    struct bitmap* fat_loaded;
+    size_t fat_prefix;
+    size_t unloaded_free;
+    
+    //root entry array, entries of the root block then of the blocks chained after it
+    root_dir root;
+    size_t root_count;
+    //number of directory blocks, and fat index of each block after the root block
+    size_t dir_blocks;
+    uint32_t* dir_chain;
+    //root entries the arrays have room for
+    size_t root_capacity;
+    //root entries logged by the journal replay, applied once the directory is loaded
+    char* replayed;
+    size_t replayed_len;
+    size_t replayed_capacity;
+    
+    //file descriptor array
+    file_descriptor open_files[FS_OPEN_MAX_COUNT];
+    //locks of the open files, at most one per descriptor: reads hold them shared and
+    //release the instance lock while they transfer blocks, writes hold them exclusively
+    file_lock file_locks[FS_OPEN_MAX_COUNT];
+    
+    //block index of each root entry, kept while the file is open
+    block_index* indexes;
+    
+    //fat blocks and directory blocks modified since they were last written
+    struct bitmap* fat_dirty;
+    struct bitmap* dir_dirty;
+    
+    //record next free root entry
+    int root_next_free;
+    
+    //index of the filenames of each directory in the root array, the dentry cache every
+    //path component is resolved through, and bit set for each free root entry
+    struct dirhash* names;
+    struct bitmap* root_free_map;
+    //number of entries in the directory of each root entry, so a directory is known
+    //to be empty without scanning the root array
+    uint32_t* children;
+    //number of directories, file names only have paths once there is one
+    size_t dir_count;
+    
+    //bit set for each free fat entry of the fat blocks read, and FS_ALLOC_* policy picking them
+    struct bitmap* free_map;
+    int allocator;
+    
+    //largest readahead window in blocks, 0 when readahead is disabled
+    int readahead_max;
+    
+    //held by the handle functions, so the checkpoint thread sees consistent tables,
+    //it guards the fat, the root entries, the descriptors and the cache
+    pthread_mutex_t lock;
+    //held for a whole checkpoint, so that tables reach the disk in the order they were copied
+    pthread_mutex_t checkpoint_lock;
+    //signaled to wake the checkpoint thread early or to stop it
+    pthread_cond_t checkpoint_cond;
+    pthread_t flusher;
+    bool flusher_running;
+    bool flusher_stop;
+    //checkpoint interval in milliseconds and dirty table blocks threshold, 0 when unused
+    int checkpoint_ms;
+    size_t checkpoint_dirty;
+    //whether data was written since the last checkpoint
+    bool data_dirty;
+    
+    //copy of the dirty tables taken by the last checkpoint, written without the lock held
+    //with the disk block and the fat or directory block index of each copied block
+    size_t* snap_blocks;
+    size_t* snap_index;
+    const void** snap_bufs;
+    char* snap_data;
+    size_t snap_count;
+    size_t snap_capacity;
+    
+    //journal, or NULL, with the fat and root entries changed since the last commit
+    struct journal* journal;
+    struct bitmap* journal_fat;
+    struct bitmap* journal_root;
+    //records of the next transaction
+    char* journal_rec;
+    //whether some changes are missing from the journal, so that it needs a checkpoint
+    bool journal_stale;
+};
 
-//global file descriptor array
-file_descriptor open_files[FS_OPEN_MAX_COUNT];
+//instance behind the functions without a handle
+fs_t* default_fs = NULL;
 
-//global flag for recording changing tables
-bool change_table = false;
+//submit the queued blocks of a batch without waiting for them
+//blocks that are adjacent on disk and in memory go in a single request
+void batch_submit(fs_t* fs, io_batch* batch){
+    size_t i, n;
+    int ret;
+    for (i = 0; i < batch->count; i += n){
+        for (n = 1; i + n < batch->count; n++){
+            if (batch->blocks[i + n] != batch->blocks[i] + n || batch->bufs[i + n] != batch->bufs[i] + n * fs->block_size)
+                break;
+        }
+        if (batch->write)
+            ret = disk_submit_write(fs->disk, batch->blocks[i], batch->bufs[i], n);
+        else
+            ret = disk_submit_read(fs->disk, batch->blocks[i], batch->bufs[i], n);
+        if (ret == -1)
+            batch->error = true;
+    }
+    batch->count = 0;
+}
 
-//global flag for mounting
-bool mounted = false;
+//submit the queued blocks of a batch and wait for all its requests
+int batch_flush(fs_t* fs, io_batch* batch){
+    batch_submit(fs, batch);
+    if (disk_wait(fs->disk) == -1)
+        batch->error = true;
+    return batch->error ? -1 : 0;
+}
 
-//record next free root entry and next free position in fat table
-int root_next_free = 0;
-int fat_next_free = 1;
+//queue one block in a batch, submitting the batch when it is full
+int batch_add(fs_t* fs, io_batch* batch, size_t block, void* buff){
+    batch->blocks[batch->count] = block;
+    batch->bufs[batch->count] = buff;
+    if (++batch->count == IO_BATCH)
+        batch_submit(fs, batch);
+    return batch->error ? -1 : 0;
+}
 
 //reading multiple blocks to buff
-int block_to_buffer(size_t block, void* buff, size_t length){
+int block_to_buffer(fs_t* fs, size_t block, void* buff, size_t length){
+    io_batch batch = { .count = 0, .write = false, .error = false };
     for (size_t i = block; i < block + length; i++){
-        if(block_read(i, buff + (i - block) * BLOCK_SIZE) == -1)
+        if (batch_add(fs, &batch, i, buff + (i - block) * fs->block_size) == -1)
             return -1;
     }
-    return 0;
+    return batch_flush(fs, &batch);
 }
 
-//writing buff multiple blocks
-int buffer_to_block(size_t block, void* buff, size_t length){
-    for (size_t i = block; i < block + length; i++){
-        if(block_write(i, buff + (i - block) * BLOCK_SIZE) == -1)
-            return -1;
+//read a fat block on first use when the fat is read lazily, and index its free entries
+int load_fat_block(fs_t* fs, size_t block){
+    size_t first = block * fs->fat_per_block, end = first + fs->fat_per_block;
+    
+    if (disk_read(fs->disk, 1 + block, (char*) fs->fat_array + block * fs->block_size) == -1)
+        return -1;
+    bitmap_set(fs->fat_loaded, block);
+    if (end > fs->super_block.data_amount)
+        end = fs->super_block.data_amount;
+    for (size_t i = first > 0 ? first : 1; i < end; i++){
+        if (fs->fat_entry == sizeof(uint16_t) ? ((uint16_t*) fs->fat_array)[i] == 0 : ((uint32_t*) fs->fat_array)[i] == 0){
+            bitmap_set(fs->free_map, i);
+            if (fs->unloaded_free > 0)
+                fs->unloaded_free--;
+        }
+    }
+    
+    //once every block is read, the fat is used as if it had been read at mount
+    while (fs->fat_prefix < fs->super_block.FAT_amount && bitmap_test(fs->fat_loaded, fs->fat_prefix))
+        fs->fat_prefix++;
+    if (fs->fat_prefix == fs->super_block.FAT_amount){
+        bitmap_destroy(fs->fat_loaded);
+        fs->fat_loaded = NULL;
+        fs->unloaded_free = 0;
     }
     return 0;
 }
 
+//make sure the fat block holding entry i has been read
+bool fat_ready(fs_t* fs, size_t i){
+    return fs->fat_loaded == NULL || bitmap_test(fs->fat_loaded, i / fs->fat_per_block) || load_fat_block(fs, i / fs->fat_per_block) == 0;
+}
+
+//read a fat entry, the end of a chain is FAT_EOC whatever the width of the entries
+size_t get_fat(fs_t* fs, size_t i){
+    if (!fat_ready(fs, i)) //fat block couldn't be read (should not happen), end the chain there
+        return FAT_EOC;
+    if (fs->fat_entry == sizeof(uint16_t)){
+        uint16_t value = ((uint16_t*) fs->fat_array)[i];
+        return value == 0xFFFF ? FAT_EOC : value;
+    }
+    return ((uint32_t*) fs->fat_array)[i];
+}
+
+//first data block of a root entry, FAT_EOC for an empty file
+size_t entry_start(fs_t* fs, const root_entry* entry){
+    if (fs->fat_entry == sizeof(uint16_t))
+        return entry->data_start == 0xFFFF ? FAT_EOC : entry->data_start;
+    return entry->data_start | (size_t) entry->data_start_high << 16;
+}
+
+//FAT_EOC is truncated to the end of chain of 16-bit entries
+void set_entry_start(fs_t* fs, root_entry* entry, size_t block){
+    entry->data_start = block;
+    if (fs->fat_entry != sizeof(uint16_t))
+        entry->data_start_high = block >> 16;
+}
+
+//size of the file of a root entry, up to 48 bits on wide images
+uint64_t entry_size(fs_t* fs, const root_entry* entry){
+    if (fs->fat_entry == sizeof(uint16_t))
+        return entry->filesize;
+    return entry->filesize | (uint64_t) entry->filesize_high << 32;
+}
+
+void set_entry_size(fs_t* fs, root_entry* entry, uint64_t size){
+    entry->filesize = size;
+    if (fs->fat_entry != sizeof(uint16_t))
+        entry->filesize_high = size >> 32;
+}
+
 //count the number of free entries in fat table
-int fat_free(){
-    int count = 0;
-    for (int i = 1; i < super_block.data_amount; i++){
-        if (fat_array[i] == 0)
+size_t fat_free(fs_t* fs){
+    if (fs->allocator == FS_ALLOC_BITMAP)
+        return bitmap_weight(fs->free_map) + fs->unloaded_free;
+    
+    size_t count = 0;
+    for (size_t i = 1; i < fs->super_block.data_amount; i++){
+        if (get_fat(fs, i) == 0)
             count++;
     }
     return count;
 }
 
 //count the number of free entries in root array
-int root_free(){
-    int count = 0;
-    for (int i = 0; i < FS_FILE_MAX_COUNT; i++){
-        if (root[i].filename[0] == '\0')
-            count++;
-    }
-    return count;
+int root_free(fs_t* fs){
+    return bitmap_weight(fs->root_free_map);
 }
 
 //find the next free entry in the fat table
-int find_fat_next_free(){
-    for (int i = 1; i < super_block.data_amount; i++){
-        if (fat_array[i] == 0)
+long find_fat_next_free(fs_t* fs){
+    if (fs->allocator == FS_ALLOC_BITMAP){
+        size_t i = bitmap_find_next(fs->free_map, 1);
+        return i == BITMAP_NONE ? -1 : (long) i;
+    }
+    
+    for (size_t i = 1; i < fs->super_block.data_amount; i++){
+        if (get_fat(fs, i) == 0)
             return i;
     }
     return -1;
 }
 
+//change a fat entry and remember that its fat block needs to be written
+//FAT_EOC is truncated to the end of chain of 16-bit entries
+void set_fat(fs_t* fs, size_t i, size_t value){
+    if (!fat_ready(fs, i)) //fat block couldn't be read (should not happen)
+        return;
+    if (fs->fat_entry == sizeof(uint16_t))
+        ((uint16_t*) fs->fat_array)[i] = value;
+    else
+        ((uint32_t*) fs->fat_array)[i] = value;
+    bitmap_set(fs->fat_dirty, i / fs->fat_per_block);
+    if (fs->journal_fat != NULL)
+        bitmap_set(fs->journal_fat, i);
+}
+
+//remember that a root entry changed, for its directory block and the journal
+void mark_root(fs_t* fs, int i){
+    bitmap_set(fs->dir_dirty, i / fs->root_per_block);
+    if (fs->journal_root != NULL)
+        bitmap_set(fs->journal_root, i);
+}
+
+//first run of want free fat entries, or BITMAP_NONE, when the fat is read lazily the
+//fat blocks are read in order until the run is among the blocks read from the first
+//one, so that it is the same run as if the whole fat had been read
+size_t find_free_run(fs_t* fs, size_t want){
+    for (;;){
+        size_t i = want > 1 ? bitmap_find_run(fs->free_map, 1, want) : bitmap_find_next(fs->free_map, 1);
+        if (fs->fat_loaded == NULL || (i != BITMAP_NONE && (i + want - 1) / fs->fat_per_block < fs->fat_prefix))
+            return i;
+        if (load_fat_block(fs, fs->fat_prefix) == -1)
+            return BITMAP_NONE;
+    }
+}
+
+//allocate up to want free blocks, contiguous when possible, and chain them after last
+//(or start a new chain if last is FAT_EOC), return the first one or -1 if disk is full
+long alloc_fat_run(fs_t* fs, size_t last, size_t want){
+    size_t first = BITMAP_NONE, len = 1;
+    
+    if (fs->allocator == FS_ALLOC_LINEAR){ //one block at a time, first free one
+        long i = find_fat_next_free(fs);
+        first = i == -1 ? BITMAP_NONE : (size_t) i;
+    }
+    else{
+        //keep growing the chain in place if the following block is free,
+        //otherwise take the first run large enough, or else the first free block
+        if (last != FAT_EOC && last + 1 < fs->super_block.data_amount && fat_ready(fs, last + 1) && bitmap_test(fs->free_map, last + 1))
+            first = last + 1;
+        else if (want > 1)
+            first = find_free_run(fs, want);
+        if (first == BITMAP_NONE)
+            first = find_free_run(fs, 1);
+        if (first != BITMAP_NONE){
+            while (len < want && first + len < fs->super_block.data_amount && fat_ready(fs, first + len) && bitmap_test(fs->free_map, first + len))
+                len++;
+        }
+    }
+    if (first == BITMAP_NONE) //disk is full
+        return -1;
+    
+    for (size_t i = first; i < first + len; i++){
+        set_fat(fs, i, i + 1 < first + len ? i + 1 : FAT_EOC);
+        bitmap_clear(fs->free_map, i);
+    }
+    if (last != FAT_EOC)
+        set_fat(fs, last, first);
+    return first;
+}
+
+//record that a fat entry is free again
+void free_fat_block(fs_t* fs, size_t i){
+    set_fat(fs, i, 0);
+    bitmap_set(fs->free_map, i);
+    cache_invalidate(fs->cache, i + 2 + fs->super_block.FAT_amount);
+}
+
+//build the free map from the fat table
+int build_free_map(fs_t* fs){
+    if (fs->free_map != NULL) //fat is read lazily, its free entries are indexed as it is read
+        return 0;
+    fs->free_map = bitmap_create(fs->super_block.data_amount);
+    if (fs->free_map == NULL)
+        return -1;
+    for (size_t i = 1; i < fs->super_block.data_amount; i++){
+        if (get_fat(fs, i) == 0)
+            bitmap_set(fs->free_map, i);
+    }
+    return 0;
+}
+
 //check whether the filename is valid by checking that length is less than FS_FILENAME_LEN
 int check_filename(const char* filename){
     bool valid_file = false;
@@ -129,496 +545,2373 @@ int check_filename(const char* filename){
     return 0;
 }
 
-//reset fat blocks to 0 when file is deleted
-void clear_fat(size_t curr){
+//reset fat blocks to 0 when file is deleted, dropping their cached copies
+void clear_fat(fs_t* fs, size_t curr){
     size_t next;
-    while (fat_array[curr] != FAT_EOC){
-        next = fat_array[curr];
-        fat_array[curr] = 0;
+    if (curr == FAT_EOC) //empty file has no blocks
+        return;
+    while (get_fat(fs, curr) != FAT_EOC){
+        next = get_fat(fs, curr);
+        free_fat_block(fs, curr);
         curr = next;
     }
-    fat_array[curr] = 0;
+    free_fat_block(fs, curr);
 }
 
-//find the first free entry in the root array
-//also check whether the filename exists in the root array
-int check_root(const char *filename){
-    bool first_empty = true;
-    for (int i = 0; i < FS_FILE_MAX_COUNT; i++){
-        if (root[i].filename[0] == '\0'){
-            if (first_empty){
-                root_next_free = i;
-                first_empty = false;
-            }
-        }else{
-            if(strcmp((char*) root[i].filename, filename) == 0)
-                return -1;
-        }
-    }
-    if (first_empty)
-        return -1;
-    return 0;
+//length of a journal record holding a run of count fat entries
+size_t jrec_fat_size(fs_t* fs, size_t count){
+    if (fs->fat_entry == sizeof(uint16_t))
+        return 5 + count * sizeof(uint16_t);
+    return 9 + count * sizeof(uint32_t);
 }
 
-//find the index of the given file in the root entry array
-int find_file(const char *filename){
-    for (int i = 0; i < FS_FILE_MAX_COUNT; i++){
-        if (strcmp((char*) root[i].filename, filename) == 0){
-            return i;
-        }
+//read the fields of the super block and the width of the fat entries from its format
+int decode_super(fs_t* fs){
+    superblock* sb = &fs->super_raw;
+    wide_superblock* wide = (wide_superblock*) &fs->super_raw;
+    geometry* geo = &fs->super_block;
+    
+    if (memcmp((char*) &sb->signature, SIGNATURE, 8) == 0){
+        fs->fat_entry = sizeof(uint16_t);
+        fs->block_size = BLOCK_SIZE;
+        geo->total_amount = sb->total_amount;
+        geo->root_idx = sb->root_idx;
+        geo->data_idx = sb->data_idx;
+        geo->data_amount = sb->data_amount;
+        geo->FAT_amount = sb->FAT_amount;
+        geo->journal_signature = sb->journal_signature;
+        geo->journal_start = sb->journal_start;
+        geo->journal_blocks = sb->journal_blocks;
+        geo->dir_signature = sb->dir_signature;
+        geo->dir_start = sb->dir_start;
     }
-    return -1;
-}
-
-//calculate the number of blocks we need to read or write
-int get_num_blocks(size_t count, size_t offset){
-    int diff = BLOCK_SIZE - offset % BLOCK_SIZE;
-    //if count fits within the current block
-    if (count < diff)
-        return 1;
-    //count evenly fits within multiple blocks
-    else if ((count - diff) % BLOCK_SIZE == 0)
-        //add 1 to count for the current block
-        return (count - diff) / BLOCK_SIZE + 1;
-    else
-        //add 2 to count for current block and the extra bytes left when we divide
-        return (count - diff) / BLOCK_SIZE + 2;
-}
-
-//copy bytes from block to buffer for fs_read
-size_t check_and_copy(char* block, char* buff, size_t count, size_t block_offset, size_t buff_offset, int fd){
-    for(int j = 0; j < count; j ++){
-        if (block[block_offset + j] != EOF)
-            buff[buff_offset + j] = block[block_offset + j];
-        else{
-            buff[buff_offset + j] = EOF;
-            open_files[fd].offset += j;
-            return j + 1;
-        }
+    else if (memcmp((char*) &wide->signature, WIDE_SIGNATURE, 8) == 0){
+        fs->fat_entry = sizeof(uint32_t);
+        fs->block_size = wide->block_size ? wide->block_size : BLOCK_SIZE;
+        if (fs->block_size < BLOCK_SIZE || (fs->block_size & (fs->block_size - 1)) != 0)
+            return -1;
+        geo->total_amount = wide->total_amount;
+        geo->root_idx = wide->root_idx;
+        geo->data_idx = wide->data_idx;
+        geo->data_amount = wide->data_amount;
+        geo->FAT_amount = wide->FAT_amount;
+        geo->journal_signature = wide->journal_signature;
+        geo->journal_start = wide->journal_start;
+        geo->journal_blocks = wide->journal_blocks;
+        geo->dir_signature = wide->dir_signature;
+        geo->dir_start = wide->dir_start;
+        geo->free_signature = wide->free_signature;
+        geo->free_blocks = wide->free_blocks;
     }
-    open_files[fd].offset += count;
-    return count;
+    else //not a file system
+        return -1;
+    fs->fat_per_block = fs->block_size / fs->fat_entry;
+    fs->root_per_block = fs->block_size / sizeof(root_entry);
+    
+    //the fat has to cover every data block, and the blocks have to be in order
+    if (geo->FAT_amount * fs->fat_per_block < geo->data_amount || geo->root_idx != geo->FAT_amount + 1 || geo->data_idx != geo->root_idx + 1)
+        return -1;
+    return 0;
 }
 
-//copy bytes from buffer to block for fs_write
-size_t write_bytes(char* block, char* buff, size_t count, size_t block_offset, size_t buff_offset, int fd){
-    for(int j = 0; j < count; j ++){
-        block[block_offset + j] = buff[buff_offset + j];
+//write the super block back after the journal or directory fields changed
+int write_super(fs_t* fs){
+    superblock* sb = &fs->super_raw;
+    wide_superblock* wide = (wide_superblock*) &fs->super_raw;
+    geometry* geo = &fs->super_block;
+    
+    if (fs->fat_entry == sizeof(uint16_t)){
+        sb->journal_signature = geo->journal_signature;
+        sb->journal_start = geo->journal_start;
+        sb->journal_blocks = geo->journal_blocks;
+        sb->dir_signature = geo->dir_signature;
+        sb->dir_start = geo->dir_start;
+    }
+    else{
+        wide->journal_signature = geo->journal_signature;
+        wide->journal_start = geo->journal_start;
+        wide->journal_blocks = geo->journal_blocks;
+        wide->dir_signature = geo->dir_signature;
+        wide->dir_start = geo->dir_start;
+        wide->free_signature = geo->free_signature;
+        wide->free_blocks = geo->free_blocks;
     }
+    if (fs->block_size == BLOCK_SIZE)
+        return disk_write(fs->disk, 0, &fs->super_raw);
     
-    open_files[fd].offset += count;
-    return count;
+    //the rest of a block larger than the super block is unused
+    memcpy(fs->super_buf, &fs->super_raw, sizeof(superblock));
+    return disk_write(fs->disk, 0, fs->super_buf);
 }
 
-//update filesize
-size_t update_filesize(size_t old, size_t new){
-    return new > old? new:old;
+//largest journal transaction: every fat block and every root entry
+size_t journal_max_len(fs_t* fs){
+    return fs->super_block.FAT_amount * jrec_fat_size(fs, fs->fat_per_block) + fs->dir_blocks * fs->root_per_block * JREC_DIRENT_SIZE;
 }
 
-
-int fs_mount(const char *diskname)
-{
-    char* signature = "ECS150FS";
-    
-    if(block_disk_open(diskname) == -1) //disk couldn't be opened
-        return -1;
+//make room for count root entries in the arrays and maps that follow the root array
+//capacity doubles, so that a growing directory is copied a logarithmic number of times
+int reserve_root(fs_t* fs, size_t count){
+    size_t capacity = fs->root_capacity ? fs->root_capacity : fs->root_per_block;
     
-    //read super block
-    block_read(0, (void*) &super_block);
+    if (count <= fs->root_capacity)
+        return 0;
+    while (capacity < count)
+        capacity *= 2;
     
-    //check the content of the super block
-    if (memcmp((char*) &super_block.signature, signature, 8) != 0)
+    root_dir root = realloc(fs->root, capacity * sizeof(root_entry));
+    if (root == NULL)
         return -1;
-    
-    if (super_block.total_amount != block_disk_count()) //superblock data doesn't match disk size (ie disk is probably corrupted or not a valid disk)
+    fs->root = root;
+    block_index* indexes = realloc(fs->indexes, capacity * sizeof(block_index));
+    if (indexes == NULL)
         return -1;
-    
-   
-    fat_array = malloc(super_block.data_amount * sizeof(uint16_t));
-    
-    if (fat_array == NULL) //malloc failed
+    memset(indexes + fs->root_capacity, 0, (capacity - fs->root_capacity) * sizeof(block_index));
+    fs->indexes = indexes;
+    uint32_t* children = realloc(fs->children, capacity * sizeof(uint32_t));
+    if (children == NULL)
         return -1;
-	
-    //read fat block into buffer
-    uint16_t* buffer = malloc(fat_length(super_block.FAT_amount) * sizeof(uint16_t));
-    if (block_to_buffer(1, buffer, super_block.FAT_amount) == -1){ //disk read failed (should never happen)
-        free(buffer);
+    memset(children + fs->root_capacity, 0, (capacity - fs->root_capacity) * sizeof(uint32_t));
+    fs->children = children;
+    uint32_t* dir_chain = realloc(fs->dir_chain, capacity / fs->root_per_block * sizeof(uint32_t));
+    if (dir_chain == NULL)
         return -1;
-    }
-    //copy fat blocks into fat array
-    memcpy(fat_array, buffer, super_block.data_amount);
+    fs->dir_chain = dir_chain;
     
-    //copy root entry blocks into root array
-    root = malloc(FS_FILE_MAX_COUNT * sizeof(root_entry));
-    if (block_read(super_block.root_idx, (void*) root) == -1){ //disk read failed (should never happen)
-        free(buffer);
+    if (fs->dir_dirty == NULL)
+        fs->dir_dirty = bitmap_create(capacity / fs->root_per_block);
+    if (fs->root_free_map == NULL)
+        fs->root_free_map = bitmap_create(capacity);
+    if (fs->dir_dirty == NULL || fs->root_free_map == NULL)
+        return -1;
+    if (bitmap_grow(fs->dir_dirty, capacity / fs->root_per_block) == -1 || bitmap_grow(fs->root_free_map, capacity) == -1)
+        return -1;
+    if (fs->journal_root != NULL && bitmap_grow(fs->journal_root, capacity) == -1)
         return -1;
-    }
-    
-    //initialize the file descriptor array
-    for (int i = 0; i < FS_OPEN_MAX_COUNT; i++)
-        open_files[i].root_idx = -1;
-    
-    free(buffer);
     
-    //when finish mounting, set the mounted flag
-    mounted = true;
+    fs->root_capacity = capacity;
     return 0;
 }
 
-int fs_umount(void)
-{
-    if (mounted == false) //disk hasn't been mounted
-        return -1;
-    
-    //all files should be closed when unmounted
-    for (int i = 0; i < FS_OPEN_MAX_COUNT; i++)
-        if (open_files[i].root_idx != -1)
-            return -1;
-    
-    //write fat array and root table back to disk if they have been changed
-    if (change_table){
-	//create buffer, and zero it, then copy fat table into buffer
-        uint16_t* buffer = malloc(fat_length(super_block.FAT_amount) * sizeof(uint16_t));
-        memset(buffer, 0, fat_length(super_block.FAT_amount) * sizeof(uint16_t));
-        memcpy(buffer, fat_array, super_block.data_amount);
+//disk block holding a directory block
+size_t dir_block(fs_t* fs, size_t k){
+    if (k == 0)
+        return fs->super_block.root_idx;
+    return fs->dir_chain[k - 1] + fs->super_block.data_idx;
+}
+
+//read the blocks chained after the root block of an extended directory
+int load_dir(fs_t* fs){
+    io_batch batch = { .count = 0, .write = false, .error = false };
+    size_t curr = fs->super_block.dir_start;
     
-        if (buffer_to_block(1, buffer, super_block.FAT_amount) == -1){ //disk write failed (should not happen)
-            free(buffer);
+    while (curr != FAT_EOC){
+        if (curr == 0 || curr >= fs->super_block.data_amount || fs->dir_blocks > fs->super_block.data_amount) //broken chain
             return -1;
-        }
-        
-        free(buffer);
-        
-        if (block_write(super_block.root_idx, root) == -1){ //disk write failed (should not happen)
+        if (reserve_root(fs, (fs->dir_blocks + 1) * fs->root_per_block) == -1)
             return -1;
-        }
+        fs->dir_chain[fs->dir_blocks - 1] = curr;
+        fs->dir_blocks++;
+        curr = get_fat(fs, curr);
     }
+    fs->root_count = fs->dir_blocks * fs->root_per_block;
     
-    //when finish unmounting, set the mounted flag
-    mounted = false;
-    change_table = false;
-    //fails if disk isn't open
-    return block_disk_close();
+    //the arrays don't move anymore, read every block into its place
+    for (size_t k = 1; k < fs->dir_blocks; k++){
+        if (batch_add(fs, &batch, dir_block(fs, k), fs->root + k * fs->root_per_block) == -1)
+            return -1;
+    }
+    return batch_flush(fs, &batch);
 }
 
-int fs_info(void)
-{
-    if (!mounted) //disk hasn't been mounted
-        return -1;
-        
-    printf("FS Info:\n");
-    printf("total_blk_count=%d\n", super_block.total_amount);
-    printf("fat_blk_count=%d\n", super_block.FAT_amount);
-    printf("rdir_blk=%d\n",super_block.root_idx);
-    printf("data_blk=%d\n",super_block.data_idx);
-    printf("data_blk_count=%d\n",super_block.data_amount);
-    printf("fat_free_ratio=%d/%d\n",fat_free(), super_block.data_amount);
-    printf("rdir_free_ratio=%d/%d\n",root_free(), FS_FILE_MAX_COUNT);
+//add a block to an extended directory, with all its entries free
+int grow_dir(fs_t* fs){
+    size_t first = fs->root_count;
+    long k;
     
-    return 0;
-}
-
-int fs_create(const char *filename)
-{
-    if (!mounted) //disk hasn't been mounted
+    //the journal has to be able to log the whole directory at once
+    if (fs->journal != NULL && journal_max_len(fs) + fs->root_per_block * JREC_DIRENT_SIZE > journal_capacity(fs->journal))
         return -1;
-    
-    if (check_filename(filename) == -1) //filename is short enough
+    if (reserve_root(fs, first + fs->root_per_block) == -1)
         return -1;
-    
-    if (check_root(filename) == -1) //finds next free, fails if file already exists or there is no space
+    k = alloc_fat_run(fs, fs->dir_chain[fs->dir_blocks - 2], 1);
+    if (k == -1) //disk is full
         return -1;
-	
-    //initialize root entry
-    strcpy((char*) root[root_next_free].filename, filename);
-    root[root_next_free].filesize = 0;
-    root[root_next_free].data_start = FAT_EOC;
     
-    change_table = true;
+    fs->dir_chain[fs->dir_blocks - 1] = k;
+    fs->dir_blocks++;
+    fs->root_count += fs->root_per_block;
+    memset(fs->root + first, 0, fs->block_size);
+    for (size_t i = first; i < fs->root_count; i++){
+        bitmap_set(fs->root_free_map, i);
+        mark_root(fs, i);
+    }
     return 0;
 }
 
-int fs_delete(const char *filename)
-{
-    if (!mounted) //disk hasn't been mounted
-        return -1;
-    
-    if (check_filename(filename) == -1) //filename is short enough
-        return -1;
-    
-    int pos = find_file(filename); 
-    
-    if (pos == -1) //file doesn't exist in root, fail
-        return -1;
-    
-    for (int i = 0; i < FS_OPEN_MAX_COUNT; i++)
-        if (open_files[i].root_idx == pos) //fails if file is open
-            return -1;
-    
-    clear_fat(root[pos].data_start); //clear fat table entries
-    root[pos].filename[0] = '\0';
-    change_table = true;
-    return 0;
+//whether a directory number is the root directory or a directory entry
+bool is_dir(fs_t* fs, uint32_t dir){
+    return dir == ROOT_DIR || (dir <= fs->root_count && fs->root[dir - 1].filename[0] != '\0' && fs->root[dir - 1].type == ENTRY_DIR);
 }
 
-int fs_ls(void)
-{
-    if (!mounted) //disk hasn't been mounted
+//build the filename index and the free root entry map from the root array
+//and count the entries of each directory, which must all exist
+int build_root_index(fs_t* fs){
+    fs->names = dirhash_create();
+    if (fs->names == NULL)
         return -1;
-    
-    printf("FS Ls:\n");
-    for (int i = 0; i < FS_FILE_MAX_COUNT; i++){
-        if (root[i].filename[0] != '\0')
-            printf("file: %s, size: %d, data_blk: %d\n", root[i].filename, root[i].filesize, root[i].data_start);
+    for (size_t i = 0; i < fs->root_count; i++){
+        if (fs->root[i].filename[0] == '\0'){
+            bitmap_set(fs->root_free_map, i);
+            continue;
+        }
+        if (!is_dir(fs, fs->root[i].parent)) //entry of a directory that doesn't exist
+            return -1;
+        if (dirhash_insert(fs->names, fs->root[i].parent, (char*) fs->root[i].filename, i) == -1)
+            return -1;
+        if (fs->root[i].parent != ROOT_DIR)
+            fs->children[fs->root[i].parent - 1]++;
+        if (fs->root[i].type == ENTRY_DIR)
+            fs->dir_count++;
     }
     return 0;
 }
 
-int fs_open(const char *filename)
-{
-    if (!mounted) //disk hasn't been mounted
+//find the first free entry in the root array, the one the reference tools would pick
+//an extended directory grows by one block when it is full
+//also check whether the filename exists in the directory
+int check_root(fs_t* fs, uint32_t dir, const char *filename){
+    if (dirhash_lookup(fs->names, dir, filename) != -1)
         return -1;
-    
-    if (check_filename(filename) == -1) //filename is short enough
+    size_t i = bitmap_find_next(fs->root_free_map, 0);
+    if (i == BITMAP_NONE && fs->super_block.dir_signature == DIR_SIGNATURE && grow_dir(fs) == 0)
+        i = bitmap_find_next(fs->root_free_map, 0);
+    if (i == BITMAP_NONE)
         return -1;
+    fs->root_next_free = i;
+    return 0;
+}
+
+//find the index of the given file of a directory in the root entry array
+int find_file(fs_t* fs, uint32_t dir, const char *filename){
+    return dirhash_lookup(fs->names, dir, filename);
+}
+
+//find the directory holding the last component of a path, and point name at that
+//component, return its directory number or -1 if a directory on the way doesn't exist
+//each component is a single lookup in the name index, whatever the number of files
+long split_path(fs_t* fs, const char* path, const char** name){
+    char component[FS_FILENAME_LEN];
+    const char* slash;
+    uint32_t dir = ROOT_DIR;
+    int i;
     
-    int pos = find_file(filename); 
-    
-    if (pos == -1) //file doesn't exist in root, fail
-        return -1;
-    //search for space in open file table
-    for (int i = 0; i < FS_OPEN_MAX_COUNT; i ++){
-        if ( open_files[i].root_idx == -1){ //if space is found, initialize openfile table entry
-            open_files[i].root_idx = pos;
-            open_files[i].offset = 0;
-            open_files[i].block_idx = root[pos].data_start;
-            open_files[i].invalid_block = false;
-            return i;
-        }
+    if (path[0] == '/')
+        path++;
+    while ((slash = strchr(path, '/')) != NULL){
+        if (slash == path || slash - path >= FS_FILENAME_LEN) //empty or too long component
+            return -1;
+        memcpy(component, path, slash - path);
+        component[slash - path] = '\0';
+        i = find_file(fs, dir, component);
+        if (i == -1 || fs->root[i].type != ENTRY_DIR)
+            return -1;
+        dir = i + 1;
+        path = slash + 1;
     }
-    
-    return -1; //open file table is full
+    if (check_filename(path) == -1) //last component is short enough
+        return -1;
+    *name = path;
+    return dir;
 }
 
-int fs_close(int fd)
-{
-    if (!mounted) //disk hasn't been mounted
+//find the directory holding the file a path names, like split_path()
+//an image without directories has flat names, '/' included, as the reference tools store
+//them, and a root entry named after the whole path is still found once directories exist
+long find_parent(fs_t* fs, const char* path, const char** name){
+    if (check_filename(path) == 0 && (fs->dir_count == 0 || find_file(fs, ROOT_DIR, path) != -1)){
+        *name = path;
+        return ROOT_DIR;
+    }
+    if (fs->dir_count == 0) //too long for a name
         return -1;
-    
-    if (fd < 0 || fd >= FS_OPEN_MAX_COUNT) //file descriptor is out of bounds 
+    return split_path(fs, path, name);
+}
+
+//fill a free root entry with an empty file or directory of a directory
+int add_entry(fs_t* fs, uint32_t dir, const char* name, uint8_t type){
+    if (check_root(fs, dir, name) == -1) //finds next free, fails if file already exists or there is no space
         return -1;
     
-    if (open_files[fd].root_idx == -1) //file descriptor points to unused entry
+    if (dirhash_insert(fs->names, dir, name, fs->root_next_free) == -1) //index couldn't grow
         return -1;
+    bitmap_clear(fs->root_free_map, fs->root_next_free);
     
-    open_files[fd].root_idx = -1;
+    //initialize root entry
+    root_entry* entry = &fs->root[fs->root_next_free];
+    memset(entry, 0, sizeof(root_entry));
+    strcpy((char*) entry->filename, name);
+    set_entry_size(fs, entry, 0);
+    set_entry_start(fs, entry, FAT_EOC);
+    entry->type = type;
+    entry->parent = dir;
+    if (dir != ROOT_DIR)
+        fs->children[dir - 1]++;
+    if (type == ENTRY_DIR)
+        fs->dir_count++;
     
+    mark_root(fs, fs->root_next_free);
     return 0;
 }
 
-int fs_stat(int fd)
-{
-    if (!mounted) //disk hasn't been mounted
-        return -1;
-    
-    if (fd < 0 || fd >= FS_OPEN_MAX_COUNT) //file descriptor is out of bounds 
-        return -1;
+//free the root entry of a file or empty directory
+void remove_entry(fs_t* fs, int pos){
+    uint32_t dir = fs->root[pos].parent;
     
-    if (open_files[fd].root_idx == -1) //file descriptor points to unused entry
-        return -1;
-    
-    return root[open_files[fd].root_idx].filesize;
+    dirhash_remove(fs->names, dir, (char*) fs->root[pos].filename);
+    if (dir != ROOT_DIR)
+        fs->children[dir - 1]--;
+    if (fs->root[pos].type == ENTRY_DIR)
+        fs->dir_count--;
+    bitmap_set(fs->root_free_map, pos);
+    fs->root[pos].filename[0] = '\0';
+    mark_root(fs, pos);
 }
 
-int fs_lseek(int fd, size_t offset)
-{
-    if (!mounted) //disk hasn't been mounted
-        return -1;
-    
-    if (fd < 0 || fd >= FS_OPEN_MAX_COUNT) //file descriptor is out of bounds 
-        return -1;
+//calculate the number of blocks we need to read or write
+int get_num_blocks(fs_t* fs, size_t count, size_t offset){
+    int diff = fs->block_size - offset % fs->block_size;
+    //if count fits within the current block
+    if (count < diff)
+        return 1;
+    //count evenly fits within multiple blocks
+    else if ((count - diff) % fs->block_size == 0)
+        //add 1 to count for the current block
+        return (count - diff) / fs->block_size + 1;
+    else
+        //add 2 to count for current block and the extra bytes left when we divide
+        return (count - diff) / fs->block_size + 2;
+}
+
+//the next len bytes of a cursor if they are in a single buffer, NULL if they are split
+char* cursor_span(io_cursor* cur, size_t len){
+    while (cur->seg < cur->iovcnt && cur->seg_offset == cur->iov[cur->seg].iov_len){ //skip used up and empty buffers
+        cur->seg++;
+        cur->seg_offset = 0;
+    }
+    if (cur->seg == cur->iovcnt || cur->iov[cur->seg].iov_len - cur->seg_offset < len)
+        return NULL;
+    return (char*) cur->iov[cur->seg].iov_base + cur->seg_offset;
+}
+
+//length of the piece of the current buffer of a cursor that the next count bytes use,
+//and its start in base
+size_t cursor_piece(io_cursor* cur, size_t count, char** base){
+    size_t n;
     
-    if (open_files[fd].root_idx == -1) //file descriptor points to unused entry
-        return -1;
+    cursor_span(cur, 0); //step to a buffer with room left
+    n = cur->iov[cur->seg].iov_len - cur->seg_offset;
+    *base = (char*) cur->iov[cur->seg].iov_base + cur->seg_offset;
+    return n < count ? n : count;
+}
+
+//move a cursor len bytes forward
+void cursor_skip(io_cursor* cur, size_t len){
+    char* base;
     
-    if (offset > root[open_files[fd].root_idx].filesize) //offset is out of bounds
-        return -1;
+    while (len > 0){
+        size_t n = cursor_piece(cur, len, &base);
+        cur->seg_offset += n;
+        len -= n;
+    }
+}
+
+//copy len bytes from the buffers of a cursor into dest
+void cursor_gather(io_cursor* cur, char* dest, size_t len){
+    char* base;
     
-    if (offset == root[open_files[fd].root_idx].filesize && offset % BLOCK_SIZE == 0){ //offset is at end and the next byte needs to be in a new block
-        open_files[fd].invalid_block = true;
+    while (len > 0){
+        size_t n = cursor_piece(cur, len, &base);
+        memcpy(dest, base, n);
+        cur->seg_offset += n;
+        dest += n;
+        len -= n;
     }
-    open_files[fd].offset = offset;
+}
+
+//copy len bytes from src into the buffers of a cursor
+void cursor_scatter(io_cursor* cur, const char* src, size_t len){
+    char* base;
     
-    return 0;
+    while (len > 0){
+        size_t n = cursor_piece(cur, len, &base);
+        memcpy(base, src, n);
+        cur->seg_offset += n;
+        src += n;
+        len -= n;
+    }
 }
 
-int fs_write(int fd, void *buf, size_t count)
-{
-    int i, fat_free_idx;
-    int amount_wrote = 0;
-    size_t start_offset = open_files[fd].offset;
-	
-    if (!mounted) //disk hasn't been mounted
-        return -1;
-	
-    if (fd < 0 || fd >= FS_OPEN_MAX_COUNT) //file descriptor is out of bounds 
-        return -1;
+//copy bytes from block to the buffers of the cursor for fs_read
+size_t read_bytes(fs_t* fs, char* block, io_cursor* cur, size_t count, size_t block_offset, file_descriptor* file){
+    cursor_scatter(cur, block + block_offset, count);
     
-    if (open_files[fd].root_idx == -1) //file descriptor points to unused entry
-        return -1;
+    file->offset += count;
+    return count;
+}
+
+//copy bytes from the buffers of the cursor to block for fs_write
+size_t write_bytes(fs_t* fs, char* block, io_cursor* cur, size_t count, size_t block_offset, file_descriptor* file){
+    cursor_gather(cur, block + block_offset, count);
     
-    char *block_buf = malloc(BLOCK_SIZE*sizeof(char)); //allocate block buffer
-    int num_blocks = get_num_blocks(count, open_files[fd].offset); //calculate blocks to write
-    int diff = BLOCK_SIZE - (open_files[fd].offset % BLOCK_SIZE);
+    file->offset += count;
+    return count;
+}
+
+//update filesize if the file grew
+void grow_file(fs_t* fs, file_descriptor* file, size_t size){
+    if (size > entry_size(fs, &fs->root[file->root_idx])){
+        set_entry_size(fs, &fs->root[file->root_idx], size);
+        mark_root(fs, file->root_idx);
+    }
+}
+
+//after moving data up to the end of a block, step to the next block of the chain
+//so block_idx keeps holding the offset, or if it is the end of the file remember
+//that the next write needs a new block
+void settle_block(fs_t* fs, file_descriptor* file, size_t moved){
+    if (moved == 0 || file->offset % fs->block_size != 0)
+        return;
+    if (get_fat(fs, file->block_idx) != FAT_EOC) //next block exists, possibly preallocated
+        file->block_idx = get_fat(fs, file->block_idx);
+    else //perfectly fills last block
+        file->invalid_block = true; //need to allocate another block on next write
+}
+
+//append a block to an index, growing it geometrically
+bool index_push(block_index* index, size_t block){
+    if (index->count == index->capacity){
+        size_t capacity = index->capacity ? index->capacity * 2 : 64;
+        uint32_t* blocks = realloc(index->blocks, capacity * sizeof(uint32_t));
+        if (blocks == NULL)
+            return false;
+        index->blocks = blocks;
+        index->capacity = capacity;
+    }
+    index->blocks[index->count++] = block;
+    return true;
+}
+
+//forget the index of a file, when it is closed or deleted
+void index_reset(block_index* index){
+    free(index->blocks);
+    index->blocks = NULL;
+    index->count = 0;
+    index->capacity = 0;
+}
+
+//return the n-th block of a file, or FAT_EOC if its chain is shorter
+//the walk resumes where the index stops and records the blocks it goes through,
+//so each block of the chain is only walked once
+size_t index_block(fs_t* fs, int root_idx, size_t n){
+    block_index* index = &fs->indexes[root_idx];
+    size_t curr, i;
     
-    change_table = true;
+    if (n < index->count)
+        return index->blocks[n];
     
-    if (root[open_files[fd].root_idx].data_start == FAT_EOC || open_files[fd].invalid_block){ //first block of empty file or beginning of unallocated block
-        fat_free_idx = find_fat_next_free(); //find next block
-        if (fat_free_idx == -1) //disk is full
-            return amount_wrote;
-        else{ //update block chain
-            open_files[fd].block_idx = fat_free_idx;
-            fat_array[fat_free_idx] = FAT_EOC;
-            if (root[open_files[fd].root_idx].data_start == FAT_EOC){
-                root[open_files[fd].root_idx].data_start = fat_free_idx;
-            }
-            open_files[fd].invalid_block = false;
-        }
+    if (index->count == 0){
+        i = 0;
+        curr = entry_start(fs, &fs->root[root_idx]);
+        if (curr != FAT_EOC)
+            index_push(index, curr);
     }
-    else{ //read current block
-        block_read(open_files[fd].block_idx + 2 + super_block.FAT_amount, (void*) block_buf);
+    else{
+        i = index->count - 1;
+        curr = index->blocks[i];
+    }
+    while (i < n && curr != FAT_EOC){
+        curr = get_fat(fs, curr);
+        i++;
+        if (curr != FAT_EOC && index->count == i) //if memory runs out, keep walking without recording
+            index_push(index, curr);
     }
+    return curr;
+}
+
+//point block_idx at the block holding the offset
+//if the offset is right after the last block, stay on it and mark the next block as missing
+void seek_block(fs_t* fs, file_descriptor* file){
+    int root_idx = file->root_idx;
+    size_t n = file->offset / fs->block_size;
+    size_t curr = index_block(fs, root_idx, n);
     
-    if (count > diff){ //writing more than one block, write to end of block, then write to disk
-        write_bytes(block_buf, buf, diff, open_files[fd].offset % BLOCK_SIZE, 0, fd);
-        amount_wrote += diff;
-        block_write(open_files[fd].block_idx + 2 + super_block.FAT_amount, (void*) block_buf);
+    file->invalid_block = false;
+    if (curr == FAT_EOC && n > 0){ //past the chain, which then ends with block n - 1
+        curr = index_block(fs, root_idx, n - 1);
+        file->invalid_block = true;
     }
-    else{ //write less than one block, write section, write to disk, then return
-        write_bytes(block_buf, buf, count, open_files[fd].offset % BLOCK_SIZE, 0, fd);
-        amount_wrote += count;
-        block_write(open_files[fd].block_idx + 2 + super_block.FAT_amount, (void*) block_buf);
-        root[open_files[fd].root_idx].filesize = update_filesize(root[open_files[fd].root_idx].filesize, start_offset + amount_wrote);
-        
-        if (open_files[fd].offset == root[open_files[fd].root_idx].filesize && open_files[fd].offset % BLOCK_SIZE == 0){ //perfectly fills last block
-            open_files[fd].invalid_block = true; //need to allocate another block on next write
+    file->block_idx = curr;
+}
+
+//grow the readahead window on sequential reads and shrink it otherwise
+void update_readahead(fs_t* fs, int fd, bool sequential){
+    if (!sequential)
+        fs->open_files[fd].ra_window /= 2;
+    else if (fs->open_files[fd].ra_window == 0)
+        fs->open_files[fd].ra_window = READAHEAD_MIN;
+    else
+        fs->open_files[fd].ra_window *= 2;
+    
+    if (fs->open_files[fd].ra_window > fs->readahead_max)
+        fs->open_files[fd].ra_window = fs->readahead_max;
+    fs->open_files[fd].ra_offset = fs->open_files[fd].offset;
+}
+
+//start reading the blocks following the current block of the descriptor into the cache
+void readahead(fs_t* fs, int fd){
+    size_t curr = fs->open_files[fd].block_idx;
+    
+    if (curr == FAT_EOC) //empty file
+        return;
+    if (curr == fs->open_files[fd].ra_block) //the blocks that follow were already asked for
+        return;
+    fs->open_files[fd].ra_block = curr;
+    for (int i = 0; i < fs->open_files[fd].ra_window && get_fat(fs, curr) != FAT_EOC; i++){
+        curr = get_fat(fs, curr);
+        if (cache_prefetch(fs->cache, curr + 2 + fs->super_block.FAT_amount) == -1)
+            break;
+    }
+    disk_kick(fs->disk); //don't wait for the next read to start the prefetches
+}
+
+
+//copy the modified fat blocks and root table and mark them clean,
+//the copy can then be written without holding the instance lock
+int snapshot_tables(fs_t* fs){
+    size_t i, n = fs->super_block.FAT_amount + fs->dir_blocks;
+    
+    fs->snap_count = 0;
+    if (n > fs->snap_capacity){ //the directory grew, room for every table block
+        size_t* blocks = realloc(fs->snap_blocks, n * sizeof(size_t));
+        if (blocks != NULL)
+            fs->snap_blocks = blocks;
+        size_t* index = realloc(fs->snap_index, n * sizeof(size_t));
+        if (index != NULL)
+            fs->snap_index = index;
+        const void** bufs = realloc(fs->snap_bufs, n * sizeof(void*));
+        if (bufs != NULL)
+            fs->snap_bufs = bufs;
+        char* data = realloc(fs->snap_data, n * fs->block_size);
+        if (data != NULL)
+            fs->snap_data = data;
+        if (blocks == NULL || index == NULL || bufs == NULL || data == NULL)
+            return -1;
+        fs->snap_capacity = n;
+    }
+    
+    for (i = bitmap_find_next(fs->fat_dirty, 0); i != BITMAP_NONE; i = bitmap_find_next(fs->fat_dirty, i + 1)){
+        fs->snap_blocks[fs->snap_count] = 1 + i;
+        fs->snap_index[fs->snap_count] = i;
+        memcpy(fs->snap_data + fs->snap_count++ * fs->block_size, (char*) fs->fat_array + i * fs->block_size, fs->block_size);
+        bitmap_clear(fs->fat_dirty, i);
+    }
+    for (i = bitmap_find_next(fs->dir_dirty, 0); i != BITMAP_NONE; i = bitmap_find_next(fs->dir_dirty, i + 1)){
+        fs->snap_blocks[fs->snap_count] = dir_block(fs, i);
+        fs->snap_index[fs->snap_count] = i;
+        memcpy(fs->snap_data + fs->snap_count++ * fs->block_size, fs->root + i * fs->root_per_block, fs->block_size);
+        bitmap_clear(fs->dir_dirty, i);
+    }
+    return 0;
+}
+
+//mark the blocks of the copy dirty again after failing to write it
+void unsnapshot_tables(fs_t* fs){
+    for (size_t i = 0; i < fs->snap_count; i++){
+        if (fs->snap_blocks[i] > fs->super_block.FAT_amount)
+            bitmap_set(fs->dir_dirty, fs->snap_index[i]);
+        else
+            bitmap_set(fs->fat_dirty, fs->snap_index[i]);
+    }
+    fs->snap_count = 0;
+}
+
+//write the copy of the tables, adjacent fat blocks go in a single request
+int write_snapshot(fs_t* fs){
+    for (size_t i = 0; i < fs->snap_count; i++)
+        fs->snap_bufs[i] = fs->snap_data + i * fs->block_size;
+    return disk_writev(fs->disk, fs->snap_blocks, fs->snap_bufs, fs->snap_count);
+}
+
+//write the modified fat blocks and root table back to disk
+int write_tables(fs_t* fs){
+    if (snapshot_tables(fs) == -1)
+        return -1;
+    if (write_snapshot(fs) == -1){ //disk write failed (should not happen), keep everything dirty
+        unsnapshot_tables(fs);
+        return -1;
+    }
+    return 0;
+}
+
+//encode a run of fat entries as a journal record, return its length
+//values are the entries as stored in the fat, the first number is as wide as them
+size_t log_fat(fs_t* fs, char* rec, size_t first, size_t count, const void* values){
+    size_t header = jrec_fat_size(fs, 0);
+    
+    if (fs->fat_entry == sizeof(uint16_t)){
+        uint16_t field[2] = { first, count };
+        rec[0] = JREC_FAT;
+        memcpy(rec + 1, field, sizeof(field));
+    }
+    else{
+        uint32_t field[2] = { first, count };
+        rec[0] = JREC_WIDE_FAT;
+        memcpy(rec + 1, field, sizeof(field));
+    }
+    memcpy(rec + header, values, count * fs->fat_entry);
+    return jrec_fat_size(fs, count);
+}
+
+//encode a root entry as a journal record, return its length
+size_t log_root(char* rec, uint32_t i, const root_entry* entry){
+    rec[0] = JREC_DIRENT;
+    memcpy(rec + 1, &i, sizeof(uint32_t));
+    memcpy(rec + 5, entry, sizeof(root_entry));
+    return JREC_DIRENT_SIZE;
+}
+
+//forget the changes waiting for a commit, a checkpoint writes them all
+void clear_pending(fs_t* fs){
+    size_t i;
+    
+    for (i = bitmap_find_next(fs->journal_fat, 0); i != BITMAP_NONE; i = bitmap_find_next(fs->journal_fat, i + 1))
+        bitmap_clear(fs->journal_fat, i);
+    for (i = bitmap_find_next(fs->journal_root, 0); i != BITMAP_NONE; i = bitmap_find_next(fs->journal_root, i + 1))
+        bitmap_clear(fs->journal_root, i);
+}
+
+//encode the fat and root entries changed since the last commit, runs of adjacent fat
+//entries share a record, return the length or -1 if it is more than space
+int log_pending(fs_t* fs, size_t space){
+    size_t len = 0, i, n;
+    
+    for (i = bitmap_find_next(fs->journal_fat, 0); i != BITMAP_NONE; i = bitmap_find_next(fs->journal_fat, i + n)){
+        for (n = 1; i + n < fs->super_block.data_amount && n < UINT16_MAX && bitmap_test(fs->journal_fat, i + n); n++)
+            ;
+        if (len + jrec_fat_size(fs, n) > space)
+            return -1;
+        len += log_fat(fs, fs->journal_rec + len, i, n, (char*) fs->fat_array + i * fs->fat_entry);
+        for (size_t j = i; j < i + n; j++)
+            bitmap_clear(fs->journal_fat, j);
+    }
+    for (i = bitmap_find_next(fs->journal_root, 0); i != BITMAP_NONE; i = bitmap_find_next(fs->journal_root, i + 1)){
+        if (len + JREC_DIRENT_SIZE > space)
+            return -1;
+        len += log_root(fs->journal_rec + len, i, &fs->root[i]);
+        bitmap_clear(fs->journal_root, i);
+    }
+    return len;
+}
+
+//log the copy of the tables in a fresh journal, which then covers every change
+//since the last checkpoint while the copy is written in place
+int log_snapshot(fs_t* fs){
+    size_t len = 0;
+    
+    for (size_t i = 0; i < fs->snap_count; i++){
+        char* block = fs->snap_data + i * fs->block_size;
+        if (fs->snap_blocks[i] > fs->super_block.FAT_amount){ //directory block
+            for (size_t j = 0; j < fs->root_per_block; j++)
+                len += log_root(fs->journal_rec + len, fs->snap_index[i] * fs->root_per_block + j, (root_entry*) block + j);
         }
-        return amount_wrote;
+        else
+            len += log_fat(fs, fs->journal_rec + len, fs->snap_index[i] * fs->fat_per_block, fs->fat_per_block, block);
+    }
+    if (journal_switch(fs->journal, fs->journal_rec, len) == -1)
+        return -1;
+    return disk_sync(fs->disk);
+}
+
+//keep a root entry logged by the journal until the directory is loaded
+int stash_root(fs_t* fs, uint32_t i, const char* entry){
+    if (fs->replayed_len + JREC_DIRENT_SIZE > fs->replayed_capacity){
+        size_t capacity = fs->replayed_capacity ? fs->replayed_capacity * 2 : 64 * JREC_DIRENT_SIZE;
+        char* replayed = realloc(fs->replayed, capacity);
+        if (replayed == NULL)
+            return -1;
+        fs->replayed = replayed;
+        fs->replayed_capacity = capacity;
     }
+    fs->replayed_len += log_root(fs->replayed + fs->replayed_len, i, (const root_entry*) entry);
+    return 0;
+}
+
+//apply the root entries logged by the journal, in the order they were logged
+int apply_stashed_roots(fs_t* fs){
+    uint32_t i;
     
-    for (i = 1; i < num_blocks - 1; i++){ //write "middle" blocks directly to disk
-        
-        if (fat_array[open_files[fd].block_idx] == FAT_EOC){ //if last block allocate a new one
-            
-            fat_free_idx = find_fat_next_free();
-            if (fat_free_idx == -1){
-                root[open_files[fd].root_idx].filesize = update_filesize(root[open_files[fd].root_idx].filesize, start_offset + amount_wrote);
-                return amount_wrote;
+    for (size_t pos = 0; pos < fs->replayed_len; pos += JREC_DIRENT_SIZE){
+        memcpy(&i, fs->replayed + pos + 1, sizeof(uint32_t));
+        if (i >= fs->root_count) //entry outside the directory
+            return -1;
+        memcpy(&fs->root[i], fs->replayed + pos + 5, sizeof(root_entry));
+        bitmap_set(fs->dir_dirty, i / fs->root_per_block);
+    }
+    free(fs->replayed);
+    fs->replayed = NULL;
+    fs->replayed_len = 0;
+    return 0;
+}
+
+//apply the records of a committed transaction when the journal is replayed at mount
+//root entries wait for the directory blocks, which the fat entries may have chained
+int replay_records(void* ctx, const void* records, size_t len){
+    fs_t* fs = ctx;
+    const char* rec = records;
+    size_t pos = 0, header = jrec_fat_size(fs, 0), first, count;
+    uint16_t field16[2];
+    uint32_t i, field32[2];
+    
+    while (pos < len){
+        //runs of fat entries, logged as wide as the entries of the image
+        if (rec[pos] == (fs->fat_entry == sizeof(uint16_t) ? JREC_FAT : JREC_WIDE_FAT) && pos + header <= len){
+            if (fs->fat_entry == sizeof(uint16_t)){
+                memcpy(field16, rec + pos + 1, sizeof(field16));
+                first = field16[0];
+                count = field16[1];
             }
             else{
-                fat_array[open_files[fd].block_idx] = fat_free_idx;
-                fat_array[fat_free_idx] = FAT_EOC;
+                memcpy(field32, rec + pos + 1, sizeof(field32));
+                first = field32[0];
+                count = field32[1];
+            }
+            if (count == 0 || pos + jrec_fat_size(fs, count) > len || first + count > fs->super_block.FAT_amount * fs->fat_per_block)
+                return -1;
+            for (size_t i = first / fs->fat_per_block; i <= (first + count - 1) / fs->fat_per_block; i++){
+                if (!fat_ready(fs, i * fs->fat_per_block)) //the logged entries overwrite the block once read
+                    return -1;
             }
+            memcpy((char*) fs->fat_array + first * fs->fat_entry, rec + pos + header, count * fs->fat_entry);
+            for (size_t i = first / fs->fat_per_block; i <= (first + count - 1) / fs->fat_per_block; i++)
+                bitmap_set(fs->fat_dirty, i);
+            pos += jrec_fat_size(fs, count);
         }
-        //get next block idx
-        open_files[fd].block_idx = fat_array[open_files[fd].block_idx];
-            
-        //write the block directly into buff
-        block_write(open_files[fd].block_idx + 2 + super_block.FAT_amount, buf + amount_wrote);
-        open_files[fd].offset += BLOCK_SIZE;
-        amount_wrote += BLOCK_SIZE;
+        else if (rec[pos] == JREC_ROOT && pos + JREC_ROOT_SIZE <= len){ //root block entry, from before extended directories
+            if (stash_root(fs, (uint8_t) rec[pos + 1], rec + pos + 2) == -1)
+                return -1;
+            pos += JREC_ROOT_SIZE;
+        }
+        else if (rec[pos] == JREC_DIRENT && pos + JREC_DIRENT_SIZE <= len){
+            memcpy(&i, rec + pos + 1, sizeof(uint32_t));
+            if (stash_root(fs, i, rec + pos + 5) == -1)
+                return -1;
+            pos += JREC_DIRENT_SIZE;
+        }
+        else //corrupted record
+            return -1;
     }
-    if (num_blocks > 1){ //more than 1 block, need to write last block
-        if (fat_array[open_files[fd].block_idx] == FAT_EOC){ //if last block allocate a new one
-            fat_free_idx = find_fat_next_free();
-            if (fat_free_idx == -1){ //return amount wrote if disk is full
-                root[open_files[fd].root_idx].filesize = update_filesize(root[open_files[fd].root_idx].filesize, start_offset + amount_wrote);
-                return amount_wrote;
-            }
-            else{ //add next block to chain and clear block buff for writing
-                fat_array[open_files[fd].block_idx] = fat_free_idx;
-                fat_array[fat_free_idx] = FAT_EOC;
-                memset(block_buf, 0, BLOCK_SIZE);
-            }
-        } else{ //read last block to write to
-            open_files[fd].block_idx = fat_array[open_files[fd].block_idx];
-            block_read(open_files[fd].block_idx + 2 + super_block.FAT_amount, (void*) block_buf);
+    return 0;
+}
+
+//replay the journal described in the super block and get ready to log changes
+int open_journal(fs_t* fs){
+    size_t start = fs->super_block.journal_start, nblocks = fs->super_block.journal_blocks;
+    
+    if (start < fs->super_block.data_idx || start + nblocks > fs->super_block.total_amount || nblocks < journal_min_blocks(fs->disk, journal_max_len(fs)))
+        return -1;
+    fs->journal = journal_open(fs->disk, start, nblocks, replay_records, fs);
+    if (fs->journal == NULL)
+        return -1;
+    fs->journal_fat = bitmap_create(fs->super_block.data_amount);
+    fs->journal_root = bitmap_create(fs->root_capacity);
+    fs->journal_rec = malloc(journal_capacity(fs->journal));
+    if (fs->journal_fat == NULL || fs->journal_root == NULL || fs->journal_rec == NULL)
+        return -1;
+    return 0;
+}
+
+//reserve a run of data blocks for a journal and describe it in the super block
+//the blocks are chained in the fat like a file without root entry, so tools
+//that don't know about the journal leave them alone
+int add_journal(fs_t* fs, size_t nblocks){
+    size_t first, start;
+    
+    if (nblocks < journal_min_blocks(fs->disk, journal_max_len(fs)))
+        nblocks = journal_min_blocks(fs->disk, journal_max_len(fs));
+    first = find_free_run(fs, nblocks);
+    if (first == BITMAP_NONE) //no room for it
+        return -1;
+    for (size_t i = first; i < first + nblocks; i++){
+        set_fat(fs, i, i + 1 < first + nblocks ? i + 1 : FAT_EOC);
+        bitmap_clear(fs->free_map, i);
+    }
+    start = first + fs->super_block.data_idx;
+    
+    //the super block only points to the journal once it and the fat are durable
+    if (journal_format(fs->disk, start, nblocks) == -1 || write_tables(fs) == -1 || disk_sync(fs->disk) == -1)
+        return -1;
+    fs->super_block.journal_signature = JOURNAL_SIGNATURE;
+    fs->super_block.journal_start = start;
+    fs->super_block.journal_blocks = nblocks;
+    if (write_super(fs) == -1 || disk_sync(fs->disk) == -1)
+        return -1;
+    return open_journal(fs);
+}
+
+//number of fat and root blocks waiting for a checkpoint, or with a journal
+//blocks worth of fat entries and root block waiting for a commit
+size_t pending_tables(fs_t* fs){
+    if (fs->journal != NULL)
+        return (bitmap_weight(fs->journal_fat) + fs->fat_per_block - 1) / fs->fat_per_block + (bitmap_weight(fs->journal_root) + fs->root_per_block - 1) / fs->root_per_block;
+    return bitmap_weight(fs->fat_dirty) + bitmap_weight(fs->dir_dirty);
+}
+
+void fs_lock(fs_t* fs){
+    pthread_mutex_lock(&fs->lock);
+}
+
+//release the instance lock, waking the checkpoint thread if enough tables are dirty
+void fs_unlock(fs_t* fs){
+    if (fs->flusher_running && fs->checkpoint_dirty != 0 && pending_tables(fs) >= fs->checkpoint_dirty)
+        pthread_cond_signal(&fs->checkpoint_cond);
+    pthread_mutex_unlock(&fs->lock);
+}
+
+//write back cached data blocks, make them durable, then write the tables pointing to them
+//and make those durable too, so the tables on disk never point to data that isn't there
+//with a journal, the copy of the tables is logged first so a crash while writing them
+//in place loses nothing, and the journal is emptied once they are durable
+//the instance lock is only held to flush the cache and copy the tables, foreground
+//operations never wait for the disk syncs
+int checkpoint(fs_t* fs){
+    int ret = 0;
+    
+    pthread_mutex_lock(&fs->checkpoint_lock);
+    fs_lock(fs);
+    if (cache_flush(fs->cache) == -1 || snapshot_tables(fs) == -1)
+        ret = -1;
+    else{
+        fs->data_dirty = false;
+        if (fs->journal != NULL) //logged as a whole with the copy
+            clear_pending(fs);
+    }
+    pthread_mutex_unlock(&fs->lock);
+    
+    if (ret == 0 && fs->snap_count > 0){
+        if (disk_sync(fs->disk) == -1 || (fs->journal != NULL && log_snapshot(fs) == -1) || write_snapshot(fs) == -1){
+            fs_lock(fs);
+            unsnapshot_tables(fs);
+            pthread_mutex_unlock(&fs->lock);
+            fs->journal_stale = true;
+            ret = -1;
         }
-	//write into block_buf and then disk
-        write_bytes(block_buf, buf, count - amount_wrote, open_files[fd].offset % BLOCK_SIZE, amount_wrote, fd);
-        block_write(open_files[fd].block_idx + 2 + super_block.FAT_amount, (void*) block_buf);
-        
-        amount_wrote = count;
     }
-    root[open_files[fd].root_idx].filesize = update_filesize(root[open_files[fd].root_idx].filesize, start_offset + amount_wrote);
-    if (open_files[fd].offset == root[open_files[fd].root_idx].filesize && open_files[fd].offset % BLOCK_SIZE == 0){//perfectly fills last block
-        open_files[fd].invalid_block = true; //need to allocate another block on next write
+    if (ret == 0 && disk_sync(fs->disk) == -1)
+        ret = -1;
+    if (ret == 0 && fs->journal != NULL && fs->snap_count > 0){
+        if (journal_switch(fs->journal, NULL, 0) == -1 || disk_sync(fs->disk) == -1)
+            ret = -1;
     }
-    return amount_wrote;
+    if (ret == 0)
+        fs->journal_stale = false;
+    pthread_mutex_unlock(&fs->checkpoint_lock);
+    return ret;
 }
 
-int fs_read(int fd, void *buf, size_t count)
-{
-    int i;
-    int amount_read = 0;
-    size_t res;
+//make the changes since the last commit durable: data blocks first, then the fat and
+//root entries that changed as a single journal transaction of a few sequential blocks
+//without a journal, or when the transaction doesn't fit in it, this is a checkpoint
+int commit(fs_t* fs){
+    int ret = 0, len = 0;
+    
+    if (fs->journal == NULL)
+        return checkpoint(fs);
+    
+    pthread_mutex_lock(&fs->checkpoint_lock);
+    if (!fs->journal_stale){
+        fs_lock(fs);
+        if (cache_flush(fs->cache) == -1)
+            ret = -1;
+        else{
+            fs->data_dirty = false;
+            len = log_pending(fs, journal_space(fs->journal));
+            if (len == -1) //some changes can't be logged anymore
+                fs->journal_stale = true;
+        }
+        pthread_mutex_unlock(&fs->lock);
+    }
+    if (fs->journal_stale){ //start over from a checkpoint
+        pthread_mutex_unlock(&fs->checkpoint_lock);
+        return checkpoint(fs);
+    }
+    
+    if (ret == 0 && disk_sync(fs->disk) == -1)
+        ret = -1;
+    if (ret == 0 && len > 0){
+        if (journal_append(fs->journal, fs->journal_rec, len) == -1 || disk_sync(fs->disk) == -1){
+            fs->journal_stale = true;
+            ret = -1;
+        }
+    }
+    pthread_mutex_unlock(&fs->checkpoint_lock);
+    return ret;
+}
+
+//checkpoint thread: commit every checkpoint_ms, or sooner once checkpoint_dirty
+//table blocks are waiting, as long as something changed
+void* flusher_main(void* arg){
+    fs_t* fs = arg;
+    struct timespec deadline;
+    bool failed = false;
+    
+    fs_lock(fs);
+    while (!fs->flusher_stop){
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += fs->checkpoint_ms / 1000;
+        deadline.tv_nsec += (fs->checkpoint_ms % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L){
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        //after a failure, only retry when the interval expires
+        while (!fs->flusher_stop && (failed || fs->checkpoint_dirty == 0 || pending_tables(fs) < fs->checkpoint_dirty)){
+            if (fs->checkpoint_ms == 0)
+                pthread_cond_wait(&fs->checkpoint_cond, &fs->lock);
+            else if (pthread_cond_timedwait(&fs->checkpoint_cond, &fs->lock, &deadline) == ETIMEDOUT)
+                break;
+        }
+        if (fs->flusher_stop)
+            break;
+        if (pending_tables(fs) == 0 && !fs->data_dirty) //nothing to checkpoint
+            continue;
+        
+        pthread_mutex_unlock(&fs->lock);
+        failed = commit(fs) == -1;
+        fs_lock(fs);
+    }
+    pthread_mutex_unlock(&fs->lock);
+    return NULL;
+}
+
+//stop the checkpoint thread, if it runs
+void stop_flusher(fs_t* fs){
+    if (!fs->flusher_running)
+        return;
+    fs_lock(fs);
+    fs->flusher_stop = true;
+    pthread_cond_signal(&fs->checkpoint_cond);
+    pthread_mutex_unlock(&fs->lock);
+    pthread_join(fs->flusher, NULL);
+    fs->flusher_running = false;
+}
+
+//switch the directory to the extended format, where blocks are chained after the root
+//block, the first one right away so that the super block never changes afterwards
+int extend_dir(fs_t* fs){
+    long first;
     
-    if (!mounted) //disk hasn't been mounted
+    if (fs->journal != NULL && journal_max_len(fs) + fs->root_per_block * JREC_DIRENT_SIZE > journal_capacity(fs->journal)) //journal is too small
         return -1;
-	
-    if (fd < 0 || fd >= FS_OPEN_MAX_COUNT) //file descriptor is out of bounds
+    if (reserve_root(fs, 2 * fs->root_per_block) == -1)
         return -1;
+    first = alloc_fat_run(fs, FAT_EOC, 1);
+    if (first == -1) //disk is full
+        return -1;
+    
+    fs->dir_chain[0] = first;
+    fs->dir_blocks = 2;
+    fs->root_count = 2 * fs->root_per_block;
+    memset(fs->root + fs->root_per_block, 0, fs->block_size);
+    for (size_t i = fs->root_per_block; i < fs->root_count; i++){
+        bitmap_set(fs->root_free_map, i);
+        mark_root(fs, i);
+    }
     
-    if (open_files[fd].root_idx == -1) //fd points to unused entry
+    //the super block only points to the new block once it and the fat are durable
+    if (checkpoint(fs) == -1)
+        return -1;
+    fs->super_block.dir_signature = DIR_SIGNATURE;
+    fs->super_block.dir_start = first;
+    if (write_super(fs) == -1 || disk_sync(fs->disk) == -1)
         return -1;
+    return 0;
+}
+
+//release the memory of an instance and close its disk
+void fs_free(fs_t* fs){
+    cache_destroy(fs->cache);
+    bitmap_destroy(fs->free_map);
+    bitmap_destroy(fs->fat_loaded);
+    bitmap_destroy(fs->fat_dirty);
+    dirhash_destroy(fs->names);
+    bitmap_destroy(fs->root_free_map);
+    if (fs->disk != NULL)
+        disk_close(fs->disk);
+    bitmap_destroy(fs->dir_dirty);
+    for (size_t i = 0; i < fs->root_capacity; i++)
+        index_reset(&fs->indexes[i]);
+    free(fs->indexes);
+    free(fs->children);
+    free(fs->fat_array);
+    free(fs->root);
+    free(fs->dir_chain);
+    free(fs->replayed);
+    free(fs->snap_blocks);
+    free(fs->snap_index);
+    free(fs->snap_bufs);
+    free(fs->snap_data);
+    journal_close(fs->journal);
+    bitmap_destroy(fs->journal_fat);
+    bitmap_destroy(fs->journal_root);
+    free(fs->journal_rec);
+    free(fs->super_buf);
+    pthread_cond_destroy(&fs->checkpoint_cond);
+    pthread_mutex_destroy(&fs->checkpoint_lock);
+    pthread_mutex_destroy(&fs->lock);
+    for (int i = 0; i < FS_OPEN_MAX_COUNT; i++)
+        pthread_rwlock_destroy(&fs->file_locks[i].lock);
+    free(fs);
+}
+
+fs_t* fs_mount_h(const char *diskname, const struct fs_options *opts)
+{
+    size_t cache_blocks;
+    bool lazy;
+    fs_t* fs = calloc(1, sizeof(fs_t));
     
-    char *block_buf = malloc(BLOCK_SIZE*sizeof(char));
+    if (fs == NULL) //malloc failed
+        return NULL;
+    pthread_mutex_init(&fs->lock, NULL);
+    pthread_mutex_init(&fs->checkpoint_lock, NULL);
+    pthread_cond_init(&fs->checkpoint_cond, NULL);
+    for (int i = 0; i < FS_OPEN_MAX_COUNT; i++)
+        pthread_rwlock_init(&fs->file_locks[i].lock, NULL);
     
-    int num_blocks = get_num_blocks(count, open_files[fd].offset); //get num blocks to read
-    int diff = BLOCK_SIZE - (open_files[fd].offset % BLOCK_SIZE);
+    fs->disk = disk_open(diskname, opts != NULL ? opts->backend : NULL, opts != NULL ? opts->engine : DISK_ENGINE_AUTO);
+    if (fs->disk == NULL){ //disk couldn't be opened
+        fs_free(fs);
+        return NULL;
+    }
     
-    block_read(open_files[fd].block_idx + 2 + super_block.FAT_amount, (void*) block_buf); //read first block
-    if (count > diff){ //if reading more than one block, read from offset to end
-        res = check_and_copy(block_buf, buf, diff, open_files[fd].offset, 0, fd);
-        if (res != diff)
-            return res;
-        else
-            amount_read += res;
+    //read super block and check its content, in either format
+    if (disk_read(fs->disk, 0, (void*) &fs->super_raw) == -1 || decode_super(fs) == -1){
+        fs_free(fs);
+        return NULL;
     }
-    else{ //read less than one block, then return
-        res = check_and_copy(block_buf, buf, count, open_files[fd].offset, 0, fd);
-        if (open_files[fd].offset == root[open_files[fd].root_idx].filesize && open_files[fd].offset % BLOCK_SIZE == 0){//perfectly fills last block
-             open_files[fd].invalid_block = true; //need to allocate another block on next write
+    
+    //blocks larger than the super block are read in its place from now on
+    if (fs->block_size != BLOCK_SIZE){
+        fs->super_buf = calloc(1, fs->block_size);
+        if (fs->super_buf == NULL || disk_set_block_size(fs->disk, fs->block_size) == -1){
+            fs_free(fs);
+            return NULL;
         }
-        return res;
     }
     
-    for (i = 1; i < num_blocks - 1; i++){ //read middle blocks directly from disk to user buf
-        //get next block idx
-        open_files[fd].block_idx = fat_array[open_files[fd].block_idx];
-	    
-        if (fat_array[open_files[fd].block_idx] == FAT_EOC){ //check if it is the last block
-            block_read(open_files[fd].block_idx + 2 + super_block.FAT_amount, (void*) block_buf); //read into block buf
-            res = check_and_copy(block_buf, buf , count - amount_read, 0, amount_read, fd); //copy the rest
-            amount_read += res;
-            return amount_read;
+    if (fs->super_block.total_amount != (size_t) disk_count(fs->disk)){ //superblock data doesn't match disk size (ie disk is probably corrupted or not a valid disk)
+        fs_free(fs);
+        return NULL;
+    }
+    
+    //the fat can only be read lazily with the free block count of a clean unmount,
+    //which is dropped until the next one, on disk before the fat can change
+    lazy = opts != NULL && opts->lazy_fat && fs->super_block.free_signature == FREE_SIGNATURE && fs->super_block.free_blocks < fs->super_block.data_amount;
+    if (fs->super_block.free_signature == FREE_SIGNATURE){
+        fs->super_block.free_signature = 0;
+        if (write_super(fs) == -1 || disk_sync(fs->disk) == -1){
+            fs_free(fs);
+            return NULL;
         }
-        //read the block directly into buff
-        block_read(open_files[fd].block_idx + 2 + super_block.FAT_amount, buf + amount_read);
-        open_files[fd].offset += BLOCK_SIZE;
-        amount_read += BLOCK_SIZE;
     }
-    if (num_blocks > 1){ //read last block into block_buf and copy the rest of count into user buf  
-        open_files[fd].block_idx = fat_array[open_files[fd].block_idx];
-        block_read(open_files[fd].block_idx + 2 + super_block.FAT_amount, (void*) block_buf);
-        res = check_and_copy(block_buf, buf , count - amount_read, 0, amount_read, fd);
-        amount_read += res;
+    
+    //the default cache and readahead window hold as many bytes whatever the block size
+    cache_blocks = FS_CACHE_DEFAULT_BLOCKS * BLOCK_SIZE / fs->block_size;
+    if (cache_blocks < CACHE_MIN_BLOCKS)
+        cache_blocks = CACHE_MIN_BLOCKS;
+    if (opts != NULL && opts->cache_blocks != 0)
+        cache_blocks = opts->cache_blocks;
+    
+    fs->readahead_max = FS_READAHEAD_DEFAULT_BLOCKS * BLOCK_SIZE / fs->block_size;
+    if (opts != NULL && opts->readahead_blocks != 0)
+        fs->readahead_max = opts->readahead_blocks > 0 ? opts->readahead_blocks : 0;
+    //leave at least half of the cache to blocks that were actually read
+    if (fs->readahead_max > cache_blocks / 2)
+        fs->readahead_max = cache_blocks / 2;
+    
+    fs->fat_array = malloc(fs->super_block.FAT_amount * fs->block_size);
+    if (fs->fat_array == NULL || reserve_root(fs, fs->root_per_block) == -1){ //malloc failed
+        fs_free(fs);
+        return NULL;
     }
-    if (open_files[fd].offset == root[open_files[fd].root_idx].filesize && open_files[fd].offset % BLOCK_SIZE == 0){//perfectly fills last block
-        open_files[fd].invalid_block = true; //need to allocate another block on next write
+    fs->dir_blocks = 1;
+    fs->root_count = fs->root_per_block;
+    
+    //read fat blocks straight into the fat array, or each one when first used,
+    //then root entry block into root array
+    if (lazy){
+        fs->fat_loaded = bitmap_create(fs->super_block.FAT_amount);
+        fs->free_map = bitmap_create(fs->super_block.data_amount);
+        fs->unloaded_free = fs->super_block.free_blocks;
+        if (fs->fat_loaded == NULL || fs->free_map == NULL){ //malloc failed
+            fs_free(fs);
+            return NULL;
+        }
     }
-    return amount_read;
+    else if (block_to_buffer(fs, 1, fs->fat_array, fs->super_block.FAT_amount) == -1){ //disk read failed (should never happen)
+        fs_free(fs);
+        return NULL;
+    }
+    if (disk_read(fs->disk, fs->super_block.root_idx, (void*) fs->root) == -1){ //disk read failed (should never happen)
+        fs_free(fs);
+        return NULL;
+    }
+    
+    //replay the journal if there is one, read the rest of an extended directory,
+    //then index the free fat entries and the root entries
+    fs->allocator = opts != NULL ? opts->allocator : FS_ALLOC_BITMAP;
+    fs->fat_dirty = bitmap_create(fs->super_block.FAT_amount);
+    if (fs->fat_dirty == NULL){ //malloc failed
+        fs_free(fs);
+        return NULL;
+    }
+    if (fs->super_block.journal_signature == JOURNAL_SIGNATURE && open_journal(fs) == -1){ //journal is invalid or couldn't be replayed
+        fs_free(fs);
+        return NULL;
+    }
+    if (fs->super_block.dir_signature == DIR_SIGNATURE && load_dir(fs) == -1){ //directory chain is broken or couldn't be read
+        fs_free(fs);
+        return NULL;
+    }
+    if (apply_stashed_roots(fs) == -1){ //journal logged an entry the directory doesn't have
+        fs_free(fs);
+        return NULL;
+    }
+    if (build_free_map(fs) == -1 || build_root_index(fs) == -1){ //malloc failed
+        fs_free(fs);
+        return NULL;
+    }
+    
+    //add a journal to an image without one if asked to
+    if (fs->journal == NULL && opts != NULL && opts->journal_blocks > 0){
+        if (opts->journal_blocks > fs->super_block.data_amount || add_journal(fs, opts->journal_blocks) == -1){
+            fs_free(fs);
+            return NULL;
+        }
+    }
+    
+    //initialize the file descriptor array
+    for (int i = 0; i < FS_OPEN_MAX_COUNT; i++)
+        fs->open_files[i].root_idx = -1;
+    
+    fs->cache = cache_create(fs->disk, cache_blocks);
+    if (fs->cache == NULL){ //block cache couldn't be allocated
+        fs_free(fs);
+        return NULL;
+    }
+    
+    //switch to the extended directory format if asked to
+    if (fs->super_block.dir_signature != DIR_SIGNATURE && opts != NULL && opts->large_dir){
+        if (extend_dir(fs) == -1){
+            fs_free(fs);
+            return NULL;
+        }
+    }
+    
+    //start the checkpoint thread if checkpoints were asked for
+    if (opts != NULL && (opts->checkpoint_ms > 0 || opts->checkpoint_dirty > 0)){
+        fs->checkpoint_ms = opts->checkpoint_ms > 0 ? opts->checkpoint_ms : 0;
+        fs->checkpoint_dirty = opts->checkpoint_dirty;
+        if (pthread_create(&fs->flusher, NULL, flusher_main, fs) != 0){
+            fs_free(fs);
+            return NULL;
+        }
+        fs->flusher_running = true;
+    }
+    
+    return fs;
+}
+
+int fs_umount_h(fs_t* fs)
+{
+    if (fs == NULL) //disk hasn't been mounted
+        return -1;
+    
+    //all files should be closed when unmounted
+    for (int i = 0; i < FS_OPEN_MAX_COUNT; i++)
+        if (fs->open_files[i].root_idx != -1)
+            return -1;
+    
+    stop_flusher(fs);
+    
+    if (fs->journal != NULL){ //write the tables through the journal, leaving it empty
+        if (checkpoint(fs) == -1)
+            return -1;
+    }
+    else{
+        //write back cached data blocks before the tables pointing to them
+        if (cache_flush(fs->cache) == -1)
+            return -1;
+        
+        //write the fat blocks and root table that have been changed back to disk
+        if (write_tables(fs) == -1 || disk_sync(fs->disk) == -1)
+            return -1;
+    }
+    
+    //once the tables are on disk, the free block count lets the next mount read the fat lazily
+    if (fs->fat_entry != sizeof(uint16_t)){
+        fs->super_block.free_signature = FREE_SIGNATURE;
+        fs->super_block.free_blocks = fat_free(fs);
+        if (write_super(fs) == -1 || disk_sync(fs->disk) == -1)
+            return -1;
+    }
+    
+    cache_destroy(fs->cache);
+    fs->cache = NULL;
+    
+    //fails if disk can't be closed
+    int ret = disk_close(fs->disk);
+    fs->disk = NULL;
+    fs_free(fs);
+    return ret;
 }
 
+//fill the super block of a new image, in the format its geometry needs
+void format_super(void* block, bool wide, size_t block_size, size_t data_amount, size_t fat_blocks){
+    superblock* sb = block;
+    wide_superblock* wsb = block;
+    
+    if (!wide){
+        memcpy((char*) &sb->signature, SIGNATURE, 8);
+        sb->total_amount = data_amount + fat_blocks + 2;
+        sb->root_idx = fat_blocks + 1;
+        sb->data_idx = fat_blocks + 2;
+        sb->data_amount = data_amount;
+        sb->FAT_amount = fat_blocks;
+    }
+    else{
+        memcpy((char*) &wsb->signature, WIDE_SIGNATURE, 8);
+        wsb->total_amount = data_amount + fat_blocks + 2;
+        wsb->root_idx = fat_blocks + 1;
+        wsb->data_idx = fat_blocks + 2;
+        wsb->data_amount = data_amount;
+        wsb->FAT_amount = fat_blocks;
+        wsb->block_size = block_size == BLOCK_SIZE ? 0 : block_size;
+        wsb->free_signature = FREE_SIGNATURE;
+        wsb->free_blocks = data_amount - 1;
+    }
+}
+
+int fs_format(const char *diskname, size_t nblocks, const struct fs_format_options *opts)
+{
+    size_t block_size = BLOCK_SIZE, fat_entry = sizeof(uint16_t), fat_blocks, total;
+    bool wide = opts != NULL && opts->wide;
+    struct disk* disk;
+    char* block;
+    int ret = -1;
+    
+    if (opts != NULL && opts->block_size != 0)
+        block_size = opts->block_size;
+    if (diskname == NULL || nblocks == 0 || block_size < BLOCK_SIZE || (block_size & (block_size - 1)) != 0)
+        return -1;
+    
+    //larger blocks, or more of them than 16-bit fields can count, need a wide image
+    fat_blocks = (nblocks * fat_entry + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    if (block_size != BLOCK_SIZE || nblocks + fat_blocks + 2 > UINT16_MAX)
+        wide = true;
+    if (wide){
+        fat_entry = sizeof(uint32_t);
+        fat_blocks = (nblocks * fat_entry + block_size - 1) / block_size;
+    }
+    total = nblocks + fat_blocks + 2;
+    if (total >= FAT_EOC || total > INT_MAX / (block_size / BLOCK_SIZE)) //too large for the disk to count
+        return -1;
+    
+    block = calloc(1, block_size);
+    if (block == NULL) //malloc failed
+        return -1;
+    
+    //the data blocks, the rest of the fat and the root directory are left as holes,
+    //that read as free entries and empty root entries
+    if (disk_create(diskname, total * (block_size / BLOCK_SIZE)) == -1){
+        free(block);
+        return -1;
+    }
+    //the fat is on disk before the super block, whose free block count describes it
+    disk = disk_open(diskname, NULL, DISK_ENGINE_AUTO);
+    if (disk != NULL && disk_set_block_size(disk, block_size) == 0){
+        //first fat entry is the end of chain, it is never allocated
+        memset(block, 0xFF, fat_entry);
+        if (disk_write(disk, 1, block) == 0 && disk_sync(disk) == 0){
+            memset(block, 0, block_size);
+            format_super(block, wide, block_size, nblocks, fat_blocks);
+            if (disk_write(disk, 0, block) == 0)
+                ret = disk_sync(disk);
+        }
+    }
+    if (disk != NULL && disk_close(disk) == -1)
+        ret = -1;
+    free(block);
+    if (ret == -1)
+        return -1;
+    
+    //the journal and the extended directory are added by mounting the new image with them
+    if (opts != NULL && (opts->journal_blocks != 0 || opts->large_dir)){
+        struct fs_options mount_opts = { .journal_blocks = opts->journal_blocks, .large_dir = opts->large_dir };
+        fs_t* fs = fs_mount_h(diskname, &mount_opts);
+        if (fs == NULL || fs_umount_h(fs) == -1)
+            return -1;
+    }
+    return 0;
+}
+
+int fs_sync_h(fs_t* fs)
+{
+    if (fs == NULL) //disk hasn't been mounted
+        return -1;
+    
+    return commit(fs);
+}
+
+int fs_cache_stats_locked(fs_t* fs, struct fs_cache_stats *stats)
+{
+    struct cache_stats cs;
+    
+    if (stats == NULL)
+        return -1;
+    
+    cache_get_stats(fs->cache, &cs);
+    stats->capacity = cs.capacity;
+    stats->hits = cs.hits;
+    stats->misses = cs.misses;
+    stats->evictions = cs.evictions;
+    stats->writebacks = cs.writebacks;
+    stats->readahead = cs.readahead;
+    stats->readahead_hits = cs.readahead_hits;
+    stats->readahead_waste = cs.readahead_waste;
+    return 0;
+}
+
+int fs_info_locked(fs_t* fs)
+{
+    printf("FS Info:\n");
+    printf("total_blk_count=%zu\n", fs->super_block.total_amount);
+    printf("fat_blk_count=%zu\n", fs->super_block.FAT_amount);
+    printf("rdir_blk=%zu\n",fs->super_block.root_idx);
+    printf("data_blk=%zu\n",fs->super_block.data_idx);
+    printf("data_blk_count=%zu\n",fs->super_block.data_amount);
+    printf("fat_free_ratio=%zu/%zu\n",fat_free(fs), fs->super_block.data_amount);
+    printf("rdir_free_ratio=%d/%zu\n",root_free(fs), fs->root_count);
+    
+    return 0;
+}
+
+int fs_create_locked(fs_t* fs, const char *filename)
+{
+    const char* name;
+    long dir = find_parent(fs, filename, &name);
+    
+    if (dir == -1) //path is invalid or its directory doesn't exist
+        return -1;
+    
+    return add_entry(fs, dir, name, ENTRY_FILE);
+}
+
+int fs_delete_locked(fs_t* fs, const char *filename)
+{
+    const char* name;
+    long dir = find_parent(fs, filename, &name);
+    
+    if (dir == -1) //path is invalid or its directory doesn't exist
+        return -1;
+    
+    int pos = find_file(fs, dir, name); 
+    
+    if (pos == -1 || fs->root[pos].type != ENTRY_FILE) //file doesn't exist in its directory, fail
+        return -1;
+    
+    for (int i = 0; i < FS_OPEN_MAX_COUNT; i++)
+        if (fs->open_files[i].root_idx == pos) //fails if file is open
+            return -1;
+    
+    clear_fat(fs, entry_start(fs, &fs->root[pos])); //clear fat table entries
+    index_reset(&fs->indexes[pos]);
+    remove_entry(fs, pos);
+    return 0;
+}
+
+int fs_mkdir_locked(fs_t* fs, const char *dirname)
+{
+    const char* name;
+    long dir = split_path(fs, dirname, &name);
+    
+    if (dir == -1) //path is invalid or its directory doesn't exist
+        return -1;
+    
+    return add_entry(fs, dir, name, ENTRY_DIR);
+}
+
+int fs_rmdir_locked(fs_t* fs, const char *dirname)
+{
+    const char* name;
+    long dir = split_path(fs, dirname, &name);
+    
+    if (dir == -1) //path is invalid or its directory doesn't exist
+        return -1;
+    
+    int pos = find_file(fs, dir, name);
+    
+    if (pos == -1 || fs->root[pos].type != ENTRY_DIR) //directory doesn't exist, fail
+        return -1;
+    if (fs->children[pos] != 0) //directory isn't empty
+        return -1;
+    
+    remove_entry(fs, pos);
+    return 0;
+}
+
+int fs_ls_locked(fs_t* fs)
+{
+    printf("FS Ls:\n");
+    for (size_t i = 0; i < fs->root_count; i++){
+        if (fs->root[i].filename[0] == '\0' || fs->root[i].parent != ROOT_DIR)
+            continue;
+        if (fs->root[i].type == ENTRY_DIR){
+            printf("dir: %s\n", fs->root[i].filename);
+            continue;
+        }
+        //an empty file shows the end of chain as stored on disk, like the reference tools
+        size_t start = entry_start(fs, &fs->root[i]);
+        if (start == FAT_EOC)
+            start = fs->fat_entry == sizeof(uint16_t) ? 0xFFFF : FAT_EOC;
+        printf("file: %s, size: %llu, data_blk: %zu\n", fs->root[i].filename, (unsigned long long) entry_size(fs, &fs->root[i]), start);
+    }
+    return 0;
+}
+
+//share the lock of a file with its other descriptors, or give it a free slot,
+//there is always one as there are as many slots as descriptors
+int take_file_lock(fs_t* fs, int root_idx){
+    int slot = -1;
+    
+    for (int i = 0; i < FS_OPEN_MAX_COUNT; i++){
+        if (fs->file_locks[i].refs > 0 && fs->file_locks[i].root_idx == root_idx){
+            fs->file_locks[i].refs++;
+            return i;
+        }
+        if (fs->file_locks[i].refs == 0 && slot == -1)
+            slot = i;
+    }
+    fs->file_locks[slot].root_idx = root_idx;
+    fs->file_locks[slot].refs = 1;
+    return slot;
+}
+
+int fs_open_locked(fs_t* fs, const char *filename)
+{
+    const char* name;
+    long dir = find_parent(fs, filename, &name);
+    
+    if (dir == -1) //path is invalid or its directory doesn't exist
+        return -1;
+    
+    int pos = find_file(fs, dir, name); 
+    
+    if (pos == -1 || fs->root[pos].type != ENTRY_FILE) //file doesn't exist in its directory, fail
+        return -1;
+    //search for space in open file table
+    for (int i = 0; i < FS_OPEN_MAX_COUNT; i ++){
+        if ( fs->open_files[i].root_idx == -1){ //if space is found, initialize openfile table entry
+            fs->open_files[i].root_idx = pos;
+            fs->open_files[i].offset = 0;
+            fs->open_files[i].block_idx = entry_start(fs, &fs->root[pos]);
+            fs->open_files[i].invalid_block = false;
+            fs->open_files[i].ra_offset = 0;
+            fs->open_files[i].ra_window = 0;
+            fs->open_files[i].ra_block = FAT_EOC;
+            fs->open_files[i].lock_idx = take_file_lock(fs, pos);
+            return i;
+        }
+    }
+    
+    return -1; //open file table is full
+}
+
+int fs_close_locked(fs_t* fs, int fd)
+{
+    if (fd < 0 || fd >= FS_OPEN_MAX_COUNT) //file descriptor is out of bounds 
+        return -1;
+    
+    if (fs->open_files[fd].root_idx == -1) //file descriptor points to unused entry
+        return -1;
+    
+    int pos = fs->open_files[fd].root_idx;
+    fs->open_files[fd].root_idx = -1;
+    fs->file_locks[fs->open_files[fd].lock_idx].refs--;
+    
+    //drop the block index with the last descriptor of the file
+    for (int i = 0; i < FS_OPEN_MAX_COUNT; i++)
+        if (fs->open_files[i].root_idx == pos)
+            return 0;
+    index_reset(&fs->indexes[pos]);
+    
+    return 0;
+}
+
+long long fs_stat_locked(fs_t* fs, int fd)
+{
+    if (fd < 0 || fd >= FS_OPEN_MAX_COUNT) //file descriptor is out of bounds 
+        return -1;
+    
+    if (fs->open_files[fd].root_idx == -1) //file descriptor points to unused entry
+        return -1;
+    
+    return entry_size(fs, &fs->root[fs->open_files[fd].root_idx]);
+}
+
+int fs_lseek_locked(fs_t* fs, int fd, size_t offset)
+{
+    if (fd < 0 || fd >= FS_OPEN_MAX_COUNT) //file descriptor is out of bounds 
+        return -1;
+    
+    if (fs->open_files[fd].root_idx == -1) //file descriptor points to unused entry
+        return -1;
+    
+    if (offset > entry_size(fs, &fs->root[fs->open_files[fd].root_idx])) //offset is out of bounds
+        return -1;
+    
+    fs->open_files[fd].offset = offset;
+    seek_block(fs, &fs->open_files[fd]);
+    
+    return 0;
+}
+
+//the descriptors of an empty file point nowhere, start them at its new first block
+void start_descriptors(fs_t* fs, int root_idx){
+    for (int i = 0; i < FS_OPEN_MAX_COUNT; i++){
+        if (fs->open_files[i].root_idx == root_idx && fs->open_files[i].block_idx == FAT_EOC)
+            fs->open_files[i].block_idx = entry_start(fs, &fs->root[root_idx]);
+    }
+}
+
+int fs_fallocate_locked(fs_t* fs, int fd, size_t len)
+{
+    if (fd < 0 || fd >= FS_OPEN_MAX_COUNT) //file descriptor is out of bounds 
+        return -1;
+    
+    if (fs->open_files[fd].root_idx == -1) //file descriptor points to unused entry
+        return -1;
+    
+    int root_idx = fs->open_files[fd].root_idx;
+    root_entry* entry = &fs->root[root_idx];
+    block_index* index = &fs->indexes[root_idx];
+    size_t want = (len + fs->block_size - 1) / fs->block_size;
+    size_t have = 0, last = FAT_EOC, end, curr, next;
+    
+    //count the blocks the file already has, from the last one its index knows,
+    //the rest of the chain is walked once and recorded in the index
+    if (entry_start(fs, entry) != FAT_EOC){
+        have = index->count > 0 ? index->count : 1;
+        while (index_block(fs, root_idx, have) != FAT_EOC)
+            have++;
+        last = index_block(fs, root_idx, have - 1);
+    }
+    if (have >= want) //already large enough
+        return 0;
+    if ((size_t) fat_free(fs) < want - have) //not enough space, reserve nothing
+        return -1;
+    
+    //append runs until the chain covers len, a single run unless free space is fragmented
+    end = last;
+    while (have < want){
+        long first = alloc_fat_run(fs, end, want - have);
+        if (first == -1) //the fat couldn't be read
+            break;
+        if (entry_start(fs, entry) == FAT_EOC){
+            set_entry_start(fs, entry, first);
+            mark_root(fs, root_idx);
+        }
+        for (end = first; get_fat(fs, end) != FAT_EOC; end = get_fat(fs, end))
+            have++;
+        have++;
+    }
+    
+    if (have < want){ //give back the runs appended so far, a failure reserves nothing
+        curr = last == FAT_EOC ? entry_start(fs, entry) : get_fat(fs, last);
+        for (; curr != FAT_EOC; curr = next){
+            next = get_fat(fs, curr);
+            free_fat_block(fs, curr);
+        }
+        if (last == FAT_EOC){
+            set_entry_start(fs, entry, FAT_EOC);
+            mark_root(fs, root_idx);
+        }
+        else
+            set_fat(fs, last, FAT_EOC);
+        return -1;
+    }
+    
+    start_descriptors(fs, root_idx);
+    return 0;
+}
+
+//write the buffers of iov at the offset of a descriptor, which may also be a copy that
+//the caller discards, each block of the file is written once
+int write_to_file(fs_t* fs, file_descriptor* file, const struct iovec* iov, int iovcnt, size_t count)
+{
+    int i;
+    long fat_free_idx;
+    int amount_wrote = 0;
+    io_batch batch = { .count = 0, .write = true, .error = false };
+    io_cursor cur = { .iov = iov, .iovcnt = iovcnt, .seg = 0, .seg_offset = 0 };
+	
+    size_t start_offset = file->offset;
+    fs->data_dirty = true;
+    char *block_buf; //cached copy of the first or last block
+    char *cached;
+    char *span;
+    int num_blocks = get_num_blocks(fs, count, file->offset); //calculate blocks to write
+    int diff = fs->block_size - (file->offset % fs->block_size);
+    
+    //the missing block may have been added since by fs_fallocate() or another descriptor
+    if (file->invalid_block && get_fat(fs, file->block_idx) != FAT_EOC){
+        file->block_idx = get_fat(fs, file->block_idx);
+        file->invalid_block = false;
+    }
+    
+    if (entry_start(fs, &fs->root[file->root_idx]) == FAT_EOC || file->invalid_block){ //first block of empty file or beginning of unallocated block
+        //allocate every block of the write at once, after the last block if there is one
+        if (entry_start(fs, &fs->root[file->root_idx]) == FAT_EOC)
+            fat_free_idx = alloc_fat_run(fs, FAT_EOC, num_blocks);
+        else
+            fat_free_idx = alloc_fat_run(fs, file->block_idx, num_blocks);
+        if (fat_free_idx == -1) //disk is full
+            return amount_wrote;
+        else{ //update block chain
+            if (entry_start(fs, &fs->root[file->root_idx]) == FAT_EOC){
+                set_entry_start(fs, &fs->root[file->root_idx], fat_free_idx);
+                mark_root(fs, file->root_idx);
+                start_descriptors(fs, file->root_idx);
+            }
+            file->block_idx = fat_free_idx;
+            file->invalid_block = false;
+        }
+        //new block starts zeroed in the cache
+        block_buf = cache_block(fs->cache, file->block_idx + 2 + fs->super_block.FAT_amount, CACHE_WRITE);
+        if (block_buf != NULL)
+            memset(block_buf, 0, fs->block_size);
+    }
+    else{ //read current block
+        block_buf = cache_block(fs->cache, file->block_idx + 2 + fs->super_block.FAT_amount, CACHE_READ | CACHE_WRITE);
+    }
+    if (block_buf == NULL) //block couldn't be read or cached
+        return amount_wrote;
+    
+    if (count > diff){ //writing more than one block, write to end of block in the cache
+        write_bytes(fs, block_buf, &cur, diff, file->offset % fs->block_size, file);
+        amount_wrote += diff;
+    }
+    else{ //write less than one block, write section in the cache, then return
+        write_bytes(fs, block_buf, &cur, count, file->offset % fs->block_size, file);
+        amount_wrote += count;
+        grow_file(fs, file, start_offset + amount_wrote);
+        
+        settle_block(fs, file, amount_wrote);
+        return amount_wrote;
+    }
+    
+    for (i = 1; i < num_blocks - 1; i++){ //write "middle" blocks directly to disk
+        
+        if (get_fat(fs, file->block_idx) == FAT_EOC){ //if last block allocate a new one
+            
+            fat_free_idx = alloc_fat_run(fs, file->block_idx, num_blocks - i); //ask for the rest of the write
+            if (fat_free_idx == -1){
+                batch_flush(fs, &batch);
+                grow_file(fs, file, start_offset + amount_wrote);
+                return amount_wrote;
+            }
+        }
+        //get next block idx
+        file->block_idx = get_fat(fs, file->block_idx);
+            
+        //update the cached copy if there is one, otherwise queue the block to be written
+        //directly from buff, runs are submitted asynchronously
+        cached = cache_lookup(fs->cache, file->block_idx + 2 + fs->super_block.FAT_amount, CACHE_WRITE);
+        span = cursor_span(&cur, fs->block_size);
+        if (cached == NULL && span == NULL) //block is split between buffers, assemble it in the cache
+            cached = cache_block(fs->cache, file->block_idx + 2 + fs->super_block.FAT_amount, CACHE_WRITE);
+        if (cached != NULL)
+            cursor_gather(&cur, cached, fs->block_size);
+        else if (span != NULL){
+            batch_add(fs, &batch, file->block_idx + 2 + fs->super_block.FAT_amount, span);
+            cursor_skip(&cur, fs->block_size);
+        }
+        else{ //block couldn't be cached
+            batch_flush(fs, &batch);
+            grow_file(fs, file, start_offset + amount_wrote);
+            return amount_wrote;
+        }
+        file->offset += fs->block_size;
+        amount_wrote += fs->block_size;
+    }
+    batch_flush(fs, &batch); //wait for the middle blocks to reach the disk
+    if (num_blocks > 1){ //more than 1 block, need to write last block
+        if (get_fat(fs, file->block_idx) == FAT_EOC){ //if last block allocate a new one
+            fat_free_idx = alloc_fat_run(fs, file->block_idx, 1);
+            if (fat_free_idx == -1){ //return amount wrote if disk is full
+                grow_file(fs, file, start_offset + amount_wrote);
+                return amount_wrote;
+            }
+            else{ //next block added to chain, clear its cached copy for writing
+                file->block_idx = fat_free_idx;
+                block_buf = cache_block(fs->cache, file->block_idx + 2 + fs->super_block.FAT_amount, CACHE_WRITE);
+                if (block_buf != NULL)
+                    memset(block_buf, 0, fs->block_size);
+            }
+        } else{ //read last block to write to
+            file->block_idx = get_fat(fs, file->block_idx);
+            block_buf = cache_block(fs->cache, file->block_idx + 2 + fs->super_block.FAT_amount, CACHE_READ | CACHE_WRITE);
+        }
+        if (block_buf == NULL){ //block couldn't be read or cached
+            grow_file(fs, file, start_offset + amount_wrote);
+            return amount_wrote;
+        }
+	//write into the cached block, it reaches the disk on eviction or sync
+        write_bytes(fs, block_buf, &cur, count - amount_wrote, file->offset % fs->block_size, file);
+        
+        amount_wrote = count;
+    }
+    grow_file(fs, file, start_offset + amount_wrote);
+    settle_block(fs, file, amount_wrote);
+    return amount_wrote;
+}
+
+//total length of the buffers of a vectored transfer, or -1 if the count of buffers is
+//invalid or they add up to more than a transfer can return
+long long iov_total(const struct iovec* iov, int iovcnt){
+    long long total = 0;
+    
+    if (iovcnt < 0 || (iovcnt > 0 && iov == NULL))
+        return -1;
+    for (int i = 0; i < iovcnt; i++){
+        if (iov[i].iov_len > INT_MAX - total)
+            return -1;
+        total += iov[i].iov_len;
+    }
+    return total;
+}
+
+int fs_writev_locked(fs_t* fs, int fd, const struct iovec *iov, int iovcnt)
+{
+    long long count = iov_total(iov, iovcnt);
+    
+    if (fd < 0 || fd >= FS_OPEN_MAX_COUNT) //file descriptor is out of bounds 
+        return -1;
+    
+    if (fs->open_files[fd].root_idx == -1) //file descriptor points to unused entry
+        return -1;
+    
+    if (count == -1) //invalid buffers
+        return -1;
+    
+    return write_to_file(fs, &fs->open_files[fd], iov, iovcnt, count);
+}
+
+int fs_write_locked(fs_t* fs, int fd, void *buf, size_t count)
+{
+    struct iovec iov = { .iov_base = buf, .iov_len = count };
+    
+    if (fd < 0 || fd >= FS_OPEN_MAX_COUNT) //file descriptor is out of bounds 
+        return -1;
+    
+    if (fs->open_files[fd].root_idx == -1) //file descriptor points to unused entry
+        return -1;
+    
+    return write_to_file(fs, &fs->open_files[fd], &iov, 1, count);
+}
+
+//read the queued blocks of a batch into the buffers of a reader without holding the
+//instance lock, the caller holds the lock of the file so that its blocks can't change
+void batch_read_unlocked(fs_t* fs, io_batch* batch){
+    if (batch->count == 0)
+        return;
+    fs_unlock(fs);
+    if (disk_readv(fs->disk, batch->blocks, batch->bufs, batch->count) == -1)
+        batch->error = true;
+    fs_lock(fs);
+    batch->count = 0;
+}
+
+//read into the buffers of iov from the offset of a descriptor, which may also be a copy that
+//the caller discards, the middle blocks are read without the instance lock, so the file's
+//lock must be held for reading
+int read_file(fs_t* fs, file_descriptor* file, const struct iovec* iov, int iovcnt, size_t count)
+{
+    int i;
+    int amount_read = 0;
+    size_t res;
+    io_batch batch = { .count = 0, .write = false, .error = false };
+    io_cursor cur = { .iov = iov, .iovcnt = iovcnt, .seg = 0, .seg_offset = 0 };
+    char *block_buf; //cached copy of the first or last block
+    char *cached;
+    char *span;
+    
+    size_t left = entry_size(fs, &fs->root[file->root_idx]) - file->offset;
+    
+    if (count > left) //stop at the end of the file
+        count = left;
+    if (count == 0) //nothing to read, the offset may even be past the last block
+        return 0;
+    
+    //the missing block may have been added since by fs_fallocate() or another descriptor
+    if (file->invalid_block && get_fat(fs, file->block_idx) != FAT_EOC){
+        file->block_idx = get_fat(fs, file->block_idx);
+        file->invalid_block = false;
+    }
+
+    int num_blocks = get_num_blocks(fs, count, file->offset); //get num blocks to read
+    int diff = fs->block_size - (file->offset % fs->block_size);
+
+    block_buf = cache_block(fs->cache, file->block_idx + 2 + fs->super_block.FAT_amount, CACHE_READ); //read first block
+    if (block_buf == NULL)
+        return -1;
+    if (count > diff){ //if reading more than one block, read from offset to end
+        amount_read += read_bytes(fs, block_buf, &cur, diff, file->offset % fs->block_size, file);
+    }
+    else{ //read less than one block, then return
+        res = read_bytes(fs, block_buf, &cur, count, file->offset % fs->block_size, file);
+        settle_block(fs, file, res);
+        return res;
+    }
+    
+    for (i = 1; i < num_blocks - 1; i++){ //read middle blocks directly from disk to user buf
+        //get next block idx
+        file->block_idx = get_fat(fs, file->block_idx);
+	    
+        if (get_fat(fs, file->block_idx) == FAT_EOC){ //check if it is the last block
+            batch_read_unlocked(fs, &batch); //finish the queued middle blocks first
+            block_buf = cache_block(fs->cache, file->block_idx + 2 + fs->super_block.FAT_amount, CACHE_READ); //read into the cache
+            if (block_buf == NULL)
+                return amount_read;
+            res = read_bytes(fs, block_buf, &cur, count - amount_read, 0, file); //copy the rest
+            amount_read += res;
+            return amount_read;
+        }
+        //copy the cached copy if there is one, otherwise queue the block to be read directly into buff
+        cached = cache_lookup(fs->cache, file->block_idx + 2 + fs->super_block.FAT_amount, 0);
+        span = cursor_span(&cur, fs->block_size);
+        if (cached == NULL && span == NULL) //block is split between buffers, read it through the cache
+            cached = cache_block(fs->cache, file->block_idx + 2 + fs->super_block.FAT_amount, CACHE_READ);
+        if (cached != NULL)
+            cursor_scatter(&cur, cached, fs->block_size);
+        else if (span != NULL){
+            batch.blocks[batch.count] = file->block_idx + 2 + fs->super_block.FAT_amount;
+            batch.bufs[batch.count] = span;
+            cursor_skip(&cur, fs->block_size);
+            if (++batch.count == IO_BATCH)
+                batch_read_unlocked(fs, &batch);
+        }
+        else{ //block couldn't be read or cached
+            batch_read_unlocked(fs, &batch);
+            return amount_read;
+        }
+        file->offset += fs->block_size;
+        amount_read += fs->block_size;
+    }
+    batch_read_unlocked(fs, &batch); //read the middle blocks
+    if (num_blocks > 1){ //read last block into block_buf and copy the rest of count into user buf  
+        file->block_idx = get_fat(fs, file->block_idx);
+        block_buf = cache_block(fs->cache, file->block_idx + 2 + fs->super_block.FAT_amount, CACHE_READ);
+        if (block_buf == NULL)
+            return amount_read;
+        res = read_bytes(fs, block_buf, &cur, count - amount_read, 0, file);
+        amount_read += res;
+    }
+    settle_block(fs, file, amount_read);
+    return amount_read;
+}
+
+
+//read at the offset of a valid descriptor and read ahead if the reads are sequential
+int read_stream(fs_t* fs, int fd, const struct iovec* iov, int iovcnt, size_t count)
+{
+    int amount_read;
+    bool sequential;
+    
+    //a read continuing where the previous one ended is part of a stream
+    sequential = fs->open_files[fd].offset == fs->open_files[fd].ra_offset;
+    
+    amount_read = read_file(fs, &fs->open_files[fd], iov, iovcnt, count);
+    
+    update_readahead(fs, fd, sequential);
+    if (sequential && fs->open_files[fd].ra_window > 0)
+        readahead(fs, fd);
+    return amount_read;
+}
+
+int fs_readv_locked(fs_t* fs, int fd, const struct iovec *iov, int iovcnt)
+{
+    long long count = iov_total(iov, iovcnt);
+    
+    if (fd < 0 || fd >= FS_OPEN_MAX_COUNT) //file descriptor is out of bounds
+        return -1;
+    
+    if (fs->open_files[fd].root_idx == -1) //fd points to unused entry
+        return -1;
+    
+    if (count == -1) //invalid buffers
+        return -1;
+    
+    return read_stream(fs, fd, iov, iovcnt, count);
+}
+
+int fs_read_locked(fs_t* fs, int fd, void *buf, size_t count)
+{
+    struct iovec iov = { .iov_base = buf, .iov_len = count };
+    
+    if (fd < 0 || fd >= FS_OPEN_MAX_COUNT) //file descriptor is out of bounds
+        return -1;
+    
+    if (fs->open_files[fd].root_idx == -1) //fd points to unused entry
+        return -1;
+    
+    return read_stream(fs, fd, &iov, 1, count);
+}
+
+//position a copy of a valid descriptor at offset, for the positional functions which
+//leave the descriptor itself as it is, fail if the offset is past the end of the file
+int position_copy(fs_t* fs, int fd, size_t offset, file_descriptor* file){
+    if (fd < 0 || fd >= FS_OPEN_MAX_COUNT) //file descriptor is out of bounds
+        return -1;
+    
+    if (fs->open_files[fd].root_idx == -1) //file descriptor points to unused entry
+        return -1;
+    
+    if (offset > entry_size(fs, &fs->root[fs->open_files[fd].root_idx])) //offset is out of bounds
+        return -1;
+    
+    *file = fs->open_files[fd];
+    file->offset = offset;
+    seek_block(fs, file);
+    return 0;
+}
+
+int fs_pwrite_locked(fs_t* fs, int fd, void *buf, size_t count, size_t offset)
+{
+    struct iovec iov = { .iov_base = buf, .iov_len = count };
+    file_descriptor file;
+    
+    if (position_copy(fs, fd, offset, &file) == -1)
+        return -1;
+    return write_to_file(fs, &file, &iov, 1, count);
+}
+
+int fs_pread_locked(fs_t* fs, int fd, void *buf, size_t count, size_t offset)
+{
+    struct iovec iov = { .iov_base = buf, .iov_len = count };
+    file_descriptor file;
+    
+    if (position_copy(fs, fd, offset, &file) == -1)
+        return -1;
+    return read_file(fs, &file, &iov, 1, count);
+}
+
+//lock of the file a descriptor is open on, or NULL if the descriptor is invalid,
+//the caller holds the instance lock
+pthread_rwlock_t* file_rwlock(fs_t* fs, int fd){
+    if (fd < 0 || fd >= FS_OPEN_MAX_COUNT || fs->open_files[fd].root_idx == -1)
+        return NULL;
+    return &fs->file_locks[fs->open_files[fd].lock_idx].lock;
+}
+
+//take the lock of the file a descriptor is open on, exclusively to write or shared to read,
+//then the instance lock, return the file lock or NULL with no lock held if the descriptor
+//is invalid. The descriptor may be closed and reopened while waiting for the file lock,
+//so it is looked up again once both are held
+pthread_rwlock_t* lock_file(fs_t* fs, int fd, bool write){
+    pthread_rwlock_t* lock;
+    
+    fs_lock(fs);
+    lock = file_rwlock(fs, fd);
+    fs_unlock(fs);
+    if (lock == NULL) //descriptor is invalid
+        return NULL;
+    if (write)
+        pthread_rwlock_wrlock(lock);
+    else
+        pthread_rwlock_rdlock(lock);
+    fs_lock(fs);
+    if (file_rwlock(fs, fd) != lock){ //closed meanwhile, or reopened on another file
+        fs_unlock(fs);
+        pthread_rwlock_unlock(lock);
+        return NULL;
+    }
+    return lock;
+}
+
+void unlock_file(fs_t* fs, pthread_rwlock_t* lock){
+    fs_unlock(fs);
+    pthread_rwlock_unlock(lock);
+}
+
+//the handle functions hold the instance lock while they run, so that the checkpoint
+//thread only sees the tables between two operations
+int fs_cache_stats_h(fs_t* fs, struct fs_cache_stats *stats)
+{
+    int ret;
+    
+    if (fs == NULL) //disk hasn't been mounted
+        return -1;
+    fs_lock(fs);
+    ret = fs_cache_stats_locked(fs, stats);
+    fs_unlock(fs);
+    return ret;
+}
+
+int fs_info_h(fs_t* fs)
+{
+    int ret;
+    
+    if (fs == NULL) //disk hasn't been mounted
+        return -1;
+    fs_lock(fs);
+    ret = fs_info_locked(fs);
+    fs_unlock(fs);
+    return ret;
+}
+
+int fs_create_h(fs_t* fs, const char *filename)
+{
+    int ret;
+    
+    if (fs == NULL) //disk hasn't been mounted
+        return -1;
+    fs_lock(fs);
+    ret = fs_create_locked(fs, filename);
+    fs_unlock(fs);
+    return ret;
+}
+
+int fs_delete_h(fs_t* fs, const char *filename)
+{
+    int ret;
+    
+    if (fs == NULL) //disk hasn't been mounted
+        return -1;
+    fs_lock(fs);
+    ret = fs_delete_locked(fs, filename);
+    fs_unlock(fs);
+    return ret;
+}
+
+int fs_mkdir_h(fs_t* fs, const char *dirname)
+{
+    int ret;
+    
+    if (fs == NULL) //disk hasn't been mounted
+        return -1;
+    fs_lock(fs);
+    ret = fs_mkdir_locked(fs, dirname);
+    fs_unlock(fs);
+    return ret;
+}
+
+int fs_rmdir_h(fs_t* fs, const char *dirname)
+{
+    int ret;
+    
+    if (fs == NULL) //disk hasn't been mounted
+        return -1;
+    fs_lock(fs);
+    ret = fs_rmdir_locked(fs, dirname);
+    fs_unlock(fs);
+    return ret;
+}
+
+int fs_ls_h(fs_t* fs)
+{
+    int ret;
+    
+    if (fs == NULL) //disk hasn't been mounted
+        return -1;
+    fs_lock(fs);
+    ret = fs_ls_locked(fs);
+    fs_unlock(fs);
+    return ret;
+}
+
+int fs_open_h(fs_t* fs, const char *filename)
+{
+    int ret;
+    
+    if (fs == NULL) //disk hasn't been mounted
+        return -1;
+    fs_lock(fs);
+    ret = fs_open_locked(fs, filename);
+    fs_unlock(fs);
+    return ret;
+}
+
+//closing takes the lock of the file, as reads still running on the descriptor use it
+//without the instance lock and a new open could take its slot meanwhile
+int fs_close_h(fs_t* fs, int fd)
+{
+    pthread_rwlock_t* file;
+    int ret;
+    
+    if (fs == NULL) //disk hasn't been mounted
+        return -1;
+    file = lock_file(fs, fd, true);
+    if (file == NULL) //descriptor is invalid
+        return -1;
+    ret = fs_close_locked(fs, fd);
+    unlock_file(fs, file);
+    return ret;
+}
+
+long long fs_stat_h(fs_t* fs, int fd)
+{
+    long long ret;
+    
+    if (fs == NULL) //disk hasn't been mounted
+        return -1;
+    fs_lock(fs);
+    ret = fs_stat_locked(fs, fd);
+    fs_unlock(fs);
+    return ret;
+}
+
+int fs_lseek_h(fs_t* fs, int fd, size_t offset)
+{
+    int ret;
+    
+    if (fs == NULL) //disk hasn't been mounted
+        return -1;
+    fs_lock(fs);
+    ret = fs_lseek_locked(fs, fd, offset);
+    fs_unlock(fs);
+    return ret;
+}
+
+int fs_fallocate_h(fs_t* fs, int fd, size_t len)
+{
+    int ret;
+    
+    if (fs == NULL) //disk hasn't been mounted
+        return -1;
+    fs_lock(fs);
+    ret = fs_fallocate_locked(fs, fd, len);
+    fs_unlock(fs);
+    return ret;
+}
+
+//reads and writes take the lock of their file before the instance lock, writes hold it
+//exclusively and reads shared, so that reads can release the instance lock meanwhile
+int fs_write_h(fs_t* fs, int fd, void *buf, size_t count)
+{
+    pthread_rwlock_t* file;
+    int ret;
+    
+    if (fs == NULL) //disk hasn't been mounted
+        return -1;
+    file = lock_file(fs, fd, true);
+    if (file == NULL) //descriptor is invalid
+        return -1;
+    ret = fs_write_locked(fs, fd, buf, count);
+    unlock_file(fs, file);
+    return ret;
+}
+
+int fs_read_h(fs_t* fs, int fd, void *buf, size_t count)
+{
+    pthread_rwlock_t* file;
+    int ret;
+    
+    if (fs == NULL) //disk hasn't been mounted
+        return -1;
+    file = lock_file(fs, fd, false);
+    if (file == NULL) //descriptor is invalid
+        return -1;
+    ret = fs_read_locked(fs, fd, buf, count);
+    unlock_file(fs, file);
+    return ret;
+}
+
+int fs_writev_h(fs_t* fs, int fd, const struct iovec *iov, int iovcnt)
+{
+    pthread_rwlock_t* file;
+    int ret;
+    
+    if (fs == NULL) //disk hasn't been mounted
+        return -1;
+    file = lock_file(fs, fd, true);
+    if (file == NULL) //descriptor is invalid
+        return -1;
+    ret = fs_writev_locked(fs, fd, iov, iovcnt);
+    unlock_file(fs, file);
+    return ret;
+}
+
+int fs_readv_h(fs_t* fs, int fd, const struct iovec *iov, int iovcnt)
+{
+    pthread_rwlock_t* file;
+    int ret;
+    
+    if (fs == NULL) //disk hasn't been mounted
+        return -1;
+    file = lock_file(fs, fd, false);
+    if (file == NULL) //descriptor is invalid
+        return -1;
+    ret = fs_readv_locked(fs, fd, iov, iovcnt);
+    unlock_file(fs, file);
+    return ret;
+}
+
+int fs_pwrite_h(fs_t* fs, int fd, void *buf, size_t count, size_t offset)
+{
+    pthread_rwlock_t* file;
+    int ret;
+    
+    if (fs == NULL) //disk hasn't been mounted
+        return -1;
+    file = lock_file(fs, fd, true);
+    if (file == NULL) //descriptor is invalid
+        return -1;
+    ret = fs_pwrite_locked(fs, fd, buf, count, offset);
+    unlock_file(fs, file);
+    return ret;
+}
+
+int fs_pread_h(fs_t* fs, int fd, void *buf, size_t count, size_t offset)
+{
+    pthread_rwlock_t* file;
+    int ret;
+    
+    if (fs == NULL) //disk hasn't been mounted
+        return -1;
+    file = lock_file(fs, fd, false);
+    if (file == NULL) //descriptor is invalid
+        return -1;
+    ret = fs_pread_locked(fs, fd, buf, count, offset);
+    unlock_file(fs, file);
+    return ret;
+}
+
+//the functions without a handle work on the default instance
+int fs_mount(const char *diskname)
+{
+    return fs_mount_ext(diskname, NULL);
+}
+
+int fs_mount_ext(const char *diskname, const struct fs_options *opts)
+{
+    if (default_fs != NULL) //default instance already mounted
+        return -1;
+    
+    default_fs = fs_mount_h(diskname, opts);
+    return default_fs == NULL ? -1 : 0;
+}
+
+int fs_umount(void)
+{
+    if (fs_umount_h(default_fs) == -1)
+        return -1;
+    
+    default_fs = NULL;
+    return 0;
+}
+
+int fs_sync(void)
+{
+    return fs_sync_h(default_fs);
+}
+
+int fs_cache_stats(struct fs_cache_stats *stats)
+{
+    return fs_cache_stats_h(default_fs, stats);
+}
+
+int fs_info(void)
+{
+    return fs_info_h(default_fs);
+}
+
+int fs_create(const char *filename)
+{
+    return fs_create_h(default_fs, filename);
+}
+
+int fs_delete(const char *filename)
+{
+    return fs_delete_h(default_fs, filename);
+}
+
+int fs_mkdir(const char *dirname)
+{
+    return fs_mkdir_h(default_fs, dirname);
+}
+
+int fs_rmdir(const char *dirname)
+{
+    return fs_rmdir_h(default_fs, dirname);
+}
+
+int fs_ls(void)
+{
+    return fs_ls_h(default_fs);
+}
+
+int fs_open(const char *filename)
+{
+    return fs_open_h(default_fs, filename);
+}
+
+int fs_close(int fd)
+{
+    return fs_close_h(default_fs, fd);
+}
+
+long long fs_stat(int fd)
+{
+    return fs_stat_h(default_fs, fd);
+}
+
+int fs_lseek(int fd, size_t offset)
+{
+    return fs_lseek_h(default_fs, fd, offset);
+}
+
+int fs_fallocate(int fd, size_t len)
+{
+    return fs_fallocate_h(default_fs, fd, len);
+}
+
+int fs_write(int fd, void *buf, size_t count)
+{
+    return fs_write_h(default_fs, fd, buf, count);
+}
+
+int fs_read(int fd, void *buf, size_t count)
+{
+    return fs_read_h(default_fs, fd, buf, count);
+}
+
+int fs_writev(int fd, const struct iovec *iov, int iovcnt)
+{
+    return fs_writev_h(default_fs, fd, iov, iovcnt);
+}
+
+int fs_readv(int fd, const struct iovec *iov, int iovcnt)
+{
+    return fs_readv_h(default_fs, fd, iov, iovcnt);
+}
+
+int fs_pwrite(int fd, void *buf, size_t count, size_t offset)
+{
+    return fs_pwrite_h(default_fs, fd, buf, count, offset);
+}
+
+int fs_pread(int fd, void *buf, size_t count, size_t offset)
+{
+    return fs_pread_h(default_fs, fd, buf, count, offset);
+}
@@ -6,12 +6,183 @@
 /** Maximum filename length (including the NULL character) */
 #define FS_FILENAME_LEN 16
 
-/** Maximum number of files in the root directory */
+/** Maximum number of files in a root directory of a single block */
 #define FS_FILE_MAX_COUNT 128
 
 /** Maximum number of open files */
 #define FS_OPEN_MAX_COUNT 32
 
+struct disk_backend;
+struct iovec;
+
+/**
+ * typedef fs_t - Mounted file system instance
+ *
+ * Every fs_*() function has an fs_*_h() counterpart taking a mounted instance
+ * as its first argument, so that one process can mount several virtual disks at
+ * once. The functions without a handle operate on a default instance, mounted
+ * with fs_mount() or fs_mount_ext(). Instances share no state, and a given
+ * instance can be used by several threads at once: a lock of the instance
+ * serializes the operations on its FAT, root directory, descriptors and cache,
+ * and every open file has a reader/writer lock. fs_read() holds the lock of its
+ * file shared and only holds the lock of the instance to find the blocks to
+ * read, not while they are read from the disk, so that reads of different
+ * files, or of the same file through different descriptors, run in parallel.
+ * fs_write() holds the lock of its file exclusively. fs_pread() and fs_pwrite()
+ * lock the file the same way but leave the descriptor untouched, so unlike the
+ * other functions they can be called on one descriptor by several threads at
+ * once. File descriptors are only meaningful for the instance that returned
+ * them.
+ */
+typedef struct fs fs_t;
+
+/** Default capacity of the block cache, in blocks */
+#define FS_CACHE_DEFAULT_BLOCKS 64
+
+/** Default largest readahead window, in blocks */
+#define FS_READAHEAD_DEFAULT_BLOCKS 32
+
+/** Free block allocators, see struct fs_options */
+#define FS_ALLOC_BITMAP	0	/* Summary bitmap of free blocks (default) */
+#define FS_ALLOC_LINEAR	1	/* Scan of the FAT on every allocation */
+
+/**
+ * struct fs_options - Mount options
+ * @cache_blocks: Capacity of the block cache, in blocks (0 selects
+ *                %FS_CACHE_DEFAULT_BLOCKS, or as many bytes worth of
+ *                larger blocks, see fs_mount())
+ * @readahead_blocks: Largest readahead window, in blocks (0 selects
+ *                    %FS_READAHEAD_DEFAULT_BLOCKS, or as many bytes worth of
+ *                    larger blocks, negative disables readahead). Never more
+ *                    than half of the cache.
+ * @backend: Block device backend serving the virtual disk (NULL selects
+ *           the image file backend, see disk.h)
+ * @engine: Asynchronous engine of the virtual disk (0 selects
+ *          %DISK_ENGINE_AUTO, see disk.h)
+ * @allocator: Free block allocator (0 selects %FS_ALLOC_BITMAP). Both
+ *             allocators pick the first free block; the bitmap finds it and
+ *             counts free blocks without scanning the FAT.
+ * @checkpoint_ms: Interval between background checkpoints, in milliseconds
+ *                 (0 for none)
+ * @checkpoint_dirty: Number of modified FAT and root directory blocks that
+ *                    triggers a background checkpoint before the interval
+ *                    expires (0 for no threshold). With a journal, blocks
+ *                    worth of entries modified since the last commit.
+ * @journal_blocks: Size of the journal to add to an image that has none, in
+ *                  blocks (0 for none). Raised to the smallest journal able
+ *                  to log every FAT block and the root directory at once.
+ * @large_dir: Switch an image with a single block root directory to the
+ *             extended directory format (0 leaves it as is)
+ * @lazy_fat: Read each FAT block of a wide file system when it is first used
+ *            instead of the whole FAT at mount (0 reads it at mount)
+ *
+ * A background thread checkpoints the file system, as fs_sync() does, when
+ * @checkpoint_ms or @checkpoint_dirty is set. Checkpoints only hold up the
+ * other operations on the file system while the block cache is written back
+ * and the modified tables are copied, not while they reach the disk.
+ *
+ * The journal is a run of data blocks, chained in the FAT without a root
+ * entry and described in the superblock. Once an image has one, every mount
+ * replays it and uses it: fs_sync() and background checkpoints then commit the
+ * FAT and root directory entries modified since the previous commit as one
+ * transaction of a few sequential blocks, instead of rewriting the modified
+ * FAT blocks and root directory. Those are only rewritten by fs_umount(), or
+ * when the journal is full.
+ *
+ * An extended directory is flagged in the superblock. Besides the root
+ * directory block, it has blocks chained in the FAT like a file, one more
+ * every %FS_FILE_MAX_COUNT files, so it can hold as many files as the disk has
+ * room for. Its filenames are indexed in memory at mount, so opening, creating
+ * or deleting a file reads no directory block, and only rewrites the block of
+ * its entry. With a journal, the directory can only grow as long as the
+ * journal can still log all of it at once.
+ *
+ * The superblock of a wide file system records its number of free blocks when
+ * it is unmounted, and drops it when it is mounted again. When the count is
+ * there, @lazy_fat makes the mount time independent of the size of the FAT:
+ * nothing but the superblock and the root directory is read at mount, and the
+ * free blocks are counted from the superblock. A file system that was not
+ * unmounted cleanly, or that has the original format, has its FAT read at
+ * mount regardless. Allocations still pick the same blocks, reading the FAT in
+ * order until the first free ones are known.
+ */
+struct fs_options {
+	size_t cache_blocks;
+	int readahead_blocks;
+	const struct disk_backend *backend;
+	int engine;
+	int allocator;
+	int checkpoint_ms;
+	size_t checkpoint_dirty;
+	size_t journal_blocks;
+	int large_dir;
+	int lazy_fat;
+};
+
+/**
+ * struct fs_cache_stats - Block cache counters
+ * @capacity: Number of blocks the cache can hold
+ * @hits: Block lookups served from the cache
+ * @misses: Block lookups that needed a cache slot
+ * @evictions: Cached blocks dropped to make room for others
+ * @writebacks: Dirty cached blocks written to disk
+ * @readahead: Blocks read ahead of sequential fs_read() calls
+ * @readahead_hits: Blocks read ahead that a later read used
+ * @readahead_waste: Blocks read ahead that left the cache unused
+ */
+struct fs_cache_stats {
+	size_t capacity;
+	size_t hits;
+	size_t misses;
+	size_t evictions;
+	size_t writebacks;
+	size_t readahead;
+	size_t readahead_hits;
+	size_t readahead_waste;
+};
+
+/**
+ * struct fs_format_options - Format options
+ * @wide: Create a wide file system even if the original format can describe
+ *        it (0 picks the original format whenever it can, see fs_mount())
+ * @block_size: Size of the blocks, a power of two no smaller than 4096 (0
+ *              selects 4096). Larger blocks need a wide file system.
+ * @journal_blocks: Size of the journal to reserve, in blocks (0 for none), as
+ *                  with &struct fs_options
+ * @large_dir: Create the root directory in the extended directory format (0
+ *             for a single block root directory)
+ */
+struct fs_format_options {
+	int wide;
+	size_t block_size;
+	size_t journal_blocks;
+	int large_dir;
+};
+
+/**
+ * fs_format - Create an empty file system
+ * @diskname: Name of the virtual disk file
+ * @nblocks: Number of data blocks
+ * @opts: Format options, or NULL for the defaults
+ *
+ * Create the virtual disk file @diskname, replacing any existing file, with an
+ * empty file system of @nblocks data blocks. Only the superblock and the first
+ * FAT block are written: the file is sized with ftruncate() and the rest of the
+ * FAT, the root directory and the data blocks are left as holes that read as
+ * zeros, so that even large virtual disks are created at once and take no
+ * space until they are written. Without options, a file system that fits in
+ * the original format is identical to the one created by the reference
+ * fs_make tool.
+ *
+ * The file system is not mounted. A journal or an extended directory requested
+ * by @opts is added by mounting it once with the corresponding mount options.
+ *
+ * Return: -1 if @nblocks is 0 or too large, if @opts is invalid, or if virtual
+ * disk file @diskname cannot be created or written. 0 otherwise.
+ */
+int fs_format(const char *diskname, size_t nblocks,
+	      const struct fs_format_options *opts);
+
 /**
  * fs_mount - Mount a file system
  * @diskname: Name of the virtual disk file
@@ -20,11 +191,85 @@
  * contains. A file system needs to be mounted before files can be read from it
  * with fs_read() or written to it with fs_write().
  *
- * Return: -1 if virtual disk file @diskname cannot be opened, or if no valid
- * file system can be located. 0 otherwise.
+ * Besides the original format, with 16-bit FAT entries and block counts that
+ * limit a disk to 65535 data blocks, wide file systems are supported. Their
+ * superblock has the signature "ECS150FW" and 32-bit block numbers and counts,
+ * their FAT has 32-bit entries, and their files can be larger than 4 GiB. The
+ * format is otherwise the same, and tools that only know the original format
+ * refuse to mount them.
+ *
+ * The blocks of a wide file system can also be larger than 4096 bytes: its
+ * superblock records their size, a power of two, with 0 standing for 4096.
+ * Larger blocks need fewer FAT entries and fewer disk requests per byte of a
+ * large file, at the cost of more space lost at the end of small files.
+ *
+ * Return: -1 if virtual disk file @diskname cannot be opened, if no valid
+ * file system can be located, or if its journal cannot be replayed or added.
+ * 0 otherwise.
  */
 int fs_mount(const char *diskname);
 
+/**
+ * fs_mount_ext - Mount a file system with options
+ * @diskname: Name of the virtual disk file
+ * @opts: Mount options, or NULL for the defaults
+ *
+ * Same as fs_mount(), with the behavior of the mounted file system tuned by
+ * @opts.
+ *
+ * Return: -1 if virtual disk file @diskname cannot be opened, if no valid
+ * file system can be located, or if its journal cannot be replayed or added.
+ * 0 otherwise.
+ */
+int fs_mount_ext(const char *diskname, const struct fs_options *opts);
+
+/**
+ * fs_mount_h - Mount a file system instance
+ * @diskname: Name of the virtual disk file
+ * @opts: Mount options, or NULL for the defaults
+ *
+ * Same as fs_mount_ext(), but return a new instance independent from the
+ * default one and from any other instance. Mounting the same virtual disk file
+ * in two instances at once is not supported.
+ *
+ * Return: NULL if virtual disk file @diskname cannot be opened, if no valid
+ * file system can be located, or if its journal cannot be replayed or added.
+ * The mounted instance otherwise.
+ */
+fs_t *fs_mount_h(const char *diskname, const struct fs_options *opts);
+
+/**
+ * fs_umount_h - Unmount a file system instance
+ * @fs: Instance returned by fs_mount_h()
+ *
+ * Same as fs_umount() for @fs. On success, @fs is freed and must not be used
+ * anymore.
+ *
+ * Return: -1 if @fs is NULL, if it cannot be written back or closed, or if
+ * there are still open file descriptors. 0 otherwise.
+ */
+int fs_umount_h(fs_t *fs);
+
+int fs_sync_h(fs_t *fs);
+int fs_cache_stats_h(fs_t *fs, struct fs_cache_stats *stats);
+int fs_info_h(fs_t *fs);
+int fs_create_h(fs_t *fs, const char *filename);
+int fs_delete_h(fs_t *fs, const char *filename);
+int fs_mkdir_h(fs_t *fs, const char *dirname);
+int fs_rmdir_h(fs_t *fs, const char *dirname);
+int fs_ls_h(fs_t *fs);
+int fs_open_h(fs_t *fs, const char *filename);
+int fs_close_h(fs_t *fs, int fd);
+long long fs_stat_h(fs_t *fs, int fd);
+int fs_lseek_h(fs_t *fs, int fd, size_t offset);
+int fs_fallocate_h(fs_t *fs, int fd, size_t len);
+int fs_write_h(fs_t *fs, int fd, void *buf, size_t count);
+int fs_read_h(fs_t *fs, int fd, void *buf, size_t count);
+int fs_writev_h(fs_t *fs, int fd, const struct iovec *iov, int iovcnt);
+int fs_readv_h(fs_t *fs, int fd, const struct iovec *iov, int iovcnt);
+int fs_pwrite_h(fs_t *fs, int fd, void *buf, size_t count, size_t offset);
+int fs_pread_h(fs_t *fs, int fd, void *buf, size_t count, size_t offset);
+
 /**
  * fs_umount - Unmount file system
  *
@@ -36,6 +281,32 @@ int fs_mount(const char *diskname);
  */
 int fs_umount(void);
 
+/**
+ * fs_sync - Flush file system to disk
+ *
+ * Write back every modified cached data block, then the FAT blocks and the root
+ * directory block that have been modified, and flush the virtual disk file. The
+ * data blocks are flushed before the tables are written, so that the tables on
+ * disk never point to data that did not reach it. Data written with fs_write()
+ * only reaches the disk on fs_sync(), fs_umount(), a background checkpoint (see
+ * struct fs_options), or when its block is evicted from the block cache. With a
+ * journal, the modified entries of the tables are committed to the journal
+ * instead of rewriting the tables.
+ *
+ * Return: -1 if no underlying virtual disk was opened, or if writing to it
+ * fails. 0 otherwise.
+ */
+int fs_sync(void);
+
+/**
+ * fs_cache_stats - Get block cache counters
+ * @stats: Counters to fill
+ *
+ * Return: -1 if no underlying virtual disk was opened or if @stats is NULL. 0
+ * otherwise.
+ */
+int fs_cache_stats(struct fs_cache_stats *stats);
+
 /**
  * fs_info - Display information about file system
  *
@@ -54,9 +325,25 @@ int fs_info(void);
  * length cannot exceed %FS_FILENAME_LEN characters (including the NULL
  * character).
  *
+ * @filename can also be a path, such as "dir/sub/file", naming a file of a
+ * directory created with fs_mkdir(). Every component of the path follows the
+ * rules of a filename, and a leading '/' is ignored. The same applies to the
+ * other functions taking a filename. Each component is resolved through an
+ * in-memory index of the names of every directory, so the cost of resolving a
+ * path only depends on its depth.
+ *
+ * Paths are only split on '/' once the file system has a directory. Until
+ * then, as before directories existed, @filename is a single name of the root
+ * directory that may contain '/', like the names the reference tools store.
+ * Once a directory exists, a name of the root directory equal to the whole of
+ * @filename is still found first, but new files are created along the path,
+ * so such names can then no longer be created.
+ *
  * Return: -1 if @filename is invalid, if a file named @filename already exists,
- * or if string @filename is too long, or if the root directory already contains
- * %FS_FILE_MAX_COUNT files. 0 otherwise.
+ * or if string @filename is too long, if a directory of the path does not
+ * exist, or if the root directory already contains %FS_FILE_MAX_COUNT entries
+ * (an extended directory grows instead, and only fails when the disk is full).
+ * 0 otherwise.
  */
 int fs_create(const char *filename);
 
@@ -68,14 +355,47 @@ int fs_create(const char *filename);
  * system.
  *
  * Return: -1 if @filename is invalid, if there is no file named @filename to
- * delete, or if file @filename is currently open. 0 otherwise.
+ * delete (a directory is removed with fs_rmdir()), or if file @filename is
+ * currently open. 0 otherwise.
  */
 int fs_delete(const char *filename);
 
+/**
+ * fs_mkdir - Create a new directory
+ * @dirname: Directory name
+ *
+ * Create a new and empty directory named @dirname, following the same rules as
+ * fs_create(). Files and directories can then be created in it with paths
+ * starting with @dirname.
+ *
+ * Directories take an entry of the root directory, and so do their files: an
+ * image with subdirectories holds %FS_FILE_MAX_COUNT files and directories in
+ * all, unless it has an extended directory. Tools that do not know about
+ * subdirectories see every one of these entries as a file of the root
+ * directory.
+ *
+ * Return: -1 if @dirname is invalid, if a file or directory named @dirname
+ * already exists, if a directory of the path does not exist, or if there is no
+ * room for another entry. 0 otherwise.
+ */
+int fs_mkdir(const char *dirname);
+
+/**
+ * fs_rmdir - Remove a directory
+ * @dirname: Directory name
+ *
+ * Remove the empty directory named @dirname.
+ *
+ * Return: -1 if @dirname is invalid, if there is no directory named @dirname,
+ * or if it still contains files or directories. 0 otherwise.
+ */
+int fs_rmdir(const char *dirname);
+
 /**
  * fs_ls - List files on file system
  *
- * List information about the files located in the root directory.
+ * List information about the files and directories located in the root
+ * directory.
  *
  * Return: -1 if no underlying virtual disk was opened. 0 otherwise.
  */
@@ -114,12 +434,13 @@ int fs_close(int fd);
  * fs_stat - Get file status
  * @fd: File descriptor
  *
- * Get the current size of the file pointed by file descriptor @fd.
+ * Get the current size of the file pointed by file descriptor @fd, which can
+ * exceed 4 GiB on a wide file system (see fs_mount()).
  *
  * Return: -1 if file descriptor @fd is invalid (out of bounds or not currently
  * open). Otherwise return the current size of file.
  */
-int fs_stat(int fd);
+long long fs_stat(int fd);
 
 /**
  * fs_lseek - Set file offset
@@ -130,12 +451,34 @@ int fs_stat(int fd);
  * descriptor @fd to the argument @offset. To append to a file, one can call
  * fs_lseek(fd, fs_stat(fd));
  *
+ * The block holding @offset is found through an index of the file's blocks,
+ * shared by its descriptors and built lazily as the file is accessed, so each
+ * block of the FAT chain is walked at most once while the file is open.
+ *
  * Return: -1 if file descriptor @fd is invalid (out of bounds or not currently
  * open), or if @offset is out of bounds (beyond the end of the file). 0
  * otherwise.
  */
 int fs_lseek(int fd, size_t offset);
 
+/**
+ * fs_fallocate - Reserve space for a file
+ * @fd: File descriptor
+ * @len: Number of bytes the file should be able to hold
+ *
+ * Make sure that the file referenced by file descriptor @fd has enough data
+ * blocks to hold @len bytes, appending free blocks to it if needed. The new
+ * blocks are taken as one contiguous run when the disk has one. The size of the
+ * file does not change: later writes up to @len bytes use the reserved blocks
+ * instead of allocating new ones. Reserved blocks are released when the file is
+ * deleted.
+ *
+ * Return: -1 if file descriptor @fd is invalid (out of bounds or not currently
+ * open), or if the disk does not have enough free blocks or its FAT cannot be
+ * read, in which case nothing is reserved. 0 otherwise.
+ */
+int fs_fallocate(int fd, size_t len);
+
 /**
  * fs_write - Write to a file
  * @fd: File descriptor
@@ -147,7 +490,9 @@ int fs_lseek(int fd, size_t offset);
  * least @count bytes.
  *
  * When the function attempts to write past the end of the file, the file is
- * automatically extended to hold the additional bytes. If the underlying disk
+ * automatically extended to hold the additional bytes. The blocks needed by the
+ * write are allocated together, as a contiguous run when possible, right after
+ * the last block of the file if it is free. If the underlying disk
  * runs out of space while performing a write operation, fs_write() should write
  * as many bytes as possible. The number of written bytes can therefore be
  * smaller than @count (it can even be 0 if there is no more space on disk).
@@ -172,9 +517,81 @@ int fs_write(int fd, void *buf, size_t count);
  * is at the end of the file). The file offset of the file descriptor is
  * implicitly incremented by the number of bytes that were actually read.
  *
+ * When consecutive calls read the file sequentially, the blocks that follow
+ * are prefetched into the block cache in the background. The prefetch window
+ * doubles on each sequential call and halves on each call at another offset.
+ *
  * Return: -1 if file descriptor @fd is invalid (out of bounds or not currently
  * open). Otherwise return the number of bytes actually read.
  */
 int fs_read(int fd, void *buf, size_t count);
 
+/**
+ * fs_writev - Write to a file from several buffers
+ * @fd: File descriptor
+ * @iov: Buffers to write in the file, in order
+ * @iovcnt: Number of buffers in @iov
+ *
+ * Write the buffers described by @iov into the file referenced by file
+ * descriptor @fd, as if they were a single buffer passed to fs_write(). The
+ * data goes through the blocks of the file in a single pass, so a block shared
+ * by several buffers is only read and written once.
+ *
+ * Return: -1 if file descriptor @fd is invalid (out of bounds or not currently
+ * open), @iovcnt is negative, or the buffers add up to more than INT_MAX bytes.
+ * Otherwise return the number of bytes actually written.
+ */
+int fs_writev(int fd, const struct iovec *iov, int iovcnt);
+
+/**
+ * fs_readv - Read from a file into several buffers
+ * @fd: File descriptor
+ * @iov: Buffers to be filled with data, in order
+ * @iovcnt: Number of buffers in @iov
+ *
+ * Read from the file referenced by file descriptor @fd into the buffers
+ * described by @iov, as if they were a single buffer passed to fs_read().
+ *
+ * Return: -1 if file descriptor @fd is invalid (out of bounds or not currently
+ * open), @iovcnt is negative, or the buffers add up to more than INT_MAX bytes.
+ * Otherwise return the number of bytes actually read.
+ */
+int fs_readv(int fd, const struct iovec *iov, int iovcnt);
+
+/**
+ * fs_pwrite - Write to a file at a given offset
+ * @fd: File descriptor
+ * @buf: Data buffer to write in the file
+ * @count: Number of bytes of data to be written
+ * @offset: Offset in the file to write at
+ *
+ * Write @count bytes of data from buffer pointer by @buf into the file
+ * referenced by file descriptor @fd, starting at @offset, as fs_lseek() then
+ * fs_write() would, without changing the file offset of @fd.
+ *
+ * Return: -1 if file descriptor @fd is invalid (out of bounds or not currently
+ * open) or @offset is larger than the current file size. Otherwise return the
+ * number of bytes actually written.
+ */
+int fs_pwrite(int fd, void *buf, size_t count, size_t offset);
+
+/**
+ * fs_pread - Read from a file at a given offset
+ * @fd: File descriptor
+ * @buf: Data buffer to be filled with data
+ * @count: Number of bytes of data to be read
+ * @offset: Offset in the file to read from
+ *
+ * Read @count bytes of data from the file referenced by file descriptor @fd,
+ * starting at @offset, into buffer pointer by @buf, as fs_lseek() then
+ * fs_read() would, without changing the file offset of @fd. The number of
+ * bytes read is smaller than @count if the file ends before, and 0 if @offset
+ * is the end of the file. Nothing is read ahead.
+ *
+ * Return: -1 if file descriptor @fd is invalid (out of bounds or not currently
+ * open) or @offset is larger than the current file size. Otherwise return the
+ * number of bytes actually read.
+ */
+int fs_pread(int fd, void *buf, size_t count, size_t offset);
+
 #endif /* _FS_H */
@@ -0,0 +1,308 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "disk.h"
+#include "journal.h"
+
+#define journal_error(fmt, ...) \
+	fprintf(stderr, "%s: "fmt"\n", __func__, ##__VA_ARGS__)
+
+/* "JTXN" */
+#define JOURNAL_MAGIC 0x4e58544a
+
+/* Header in front of the records of each transaction */
+struct journal_header {
+	uint32_t magic;
+	/* Epoch of the half holding the transaction, and position in that half */
+	uint32_t epoch;
+	uint32_t seq;
+	/* Length of the records following the header */
+	uint32_t length;
+	/* FNV-1a hash of the header, with this field zero, and of the records */
+	uint32_t checksum;
+	uint8_t padding[12];
+} __attribute__((__packed__));
+
+/* Journal description */
+struct journal {
+	struct disk *disk;
+	size_t block_size;
+	/* First block of each half, and number of blocks per half */
+	size_t half_start[2];
+	size_t half_blocks;
+	/* Half holding the current epoch */
+	int current;
+	uint32_t epoch;
+	/* Number of the next transaction, and its block in the current half */
+	uint32_t seq;
+	size_t used;
+	/* One half worth of blocks to stage transactions */
+	uint8_t *buf;
+	size_t *blocks;
+	void **bufs;
+};
+
+static size_t tx_blocks(size_t block_size, size_t len)
+{
+	return (sizeof(struct journal_header) + len + block_size - 1) /
+		block_size;
+}
+
+static uint32_t fnv1a(const uint8_t *data, size_t len)
+{
+	uint32_t hash = 2166136261u;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		hash ^= data[i];
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+/* Checksum of the transaction staged in the buffer */
+static uint32_t tx_checksum(struct journal *journal)
+{
+	struct journal_header *hdr = (struct journal_header *)journal->buf;
+	uint32_t saved = hdr->checksum, sum;
+
+	hdr->checksum = 0;
+	sum = fnv1a(journal->buf, sizeof(*hdr) + hdr->length);
+	hdr->checksum = saved;
+
+	return sum;
+}
+
+/* Transfer @n blocks between the buffer and a half, from block @offset */
+static int tx_xfer(struct journal *journal, int write, int half,
+		   size_t offset, size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		journal->blocks[i] = journal->half_start[half] + offset + i;
+		journal->bufs[i] = journal->buf + i * journal->block_size;
+	}
+	if (write)
+		return disk_writev(journal->disk, journal->blocks,
+				   (const void *const *)journal->bufs, n);
+	return disk_readv(journal->disk, journal->blocks, journal->bufs, n);
+}
+
+/*
+ * Read the transaction at block @offset of a half into the buffer. Return its
+ * number of blocks, 0 if it is not a valid transaction numbered @seq (of
+ * epoch @epoch unless @any_epoch), or -1 if reading fails.
+ */
+static int tx_read(struct journal *journal, int half, size_t offset,
+		   int any_epoch, uint32_t epoch, uint32_t seq)
+{
+	struct journal_header *hdr = (struct journal_header *)journal->buf;
+	size_t n;
+
+	if (offset >= journal->half_blocks)
+		return 0;
+	if (tx_xfer(journal, 0, half, offset, 1))
+		return -1;
+	if (hdr->magic != JOURNAL_MAGIC || hdr->seq != seq ||
+	    (!any_epoch && hdr->epoch != epoch))
+		return 0;
+
+	n = tx_blocks(journal->block_size, hdr->length);
+	if (n > journal->half_blocks - offset)
+		return 0;
+	if (n > 1 && tx_xfer(journal, 0, half, offset, n))
+		return -1;
+	if (tx_checksum(journal) != hdr->checksum)
+		return 0;
+
+	return n;
+}
+
+/* Write a transaction at block @offset of a half, return its block count */
+static int tx_write(struct journal *journal, int half, size_t offset,
+		    uint32_t epoch, uint32_t seq, const void *records,
+		    size_t len)
+{
+	struct journal_header *hdr = (struct journal_header *)journal->buf;
+	size_t n = tx_blocks(journal->block_size, len);
+
+	if (n > journal->half_blocks - offset) {
+		journal_error("transaction too large (%zu bytes)", len);
+		return -1;
+	}
+
+	memset(hdr, 0, sizeof(*hdr));
+	hdr->magic = JOURNAL_MAGIC;
+	hdr->epoch = epoch;
+	hdr->seq = seq;
+	hdr->length = len;
+	if (len)
+		memcpy(journal->buf + sizeof(*hdr), records, len);
+	memset(journal->buf + sizeof(*hdr) + len, 0,
+	       n * journal->block_size - sizeof(*hdr) - len);
+	hdr->checksum = tx_checksum(journal);
+
+	if (tx_xfer(journal, 1, half, offset, n))
+		return -1;
+
+	return n;
+}
+
+static struct journal *journal_alloc(struct disk *disk, size_t start,
+				     size_t nblocks)
+{
+	struct journal *journal;
+
+	if (nblocks < journal_min_blocks(disk, 0)) {
+		journal_error("journal too small (%zu blocks)", nblocks);
+		return NULL;
+	}
+
+	journal = calloc(1, sizeof(*journal));
+	if (!journal)
+		return NULL;
+	journal->disk = disk;
+	journal->block_size = disk_block_size(disk);
+	journal->half_blocks = nblocks / 2;
+	journal->half_start[0] = start;
+	journal->half_start[1] = start + journal->half_blocks;
+
+	journal->buf = malloc(journal->half_blocks * journal->block_size);
+	journal->blocks = malloc(journal->half_blocks * sizeof(size_t));
+	journal->bufs = malloc(journal->half_blocks * sizeof(void *));
+	if (!journal->buf || !journal->blocks || !journal->bufs) {
+		journal_close(journal);
+		return NULL;
+	}
+
+	return journal;
+}
+
+size_t journal_min_blocks(struct disk *disk, size_t len)
+{
+	return 2 * tx_blocks(disk_block_size(disk), len);
+}
+
+int journal_format(struct disk *disk, size_t start, size_t nblocks)
+{
+	struct journal *journal;
+	int ret;
+
+	journal = journal_alloc(disk, start, nblocks);
+	if (!journal)
+		return -1;
+
+	/* An empty first epoch, and nothing valid in the second half */
+	ret = tx_write(journal, 0, 0, 1, 0, NULL, 0) < 0;
+	memset(journal->buf, 0, journal->block_size);
+	if (!ret)
+		ret = tx_xfer(journal, 1, 1, 0, 1);
+
+	journal_close(journal);
+	return ret ? -1 : 0;
+}
+
+struct journal *journal_open(struct disk *disk, size_t start, size_t nblocks,
+			     journal_apply_t apply, void *ctx)
+{
+	struct journal_header *hdr;
+	struct journal *journal;
+	uint32_t epoch[2] = { 0, 0 };
+	int valid[2], n, half;
+
+	journal = journal_alloc(disk, start, nblocks);
+	if (!journal)
+		return NULL;
+	hdr = (struct journal_header *)journal->buf;
+
+	/* The current half is the one starting the latest epoch */
+	for (half = 0; half < 2; half++) {
+		valid[half] = tx_read(journal, half, 0, 1, 0, 0);
+		if (valid[half] < 0)
+			goto fail;
+		epoch[half] = hdr->epoch;
+	}
+	if (!valid[0] && !valid[1]) {
+		journal_error("no valid journal");
+		goto fail;
+	}
+	journal->current = !valid[0] || (valid[1] && epoch[1] > epoch[0]);
+	journal->epoch = epoch[journal->current];
+
+	/* Replay every transaction of the epoch up to the first invalid one */
+	while ((n = tx_read(journal, journal->current, journal->used, 0,
+			    journal->epoch, journal->seq)) > 0) {
+		if (apply(ctx, journal->buf + sizeof(*hdr), hdr->length))
+			goto fail;
+		journal->used += n;
+		journal->seq++;
+	}
+	if (n < 0)
+		goto fail;
+
+	return journal;
+
+fail:
+	journal_close(journal);
+	return NULL;
+}
+
+void journal_close(struct journal *journal)
+{
+	if (!journal)
+		return;
+
+	free(journal->buf);
+	free(journal->blocks);
+	free(journal->bufs);
+	free(journal);
+}
+
+size_t journal_capacity(const struct journal *journal)
+{
+	return journal->half_blocks * journal->block_size -
+		sizeof(struct journal_header);
+}
+
+size_t journal_space(const struct journal *journal)
+{
+	size_t left = journal->half_blocks - journal->used;
+
+	if (!left)
+		return 0;
+	return left * journal->block_size - sizeof(struct journal_header);
+}
+
+int journal_append(struct journal *journal, const void *records, size_t len)
+{
+	int n;
+
+	n = tx_write(journal, journal->current, journal->used, journal->epoch,
+		     journal->seq, records, len);
+	if (n < 0)
+		return -1;
+
+	journal->used += n;
+	journal->seq++;
+	return 0;
+}
+
+int journal_switch(struct journal *journal, const void *records, size_t len)
+{
+	int n;
+
+	n = tx_write(journal, !journal->current, 0, journal->epoch + 1, 0,
+		     records, len);
+	if (n < 0)
+		return -1;
+
+	journal->current = !journal->current;
+	journal->epoch++;
+	journal->seq = 1;
+	journal->used = n;
+	return 0;
+}
@@ -0,0 +1,117 @@
+#ifndef _JOURNAL_H
+#define _JOURNAL_H
+
+#include <stddef.h> /* for size_t definition */
+
+struct disk;
+struct journal;
+
+/**
+ * journal_apply_t - Replay callback
+ * @ctx: Context given to journal_open()
+ * @records: Records of one committed transaction
+ * @len: Length of @records in bytes
+ *
+ * Return: -1 if the records are invalid. 0 otherwise.
+ */
+typedef int (*journal_apply_t)(void *ctx, const void *records, size_t len);
+
+/**
+ * journal_min_blocks - Smallest journal holding a transaction
+ * @disk: Disk holding the journal, whose block size counts
+ * @len: Length of the largest transaction, in bytes of records
+ *
+ * Return: The number of blocks a journal needs so that journal_switch() can
+ * always write a transaction of @len bytes.
+ */
+size_t journal_min_blocks(struct disk *disk, size_t len);
+
+/**
+ * journal_format - Initialize a journal region
+ * @disk: Disk holding the journal
+ * @start: First block of the journal
+ * @nblocks: Number of blocks of the journal
+ *
+ * Write an empty journal to @nblocks blocks of @disk from @start. The caller
+ * makes it durable with disk_sync().
+ *
+ * Return: -1 if writing to @disk fails. 0 otherwise.
+ */
+int journal_format(struct disk *disk, size_t start, size_t nblocks);
+
+/**
+ * journal_open - Open and replay a journal
+ * @disk: Disk holding the journal
+ * @start: First block of the journal
+ * @nblocks: Number of blocks of the journal
+ * @apply: Called with the records of each committed transaction, in order
+ * @ctx: Passed to @apply
+ *
+ * The journal is split in two halves. Transactions are appended to the
+ * current half, after the ones already there. journal_switch() writes a
+ * transaction at the start of the other half, which then becomes the current
+ * one: it replaces every transaction before it. Each transaction carries a
+ * checksum, so a transaction that was only partially written is never
+ * replayed, nor anything after it.
+ *
+ * Return: NULL if the journal cannot be read, holds no valid transaction, or
+ * if @apply fails. The open journal otherwise.
+ */
+struct journal *journal_open(struct disk *disk, size_t start, size_t nblocks,
+			     journal_apply_t apply, void *ctx);
+
+/**
+ * journal_close - Free a journal
+ * @journal: Journal to free, or NULL
+ */
+void journal_close(struct journal *journal);
+
+/**
+ * journal_capacity - Largest transaction
+ * @journal: Journal
+ *
+ * Return: The length in bytes of the largest transaction journal_switch()
+ * accepts.
+ */
+size_t journal_capacity(const struct journal *journal);
+
+/**
+ * journal_space - Room left in the current half
+ * @journal: Journal
+ *
+ * Return: The length in bytes of the largest transaction journal_append()
+ * accepts.
+ */
+size_t journal_space(const struct journal *journal);
+
+/**
+ * journal_append - Commit a transaction
+ * @journal: Journal
+ * @records: Records of the transaction
+ * @len: Length of @records in bytes, at most journal_space()
+ *
+ * Write a transaction after the last one of the current half, in sequential
+ * blocks. The caller makes it durable with disk_sync().
+ *
+ * Return: -1 if the transaction doesn't fit or if writing it fails. 0
+ * otherwise.
+ */
+int journal_append(struct journal *journal, const void *records, size_t len);
+
+/**
+ * journal_switch - Commit a transaction replacing the journal
+ * @journal: Journal
+ * @records: Records of the transaction
+ * @len: Length of @records in bytes, at most journal_capacity()
+ *
+ * Write a transaction at the start of the other half and make that half the
+ * current one. Once it is durable, replaying the journal only replays @records
+ * and what is appended after them. If writing fails, the current half stays
+ * the same.
+ *
+ * Return: -1 if the transaction doesn't fit or if writing it fails. 0
+ * otherwise.
+ */
+int journal_switch(struct journal *journal, const void *records, size_t len);
+
+#endif /* _JOURNAL_H */
@@ -0,0 +1,135 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <disk.h>
+#include <fs.h>
+
+#define bench_error(fmt, ...) \
+	fprintf(stderr, "%s: "fmt"\n", __func__, ##__VA_ARGS__)
+
+#define die(...)				\
+do {							\
+	bench_error(__VA_ARGS__);	\
+	exit(1);					\
+} while (0)
+
+/* Largest disk the 16-bit super block can describe */
+#define MAX_BLOCKS 65535
+
+/* Files created by the fragmented refill */
+#define NFILES 100
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/*
+ * Create an empty file system of @total blocks, super block, FAT and root
+ * directory included. fs_make.x stops at 8192 data blocks, fs_format() does
+ * not.
+ */
+static size_t make_disk(const char *diskname, size_t total)
+{
+	size_t fat_blocks = 1, data;
+
+	while (total - 2 - fat_blocks > fat_blocks * BLOCK_SIZE / 2)
+		fat_blocks++;
+	data = total - 2 - fat_blocks;
+
+	if (fs_format(diskname, data, NULL))
+		die("Cannot create %s", diskname);
+
+	return data;
+}
+
+/* Append one block per call to @filename until @nblocks or the disk is full */
+static size_t fill(fs_t *fs, const char *filename, size_t nblocks)
+{
+	char buf[BLOCK_SIZE];
+	size_t n;
+	int fd;
+
+	memset(buf, 0x5a, sizeof(buf));
+	if (fs_create_h(fs, filename) || (fd = fs_open_h(fs, filename)) < 0)
+		die("Cannot create %s", filename);
+	for (n = 0; n < nblocks; n++)
+		if (fs_write_h(fs, fd, buf, BLOCK_SIZE) != BLOCK_SIZE)
+			break;
+	fs_close_h(fs, fd);
+
+	return n;
+}
+
+static void report(const char *name, const char *op, size_t nblocks,
+		   double ns)
+{
+	printf("%-6s %-8s %8zu blocks %10.1f ns/block %10.3f s\n",
+	       name, op, nblocks, ns / nblocks, ns / 1e9);
+}
+
+static void bench_allocator(const char *diskname, const char *name,
+			    int allocator, size_t total)
+{
+	struct fs_options opts = {
+		.backend = &disk_ram_backend,
+		.allocator = allocator,
+	};
+	size_t data = make_disk(diskname, total), n, i;
+	char filename[FS_FILENAME_LEN];
+	double start;
+	fs_t *fs;
+
+	if (!(fs = fs_mount_h(diskname, &opts)))
+		die("Cannot mount %s", diskname);
+
+	/* Sequential fill of an empty disk, one allocation per block */
+	start = now_ns();
+	n = fill(fs, "fill", data);
+	report(name, "fill", n, now_ns() - start);
+	if (fs_delete_h(fs, "fill"))
+		die("Cannot delete fill");
+
+	/* Free every other file, then fill the holes left behind */
+	for (i = 0; i < NFILES; i++) {
+		snprintf(filename, sizeof(filename), "f%zu", i);
+		fill(fs, filename, data / NFILES);
+	}
+	for (i = 0; i < NFILES; i += 2) {
+		snprintf(filename, sizeof(filename), "f%zu", i);
+		fs_delete_h(fs, filename);
+	}
+	start = now_ns();
+	n = fill(fs, "refill", data);
+	report(name, "refill", n, now_ns() - start);
+
+	if (fs_umount_h(fs))
+		die("Cannot unmount %s", diskname);
+}
+
+int main(int argc, char **argv)
+{
+	size_t total = MAX_BLOCKS;
+
+	if (argc < 2)
+		die("Usage: %s <diskname> [<block count>]", argv[0]);
+
+	if (argc > 2)
+		total = strtoul(argv[2], NULL, 0);
+	if (total < 4 || total > MAX_BLOCKS)
+		die("invalid block count '%s'", argv[2]);
+
+	bench_allocator(argv[1], "linear", FS_ALLOC_LINEAR, total);
+	bench_allocator(argv[1], "bitmap", FS_ALLOC_BITMAP, total);
+
+	unlink(argv[1]);
+
+	return 0;
+}
@@ -0,0 +1,135 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <fs.h>
+
+#define ARRAY_SIZE(x) (sizeof(x) / sizeof((x)[0]))
+
+#define bench_error(fmt, ...) \
+	fprintf(stderr, "%s: "fmt"\n", __func__, ##__VA_ARGS__)
+
+#define die(...)				\
+do {							\
+	bench_error(__VA_ARGS__);	\
+	exit(1);					\
+} while (0)
+
+#define die_perror(msg)			\
+do {							\
+	perror(msg);				\
+	exit(1);					\
+} while (0)
+
+/* Default size of the file written and read back, in MiB */
+#define FILE_MB 256
+
+/* Bytes passed to every fs_write() and fs_read() call, a run of blocks of
+ * every size */
+#define CHUNK (8 << 20)
+
+static const size_t block_sizes[] = {
+	4096,
+	16 * 1024,
+	64 * 1024,
+	256 * 1024,
+	1024 * 1024,
+};
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/*
+ * Create an empty file system of blocks of @block_size bytes, with room for a
+ * file of @size bytes. Return the number of FAT blocks.
+ */
+static size_t make_disk(const char *diskname, size_t block_size, size_t size)
+{
+	struct fs_format_options opts = {
+		.wide = 1,
+		.block_size = block_size,
+	};
+	size_t data = size / block_size + 1;
+
+	if (fs_format(diskname, data, &opts))
+		die("Cannot create %s", diskname);
+
+	return (data * sizeof(uint32_t) + block_size - 1) / block_size;
+}
+
+static void report(size_t block_size, const char *op, size_t size, double ns)
+{
+	printf("%7zu B %-6s %10.1f MiB/s\n", block_size, op,
+	       size / (double)(1 << 20) / (ns / 1e9));
+}
+
+/* Write a file of @size bytes sequentially, then read it back once remounted */
+static void bench_block_size(const char *diskname, size_t block_size,
+			     size_t size)
+{
+	size_t fat_blocks = make_disk(diskname, block_size, size), done;
+	char *buf;
+	double start;
+	fs_t *fs;
+	int fd;
+
+	buf = malloc(CHUNK);
+	if (!buf)
+		die_perror("malloc");
+	memset(buf, 0x5a, CHUNK);
+
+	if (!(fs = fs_mount_h(diskname, NULL)))
+		die("Cannot mount %s", diskname);
+	if (fs_create_h(fs, "file") || (fd = fs_open_h(fs, "file")) < 0)
+		die("Cannot create file");
+	start = now_ns();
+	for (done = 0; done < size; done += CHUNK)
+		if (fs_write_h(fs, fd, buf, CHUNK) != CHUNK)
+			die("write failed");
+	if (fs_close_h(fs, fd) || fs_umount_h(fs))
+		die("Cannot unmount %s", diskname);
+	report(block_size, "write", size, now_ns() - start);
+
+	if (!(fs = fs_mount_h(diskname, NULL)))
+		die("Cannot mount %s", diskname);
+	if ((fd = fs_open_h(fs, "file")) < 0)
+		die("Cannot open file");
+	start = now_ns();
+	for (done = 0; done < size; done += CHUNK)
+		if (fs_read_h(fs, fd, buf, CHUNK) != CHUNK)
+			die("read failed");
+	report(block_size, "read", size, now_ns() - start);
+	if (fs_close_h(fs, fd) || fs_umount_h(fs))
+		die("Cannot unmount %s", diskname);
+
+	printf("%7zu B %-6s %10zu blocks\n", block_size, "fat", fat_blocks);
+	free(buf);
+}
+
+int main(int argc, char **argv)
+{
+	size_t size = (size_t)FILE_MB << 20, i;
+
+	if (argc < 2)
+		die("Usage: %s <diskname> [<file size in MiB>]", argv[0]);
+
+	if (argc > 2)
+		size = strtoul(argv[2], NULL, 0) << 20;
+	if (!size)
+		die("invalid file size '%s'", argv[2]);
+
+	for (i = 0; i < ARRAY_SIZE(block_sizes); i++)
+		bench_block_size(argv[1], block_sizes[i], size);
+
+	unlink(argv[1]);
+
+	return 0;
+}
@@ -0,0 +1,128 @@
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <disk.h>
+
+#define ARRAY_SIZE(x) (sizeof(x) / sizeof((x)[0]))
+
+#define bench_error(fmt, ...) \
+	fprintf(stderr, "%s: "fmt"\n", __func__, ##__VA_ARGS__)
+
+#define die(...)				\
+do {							\
+	bench_error(__VA_ARGS__);	\
+	exit(1);					\
+} while (0)
+
+#define die_perror(msg)			\
+do {							\
+	perror(msg);				\
+	exit(1);					\
+} while (0)
+
+static const struct disk_backend *backends[] = {
+	&disk_file_backend,
+	&disk_mmap_backend,
+	&disk_ram_backend,
+};
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void report(const char *mode, const char *op, size_t nblocks,
+		   double ns)
+{
+	printf("%-5s %-10s %8zu blocks %10.1f ns/block %10.1f MiB/s\n",
+	       mode, op, nblocks, ns / nblocks,
+	       nblocks * (double)BLOCK_SIZE / (1 << 20) / (ns / 1e9));
+}
+
+/* Run every access pattern once against the disk served by @backend */
+static void bench_backend(const char *diskname,
+			  const struct disk_backend *backend, size_t bcount,
+			  size_t nrandom)
+{
+	const char *name = backend->name;
+	char buf[BLOCK_SIZE];
+	size_t i;
+	double start;
+
+	memset(buf, 0xa5, sizeof(buf));
+
+	start = now_ns();
+	if (block_disk_open_backend(diskname, backend))
+		die("Cannot open disk with %s backend", name);
+	printf("%-5s %-10s %28.3f ms\n", name, "open",
+	       (now_ns() - start) / 1e6);
+
+	start = now_ns();
+	for (i = 0; i < bcount; i++)
+		if (block_write(i, buf))
+			die("write failed");
+	report(name, "seq-write", bcount, now_ns() - start);
+
+	start = now_ns();
+	for (i = 0; i < bcount; i++)
+		if (block_read(i, buf))
+			die("read failed");
+	report(name, "seq-read", bcount, now_ns() - start);
+
+	srand(150);
+	start = now_ns();
+	for (i = 0; i < nrandom; i++)
+		if (block_read(rand() % bcount, buf))
+			die("read failed");
+	report(name, "rand-read", nrandom, now_ns() - start);
+
+	start = now_ns();
+	for (i = 0; i < nrandom; i++)
+		if (block_write(rand() % bcount, buf))
+			die("write failed");
+	report(name, "rand-write", nrandom, now_ns() - start);
+
+	/* Closing includes saving the image back to the file */
+	start = now_ns();
+	if (block_disk_close())
+		die("Cannot close disk");
+	printf("%-5s %-10s %28.3f ms\n", name, "close",
+	       (now_ns() - start) / 1e6);
+}
+
+int main(int argc, char **argv)
+{
+	char *diskname;
+	size_t bcount, i;
+	int fd;
+
+	if (argc < 3)
+		die("Usage: %s <diskname> <block count>", argv[0]);
+
+	diskname = argv[1];
+	bcount = strtoul(argv[2], NULL, 0);
+	if (!bcount || bcount > INT_MAX)
+		die("invalid block count '%s'", argv[2]);
+
+	fd = open(diskname, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		die_perror("open");
+	if (ftruncate(fd, bcount * BLOCK_SIZE))
+		die_perror("ftruncate");
+	close(fd);
+
+	for (i = 0; i < ARRAY_SIZE(backends); i++)
+		bench_backend(diskname, backends[i], bcount, 4 * bcount);
+
+	unlink(diskname);
+
+	return 0;
+}
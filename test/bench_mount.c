@@ -0,0 +1,76 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <fs.h>
+
+#define ARRAY_SIZE(x) (sizeof(x) / sizeof((x)[0]))
+
+#define bench_error(fmt, ...) \
+	fprintf(stderr, "%s: "fmt"\n", __func__, ##__VA_ARGS__)
+
+#define die(...)				\
+do {							\
+	bench_error(__VA_ARGS__);	\
+	exit(1);					\
+} while (0)
+
+/* Data blocks of the images, up to a FAT of 40 MB */
+static const size_t sizes[] = {
+	10000,
+	100000,
+	1000000,
+	10000000,
+};
+
+/* Mounts timed per image and mode */
+#define NMOUNTS 5
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Time mounting, with the FAT read at once or as it is used */
+static void bench_mount(const char *diskname, size_t nblocks, int lazy)
+{
+	struct fs_options opts = { .lazy_fat = lazy };
+	double mount = 0, start;
+	fs_t *fs;
+	int i;
+
+	for (i = 0; i < NMOUNTS; i++) {
+		start = now_ns();
+		if (!(fs = fs_mount_h(diskname, &opts)))
+			die("Cannot mount %s", diskname);
+		mount += now_ns() - start;
+		if (fs_umount_h(fs))
+			die("Cannot unmount %s", diskname);
+	}
+
+	printf("%9zu blocks %-6s %10.3f ms/mount\n", nblocks,
+	       lazy ? "lazy" : "eager", mount / NMOUNTS / 1e6);
+}
+
+int main(int argc, char **argv)
+{
+	size_t i;
+
+	if (argc < 2)
+		die("Usage: %s <diskname>", argv[0]);
+
+	for (i = 0; i < ARRAY_SIZE(sizes); i++) {
+		if (fs_format(argv[1], sizes[i], NULL))
+			die("Cannot create %s", argv[1]);
+		bench_mount(argv[1], sizes[i], 0);
+		bench_mount(argv[1], sizes[i], 1);
+	}
+
+	unlink(argv[1]);
+
+	return 0;
+}
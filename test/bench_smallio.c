@@ -0,0 +1,178 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include <fs.h>
+
+#define ARRAY_SIZE(x) (sizeof(x) / sizeof((x)[0]))
+
+#define bench_error(fmt, ...) \
+	fprintf(stderr, "%s: "fmt"\n", __func__, ##__VA_ARGS__)
+
+#define die(...)				\
+do {							\
+	bench_error(__VA_ARGS__);	\
+	exit(1);					\
+} while (0)
+
+/* Size of the file the operations work on, in blocks */
+#define FILE_BLOCKS 256
+
+/* Operations timed per size and kind */
+#define NOPS 100000
+
+static const size_t sizes[] = { 16, 256, 1024, 4096 };
+
+/*
+ * Count the heap allocations of the library by standing in front of the glibc
+ * allocator, which the static libfs.a calls through these symbols.
+ */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+
+static size_t nallocs;
+
+void *malloc(size_t size)
+{
+	nallocs++;
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	nallocs++;
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	nallocs++;
+	return __libc_realloc(ptr, size);
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+	nallocs++;
+	*memptr = __libc_memalign(alignment, size);
+	return *memptr ? 0 : -1;
+}
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+enum op { OP_MEMCPY, OP_READ, OP_WRITE, OP_PREAD, OP_WRITEV };
+
+static const char *op_names[] = { "memcpy", "read", "write", "pread", "writev" };
+
+/* Copy of the file, what reads would cost if they were a plain memcpy() */
+static char file_copy[FILE_BLOCKS * 4096];
+
+/* Run one operation of @size bytes, going back to the start at the end */
+static void run_op(fs_t *fs, int fd, enum op op, char *buf, size_t size,
+		   size_t *offset)
+{
+	struct iovec iov[] = {
+		{ .iov_base = buf, .iov_len = size / 2 },
+		{ .iov_base = buf + size / 2, .iov_len = size - size / 2 },
+	};
+	int ret;
+
+	if (*offset + size > FILE_BLOCKS * 4096) {
+		*offset = 0;
+		if (fs_lseek_h(fs, fd, 0))
+			die("lseek failed");
+	}
+
+	switch (op) {
+	case OP_MEMCPY:
+		memcpy(buf, file_copy + *offset, size);
+		/* Keep the copy although nothing reads it */
+		__asm__ volatile("" : : "r"(buf) : "memory");
+		ret = size;
+		break;
+	case OP_READ:
+		ret = fs_read_h(fs, fd, buf, size);
+		break;
+	case OP_WRITE:
+		ret = fs_write_h(fs, fd, buf, size);
+		break;
+	case OP_PREAD:
+		ret = fs_pread_h(fs, fd, buf, size, *offset);
+		break;
+	default:
+		ret = fs_writev_h(fs, fd, iov, ARRAY_SIZE(iov));
+		break;
+	}
+	if (ret != (int)size)
+		die("%s failed", op_names[op]);
+	*offset += size;
+}
+
+/* Time NOPS operations once the descriptor is warm, and count allocations */
+static void bench_op(fs_t *fs, int fd, enum op op, size_t size)
+{
+	char buf[4096];
+	size_t offset = 0, allocs;
+	double start, ns;
+	int i;
+
+	memset(buf, 0x5a, sizeof(buf));
+	if (fs_lseek_h(fs, fd, 0))
+		die("lseek failed");
+	run_op(fs, fd, op, buf, size, &offset);
+
+	allocs = nallocs;
+	start = now_ns();
+	for (i = 0; i < NOPS; i++)
+		run_op(fs, fd, op, buf, size, &offset);
+	ns = now_ns() - start;
+	allocs = nallocs - allocs;
+
+	printf("%-6s %5zu B %8.1f ns/op %10zu allocs\n", op_names[op], size,
+	       ns / NOPS, allocs);
+}
+
+int main(int argc, char **argv)
+{
+	char block[4096];
+	size_t i;
+	fs_t *fs;
+	int fd, op;
+
+	if (argc < 2)
+		die("Usage: %s <diskname>", argv[0]);
+
+	if (fs_format(argv[1], FILE_BLOCKS + 1, NULL))
+		die("Cannot create %s", argv[1]);
+	if (!(fs = fs_mount_h(argv[1], NULL)))
+		die("Cannot mount %s", argv[1]);
+	if (fs_create_h(fs, "file") || (fd = fs_open_h(fs, "file")) < 0)
+		die("Cannot create file");
+	memset(block, 0x5a, sizeof(block));
+	for (i = 0; i < FILE_BLOCKS; i++)
+		if (fs_write_h(fs, fd, block, sizeof(block)) != sizeof(block))
+			die("write failed");
+	/* The offset-to-block index of the file is filled once, on first use */
+	if (fs_pread_h(fs, fd, block, 1, FILE_BLOCKS * 4096 - 1) != 1)
+		die("pread failed");
+
+	for (op = OP_MEMCPY; op <= OP_WRITEV; op++)
+		for (i = 0; i < ARRAY_SIZE(sizes); i++)
+			bench_op(fs, fd, op, sizes[i]);
+
+	if (fs_close_h(fs, fd) || fs_umount_h(fs))
+		die("Cannot unmount %s", argv[1]);
+	unlink(argv[1]);
+
+	return 0;
+}
@@ -0,0 +1,148 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <fs.h>
+
+#define ARRAY_SIZE(x) (sizeof(x) / sizeof((x)[0]))
+
+#define bench_error(fmt, ...) \
+	fprintf(stderr, "%s: "fmt"\n", __func__, ##__VA_ARGS__)
+
+#define die(...)				\
+do {							\
+	bench_error(__VA_ARGS__);	\
+	exit(1);					\
+} while (0)
+
+#define die_perror(msg)			\
+do {							\
+	perror(msg);				\
+	exit(1);					\
+} while (0)
+
+/* Files written once, then read by the threads */
+#define NFILES 8
+
+/* Size of every file, in MiB */
+#define FILE_MB 32
+
+/* Bytes passed to every fs_read() call */
+#define CHUNK (1 << 20)
+
+/* Times every thread reads its file */
+#define NROUNDS 4
+
+static const int nthreads[] = { 1, 2, 4, 8 };
+
+struct reader {
+	pthread_t thread;
+	fs_t *fs;
+	char filename[FS_FILENAME_LEN];
+};
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Read a whole file NROUNDS times through a descriptor of its own */
+static void *read_file(void *arg)
+{
+	struct reader *r = arg;
+	size_t done;
+	char *buf;
+	int round, fd;
+
+	buf = malloc(CHUNK);
+	if (!buf)
+		die_perror("malloc");
+
+	for (round = 0; round < NROUNDS; round++) {
+		if ((fd = fs_open_h(r->fs, r->filename)) < 0)
+			die("Cannot open %s", r->filename);
+		for (done = 0; done < (size_t)FILE_MB << 20; done += CHUNK)
+			if (fs_read_h(r->fs, fd, buf, CHUNK) != CHUNK)
+				die("read failed");
+		fs_close_h(r->fs, fd);
+	}
+
+	free(buf);
+	return NULL;
+}
+
+/* Read with @n threads, each its own file or all of them the same one */
+static void bench_threads(fs_t *fs, int n, int shared)
+{
+	struct reader readers[NFILES];
+	double start, ns;
+	int i;
+
+	start = now_ns();
+	for (i = 0; i < n; i++) {
+		readers[i].fs = fs;
+		snprintf(readers[i].filename, FS_FILENAME_LEN, "file%d",
+			 shared ? 0 : i);
+		if (pthread_create(&readers[i].thread, NULL, read_file,
+				   &readers[i]))
+			die("Cannot create thread");
+	}
+	for (i = 0; i < n; i++)
+		pthread_join(readers[i].thread, NULL);
+	ns = now_ns() - start;
+
+	printf("%d threads %-9s %10.1f MiB/s\n", n,
+	       shared ? "same" : "different",
+	       (double)n * NROUNDS * FILE_MB / (ns / 1e9));
+}
+
+int main(int argc, char **argv)
+{
+	char filename[FS_FILENAME_LEN];
+	size_t done;
+	char *buf;
+	fs_t *fs;
+	int fd, i;
+
+	if (argc < 2)
+		die("Usage: %s <diskname>", argv[0]);
+
+	if (fs_format(argv[1], ((size_t)NFILES * FILE_MB << 20) / 4096 + 1,
+		      NULL))
+		die("Cannot create %s", argv[1]);
+	if (!(fs = fs_mount_h(argv[1], NULL)))
+		die("Cannot mount %s", argv[1]);
+
+	buf = malloc(CHUNK);
+	if (!buf)
+		die_perror("malloc");
+	memset(buf, 0x5a, CHUNK);
+	for (i = 0; i < NFILES; i++) {
+		snprintf(filename, sizeof(filename), "file%d", i);
+		if (fs_create_h(fs, filename) ||
+		    (fd = fs_open_h(fs, filename)) < 0)
+			die("Cannot create %s", filename);
+		for (done = 0; done < (size_t)FILE_MB << 20; done += CHUNK)
+			if (fs_write_h(fs, fd, buf, CHUNK) != CHUNK)
+				die("write failed");
+		fs_close_h(fs, fd);
+	}
+	free(buf);
+
+	for (i = 0; i < (int)ARRAY_SIZE(nthreads); i++) {
+		bench_threads(fs, nthreads[i], 0);
+		bench_threads(fs, nthreads[i], 1);
+	}
+
+	if (fs_umount_h(fs))
+		die("Cannot unmount %s", argv[1]);
+	unlink(argv[1]);
+
+	return 0;
+}
@@ -0,0 +1,75 @@
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <fs.h>
+
+#define fs_mkfs_error(fmt, ...) \
+	fprintf(stderr, "%s: "fmt"\n", __func__, ##__VA_ARGS__)
+
+#define die(...)				\
+do {							\
+	fs_mkfs_error(__VA_ARGS__);	\
+	exit(1);					\
+} while (0)
+
+size_t get_argv(const char *arg)
+{
+	char *end;
+	unsigned long ret = strtoul(arg, &end, 0);
+
+	if (*arg == '\0' || *end != '\0' || ret == ULONG_MAX)
+		die("invalid number '%s'", arg);
+	return (size_t)ret;
+}
+
+void usage(char *program)
+{
+	fprintf(stderr, "Usage: %s [options] <diskname> <data block count>\n",
+		program);
+	fprintf(stderr, "Possible options are:\n");
+	fprintf(stderr, "\t-w\t\twide file system\n");
+	fprintf(stderr, "\t-b <bytes>\tblock size\n");
+	fprintf(stderr, "\t-j <blocks>\tjournal size\n");
+	fprintf(stderr, "\t-d\t\textended root directory\n");
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	struct fs_format_options opts = { 0 };
+	size_t nblocks;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "wb:j:d")) != -1) {
+		switch (opt) {
+		case 'w':
+			opts.wide = 1;
+			break;
+		case 'b':
+			opts.block_size = get_argv(optarg);
+			break;
+		case 'j':
+			opts.journal_blocks = get_argv(optarg);
+			break;
+		case 'd':
+			opts.large_dir = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (argc - optind != 2)
+		usage(argv[0]);
+
+	nblocks = get_argv(argv[optind + 1]);
+	if (fs_format(argv[optind], nblocks, &opts))
+		die("Cannot create virtual disk '%s'", argv[optind]);
+
+	printf("Created virtual disk '%s' with '%zu' data blocks\n",
+	       argv[optind], nblocks);
+
+	return 0;
+}
@@ -0,0 +1,162 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fs.h>
+
+#define test_fs_error(fmt, ...) \
+	fprintf(stderr, "%s: "fmt"\n", __func__, ##__VA_ARGS__)
+
+#define die(...)				\
+do {							\
+	test_fs_error(__VA_ARGS__);	\
+	exit(1);					\
+} while (0)
+
+#define BLOCK_SIZE 4096
+#define DATA_BLOCKS 100
+#define FILE_SIZE (10 * BLOCK_SIZE + 333)
+//blocks reserved past the end of the file
+#define RESERVED 20
+//read sizes, within a block, across one and across several
+static const size_t sizes[] = { 1, 17, BLOCK_SIZE - 1, BLOCK_SIZE, BLOCK_SIZE + 1, 3 * BLOCK_SIZE + 5 };
+#define READS 300
+
+//every byte value, 0xFF and 0 included, in no block-aligned order
+void fill(unsigned char* buf, size_t len){
+    for (size_t i = 0; i < len; i++)
+        buf[i] = (i * 7 + i / 256) % 256;
+}
+
+//a descriptor that read up to the end of the last block sees what is appended after it,
+//through another descriptor or at an offset
+void check_append(fs_t* fs){
+    char block[BLOCK_SIZE], buf[BLOCK_SIZE];
+    int writer, reader, ret;
+
+    ret = fs_create_h(fs, "appended");
+    assert(ret == 0);
+    writer = fs_open_h(fs, "appended");
+    reader = fs_open_h(fs, "appended");
+    assert(writer >= 0 && reader >= 0);
+
+    memset(block, 'A', BLOCK_SIZE);
+    ret = fs_write_h(fs, writer, block, BLOCK_SIZE);
+    assert(ret == BLOCK_SIZE);
+    ret = fs_read_h(fs, reader, buf, BLOCK_SIZE);
+    assert(ret == BLOCK_SIZE);
+
+    memset(block, 'B', 100);
+    ret = fs_write_h(fs, writer, block, 100);
+    assert(ret == 100);
+    ret = fs_read_h(fs, reader, buf, BLOCK_SIZE);
+    assert(ret == 100);
+    assert(memcmp(buf, block, 100) == 0);
+
+    //the block is filled, and the next one only added by a positional write
+    memset(block, 'C', BLOCK_SIZE);
+    ret = fs_pwrite_h(fs, writer, block, BLOCK_SIZE - 100, BLOCK_SIZE + 100);
+    assert(ret == BLOCK_SIZE - 100);
+    ret = fs_read_h(fs, reader, buf, BLOCK_SIZE);
+    assert(ret == BLOCK_SIZE - 100);
+    memset(block, 'D', 10);
+    ret = fs_pwrite_h(fs, writer, block, 10, 2 * BLOCK_SIZE);
+    assert(ret == 10);
+    ret = fs_read_h(fs, reader, buf, BLOCK_SIZE);
+    assert(ret == 10);
+    assert(memcmp(buf, block, 10) == 0);
+    ret = fs_pread_h(fs, reader, buf, BLOCK_SIZE, 2 * BLOCK_SIZE);
+    assert(ret == 10);
+    assert(memcmp(buf, block, 10) == 0);
+
+    ret = fs_close_h(fs, writer);
+    assert(ret == 0);
+    ret = fs_close_h(fs, reader);
+    assert(ret == 0);
+}
+
+int main(int argc, char **argv)
+{
+    static unsigned char data[FILE_SIZE], buf[FILE_SIZE + BLOCK_SIZE];
+    unsigned int seed = 1;
+    fs_t* fs;
+    int fs_fd, ret;
+
+    if (argc < 2)
+        die("Usage: %s <diskname>", argv[0]);
+    if (fs_format(argv[1], DATA_BLOCKS, NULL))
+        die("Cannot create %s", argv[1]);
+    fs = fs_mount_h(argv[1], NULL);
+    if (fs == NULL)
+        die("Cannot mount %s", argv[1]);
+
+    fill(data, FILE_SIZE);
+    memset(data + 100, 0xFF, 2 * BLOCK_SIZE); //a run of 0xFF across blocks
+    ret = fs_create_h(fs, "binary");
+    assert(ret == 0);
+    fs_fd = fs_open_h(fs, "binary");
+    assert(fs_fd >= 0);
+    ret = fs_write_h(fs, fs_fd, data, FILE_SIZE);
+    assert(ret == FILE_SIZE);
+    //the blocks past the end of the file are never read
+    ret = fs_fallocate_h(fs, fs_fd, FILE_SIZE + RESERVED * BLOCK_SIZE);
+    assert(ret == 0);
+
+    //the whole file, and nothing past its end
+    ret = fs_lseek_h(fs, fs_fd, 0);
+    assert(ret == 0);
+    ret = fs_read_h(fs, fs_fd, buf, sizeof(buf));
+    assert(ret == FILE_SIZE);
+    assert(memcmp(buf, data, FILE_SIZE) == 0);
+    ret = fs_read_h(fs, fs_fd, buf, sizeof(buf));
+    assert(ret == 0);
+
+    //reads of every size at any offset stop at the end of the file
+    for (int i = 0; i < READS; i++){
+        size_t offset = rand_r(&seed) % FILE_SIZE;
+        size_t count = sizes[i % (sizeof(sizes) / sizeof(sizes[0]))];
+        size_t want = FILE_SIZE - offset < count ? FILE_SIZE - offset : count;
+
+        ret = fs_lseek_h(fs, fs_fd, offset);
+        assert(ret == 0);
+        ret = fs_read_h(fs, fs_fd, buf, count);
+        assert(ret == (int) want);
+        assert(memcmp(buf, data + offset, want) == 0);
+        ret = fs_pread_h(fs, fs_fd, buf, count, offset);
+        assert(ret == (int) want);
+        assert(memcmp(buf, data + offset, want) == 0);
+    }
+    ret = fs_close_h(fs, fs_fd);
+    assert(ret == 0);
+    if (fs_umount_h(fs))
+        die("Cannot unmount");
+
+    //an empty file has nothing to read
+    fs = fs_mount_h(argv[1], NULL);
+    assert(fs != NULL);
+    ret = fs_create_h(fs, "empty");
+    assert(ret == 0);
+    fs_fd = fs_open_h(fs, "empty");
+    assert(fs_fd >= 0);
+    ret = fs_read_h(fs, fs_fd, buf, 10);
+    assert(ret == 0);
+    ret = fs_close_h(fs, fs_fd);
+    assert(ret == 0);
+
+    check_append(fs);
+
+    //the data reached the disk
+    fs_fd = fs_open_h(fs, "binary");
+    assert(fs_fd >= 0);
+    ret = fs_read_h(fs, fs_fd, buf, sizeof(buf));
+    assert(ret == FILE_SIZE);
+    assert(memcmp(buf, data, FILE_SIZE) == 0);
+    ret = fs_close_h(fs, fs_fd);
+    assert(ret == 0);
+    if (fs_umount_h(fs))
+        die("Cannot unmount");
+
+    printf("test_binary: OK\n");
+    return 0;
+}
@@ -0,0 +1,160 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fs.h>
+
+#define test_fs_error(fmt, ...) \
+	fprintf(stderr, "%s: "fmt"\n", __func__, ##__VA_ARGS__)
+
+#define die(...)				\
+do {							\
+	test_fs_error(__VA_ARGS__);	\
+	exit(1);					\
+} while (0)
+
+//nested deep enough that every level has to be resolved
+#define DEPTH 6
+
+//every file holds its own path
+void write_file(fs_t* fs, const char* path){
+    int fs_fd, ret;
+
+    ret = fs_create_h(fs, path);
+    assert(ret == 0);
+    fs_fd = fs_open_h(fs, path);
+    assert(fs_fd >= 0);
+    ret = fs_write_h(fs, fs_fd, (void*) path, strlen(path));
+    assert(ret == (int) strlen(path));
+    ret = fs_close_h(fs, fs_fd);
+    assert(ret == 0);
+}
+
+//the path may have a leading '/' the file was written without
+void check_file(fs_t* fs, const char* path){
+    const char* content = path[0] == '/' ? path + 1 : path;
+    char buf[256];
+    int fs_fd, ret;
+
+    fs_fd = fs_open_h(fs, path);
+    assert(fs_fd >= 0);
+    ret = fs_stat_h(fs, fs_fd);
+    assert(ret == (int) strlen(content));
+    ret = fs_read_h(fs, fs_fd, buf, strlen(content));
+    assert(ret == (int) strlen(content));
+    assert(memcmp(buf, content, strlen(content)) == 0);
+    ret = fs_close_h(fs, fs_fd);
+    assert(ret == 0);
+}
+
+fs_t* mount(char* diskname){
+    fs_t* fs = fs_mount_h(diskname, NULL);
+    if (fs == NULL)
+        die("Cannot mount %s", diskname);
+    return fs;
+}
+
+void umount(fs_t* fs){
+    if (fs_umount_h(fs))
+        die("Cannot unmount");
+}
+
+int main(int argc, char **argv)
+{
+    char path[256] = "";
+    char file[sizeof(path) + 8]; //room for a leading '/' and "/same" around the path
+    int fs_fd, ret;
+    fs_t* fs;
+
+    if (argc < 2)
+        die("Usage: %s <diskname>", argv[0]);
+
+    fs = mount(argv[1]);
+    //without directories a name with '/' is a name of the root directory, as before them
+    write_file(fs, "flat/name");
+    check_file(fs, "flat/name");
+    ret = fs_create_h(fs, "/abs");
+    assert(ret == 0);
+    fs_fd = fs_open_h(fs, "abs");
+    assert(fs_fd == -1);
+    ret = fs_delete_h(fs, "/abs");
+    assert(ret == 0);
+    //the same name in every directory, one more level each time
+    write_file(fs, "same");
+    for (int i = 0; i < DEPTH; i++){
+        snprintf(path + strlen(path), sizeof(path) - strlen(path), "%sd%d", i ? "/" : "", i);
+        ret = fs_mkdir_h(fs, path);
+        assert(ret == 0);
+        snprintf(file, sizeof(file), "%s/same", path);
+        write_file(fs, file);
+    }
+    ret = fs_mkdir_h(fs, "d0");
+    assert(ret == -1);
+    ret = fs_create_h(fs, "d0");
+    assert(ret == -1);
+    ret = fs_create_h(fs, "missing/file");
+    assert(ret == -1);
+    ret = fs_create_h(fs, "same/file");
+    assert(ret == -1);
+    ret = fs_create_h(fs, "d0//file");
+    assert(ret == -1);
+    ret = fs_create_h(fs, "d0/");
+    assert(ret == -1);
+    ret = fs_create_h(fs, "d0/sixteen_chars_ab");
+    assert(ret == -1);
+    ret = fs_open_h(fs, "d0");
+    assert(ret == -1);
+    ret = fs_delete_h(fs, "d0");
+    assert(ret == -1);
+    ret = fs_rmdir_h(fs, "same");
+    assert(ret == -1);
+    ret = fs_rmdir_h(fs, "d0");
+    assert(ret == -1);
+    umount(fs);
+
+    //everything is found again from the disk, leading '/' or not
+    fs = mount(argv[1]);
+    check_file(fs, "/same");
+    strcpy(path, "");
+    for (int i = 0; i < DEPTH; i++){
+        snprintf(path + strlen(path), sizeof(path) - strlen(path), "%sd%d", i ? "/" : "", i);
+        snprintf(file, sizeof(file), "/%s/same", path);
+        check_file(fs, file);
+    }
+
+    //directories are removed from the deepest one up, once emptied
+    for (int i = DEPTH - 1; i >= 0; i--){
+        snprintf(file, sizeof(file), "%s/same", path);
+        ret = fs_rmdir_h(fs, path);
+        assert(ret == -1);
+        ret = fs_delete_h(fs, file);
+        assert(ret == 0);
+        ret = fs_open_h(fs, file);
+        assert(ret == -1);
+        ret = fs_rmdir_h(fs, path);
+        assert(ret == 0);
+        if (i > 0)
+            *strrchr(path, '/') = '\0';
+    }
+    check_file(fs, "same");
+    ret = fs_open_h(fs, "d0/same");
+    assert(ret == -1);
+    umount(fs);
+
+    //and it stays reachable by its whole name with directories around
+    fs = mount(argv[1]);
+    ret = fs_mkdir_h(fs, "flat");
+    assert(ret == 0);
+    check_file(fs, "flat/name");
+    ret = fs_delete_h(fs, "flat/name");
+    assert(ret == 0);
+    fs_fd = fs_open_h(fs, "flat/name");
+    assert(fs_fd == -1);
+    ret = fs_rmdir_h(fs, "flat");
+    assert(ret == 0);
+    umount(fs);
+
+    printf("test_dirs: OK\n");
+    return 0;
+}
@@ -0,0 +1,112 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <disk.h>
+#include <fs.h>
+
+#define test_fs_error(fmt, ...) \
+	fprintf(stderr, "%s: "fmt"\n", __func__, ##__VA_ARGS__)
+
+#define die(...)				\
+do {							\
+	test_fs_error(__VA_ARGS__);	\
+	exit(1);					\
+} while (0)
+
+#define DATA_BLOCKS 100
+//less than a block, so that it stays in the cache until written back
+#define DATA_LEN 1000
+
+//the image file backend, whose writes fail on demand
+static bool fail_writes;
+
+void* flaky_open(const char* diskname){
+    return disk_file_backend.open(diskname);
+}
+
+int flaky_close(void* ctx){
+    return disk_file_backend.close(ctx);
+}
+
+size_t flaky_count(void* ctx){
+    return disk_file_backend.count(ctx);
+}
+
+int flaky_read(void* ctx, size_t block, const struct iovec* iov, int iovcnt){
+    return disk_file_backend.read(ctx, block, iov, iovcnt);
+}
+
+int flaky_write(void* ctx, size_t block, const struct iovec* iov, int iovcnt){
+    if (fail_writes)
+        return -1;
+    return disk_file_backend.write(ctx, block, iov, iovcnt);
+}
+
+int flaky_flush(void* ctx){
+    return disk_file_backend.flush(ctx);
+}
+
+static const struct disk_backend flaky_backend = {
+    .name = "flaky",
+    .open = flaky_open,
+    .close = flaky_close,
+    .count = flaky_count,
+    .read = flaky_read,
+    .write = flaky_write,
+    .flush = flaky_flush,
+};
+
+int main(int argc, char **argv)
+{
+    struct fs_options opts = { .backend = &flaky_backend };
+    char data[DATA_LEN], buf[DATA_LEN];
+    int fs_fd, ret;
+    fs_t* fs;
+
+    if (argc < 2)
+        die("Usage: %s <diskname>", argv[0]);
+    if (fs_format(argv[1], DATA_BLOCKS, NULL))
+        die("Cannot create %s", argv[1]);
+
+    fs = fs_mount_h(argv[1], &opts);
+    if (fs == NULL)
+        die("Cannot mount %s", argv[1]);
+    memset(data, 'x', DATA_LEN);
+    ret = fs_create_h(fs, "file");
+    assert(ret == 0);
+    fs_fd = fs_open_h(fs, "file");
+    assert(fs_fd >= 0);
+    ret = fs_write_h(fs, fs_fd, data, DATA_LEN);
+    assert(ret == DATA_LEN);
+    ret = fs_close_h(fs, fs_fd);
+    assert(ret == 0);
+
+    //a failed write back leaves the block dirty, and the next sync writes it
+    fail_writes = true;
+    ret = fs_sync_h(fs);
+    assert(ret == -1);
+    fail_writes = false;
+    ret = fs_sync_h(fs);
+    assert(ret == 0);
+    ret = fs_umount_h(fs);
+    assert(ret == 0);
+
+    fs = fs_mount_h(argv[1], NULL);
+    if (fs == NULL)
+        die("Cannot mount %s", argv[1]);
+    fs_fd = fs_open_h(fs, "file");
+    assert(fs_fd >= 0);
+    ret = fs_read_h(fs, fs_fd, buf, DATA_LEN);
+    assert(ret == DATA_LEN);
+    assert(memcmp(buf, data, DATA_LEN) == 0);
+    ret = fs_close_h(fs, fs_fd);
+    assert(ret == 0);
+    ret = fs_umount_h(fs);
+    assert(ret == 0);
+
+    printf("test_flush: OK\n");
+    return 0;
+}
@@ -0,0 +1,132 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <fs.h>
+
+#define test_fs_error(fmt, ...) \
+	fprintf(stderr, "%s: "fmt"\n", __func__, ##__VA_ARGS__)
+
+#define die(...)				\
+do {							\
+	test_fs_error(__VA_ARGS__);	\
+	exit(1);					\
+} while (0)
+
+#define BLOCK_SIZE 4096
+//data blocks of the small images
+#define DATA_BLOCKS 100
+//a multi-GiB image, that should take no space
+#define HUGE_BLOCKS 1000000
+//more files than a root block of the large blocks holds
+#define FILE_COUNT 600
+
+fs_t* mount(char* diskname, const struct fs_options* opts){
+    fs_t* fs = fs_mount_h(diskname, opts);
+    if (fs == NULL)
+        die("Cannot mount %s", diskname);
+    return fs;
+}
+
+void umount(fs_t* fs){
+    if (fs_umount_h(fs))
+        die("Cannot unmount");
+}
+
+//the signature of the image on disk
+void check_signature(const char* diskname, const char* signature){
+    char buf[8];
+    FILE* f = fopen(diskname, "r");
+    size_t n;
+
+    assert(f != NULL);
+    n = fread(buf, 1, sizeof(buf), f);
+    assert(n == sizeof(buf));
+    assert(memcmp(buf, signature, sizeof(buf)) == 0);
+    fclose(f);
+}
+
+//every data block can be allocated, and no more
+void check_capacity(char* diskname, size_t block_size){
+    fs_t* fs = mount(diskname, NULL);
+    int fs_fd, ret;
+
+    ret = fs_create_h(fs, "all");
+    assert(ret == 0);
+    fs_fd = fs_open_h(fs, "all");
+    assert(fs_fd >= 0);
+    ret = fs_fallocate_h(fs, fs_fd, (DATA_BLOCKS - 1) * block_size);
+    assert(ret == 0);
+    ret = fs_fallocate_h(fs, fs_fd, DATA_BLOCKS * block_size);
+    assert(ret == -1);
+    ret = fs_close_h(fs, fs_fd);
+    assert(ret == 0);
+    umount(fs);
+}
+
+int main(int argc, char **argv)
+{
+    struct fs_format_options wide = { .wide = 1 };
+    struct fs_format_options large = { .block_size = 16 * 1024, .journal_blocks = 64, .large_dir = 1 };
+    struct fs_format_options invalid = { .block_size = 5000 };
+    char filename[FS_FILENAME_LEN];
+    struct stat st;
+    fs_t* fs;
+    int ret;
+
+    if (argc < 2)
+        die("Usage: %s <diskname>", argv[0]);
+
+    //the original format, whose first data block is never allocated
+    ret = fs_format(argv[1], DATA_BLOCKS, NULL);
+    assert(ret == 0);
+    check_signature(argv[1], "ECS150FS");
+    check_capacity(argv[1], BLOCK_SIZE);
+
+    //formatting again empties the image
+    ret = fs_format(argv[1], DATA_BLOCKS, &wide);
+    assert(ret == 0);
+    check_signature(argv[1], "ECS150FW");
+    check_capacity(argv[1], BLOCK_SIZE);
+
+    ret = fs_format(argv[1], 0, NULL);
+    assert(ret == -1);
+    ret = fs_format(argv[1], DATA_BLOCKS, &invalid);
+    assert(ret == -1);
+
+    //too many blocks for the original format, only the written blocks take space
+    ret = fs_format(argv[1], HUGE_BLOCKS, NULL);
+    assert(ret == 0);
+    check_signature(argv[1], "ECS150FW");
+    ret = stat(argv[1], &st);
+    assert(ret == 0);
+    assert(st.st_size > (off_t) HUGE_BLOCKS * BLOCK_SIZE);
+    assert(st.st_blocks * 512 < 1024 * 1024);
+    fs = mount(argv[1], NULL);
+    umount(fs);
+
+    //larger blocks, with a journal and an extended directory from the start
+    ret = fs_format(argv[1], DATA_BLOCKS, &large);
+    assert(ret == 0);
+    fs = mount(argv[1], NULL);
+    for (int i = 0; i < FILE_COUNT; i++){
+        snprintf(filename, sizeof(filename), "file%d", i);
+        ret = fs_create_h(fs, filename);
+        assert(ret == 0);
+    }
+    umount(fs);
+    fs = mount(argv[1], NULL);
+    for (int i = 0; i < FILE_COUNT; i++){
+        snprintf(filename, sizeof(filename), "file%d", i);
+        int fs_fd = fs_open_h(fs, filename);
+        assert(fs_fd >= 0);
+        ret = fs_close_h(fs, fs_fd);
+        assert(ret == 0);
+    }
+    umount(fs);
+
+    printf("test_format: OK\n");
+    return 0;
+}
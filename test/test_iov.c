@@ -0,0 +1,140 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#include <fs.h>
+
+#define test_fs_error(fmt, ...) \
+	fprintf(stderr, "%s: "fmt"\n", __func__, ##__VA_ARGS__)
+
+#define die(...)				\
+do {							\
+	test_fs_error(__VA_ARGS__);	\
+	exit(1);					\
+} while (0)
+
+#define BLOCK_SIZE 4096
+#define DATA_BLOCKS 1024
+//records of a header, a payload and a trailer
+#define RECORDS 200
+#define HEADER 16
+#define PAYLOAD 1000
+#define TRAILER 8
+#define RECORD (HEADER + PAYLOAD + TRAILER)
+//buffers of a large transfer, some split blocks, some hold whole blocks, one is empty
+static const size_t lengths[] = { 100, 0, 3 * BLOCK_SIZE, BLOCK_SIZE + 1, 2 * BLOCK_SIZE - 2, 7, 5 * BLOCK_SIZE + 33 };
+#define BUFS (sizeof(lengths) / sizeof(lengths[0]))
+
+void fill(char* buf, size_t len, size_t offset){
+    for (size_t i = 0; i < len; i++)
+        buf[i] = 'a' + (offset + i) % 19;
+}
+
+size_t lookups(fs_t* fs){
+    struct fs_cache_stats stats;
+    int ret;
+
+    ret = fs_cache_stats_h(fs, &stats);
+    assert(ret == 0);
+    return stats.hits + stats.misses;
+}
+
+int main(int argc, char **argv)
+{
+    static char data[RECORDS * RECORD], buf[RECORDS * RECORD];
+    struct iovec iov[BUFS];
+    size_t total = 0, before;
+    fs_t* fs;
+    int fs_fd, ret;
+
+    if (argc < 2)
+        die("Usage: %s <diskname>", argv[0]);
+    if (fs_format(argv[1], DATA_BLOCKS, NULL))
+        die("Cannot create %s", argv[1]);
+    fs = fs_mount_h(argv[1], NULL);
+    if (fs == NULL)
+        die("Cannot mount %s", argv[1]);
+
+    //records written in one call each, the block they share is looked up once per call
+    fill(data, sizeof(data), 0);
+    ret = fs_create_h(fs, "records");
+    assert(ret == 0);
+    fs_fd = fs_open_h(fs, "records");
+    assert(fs_fd >= 0);
+    for (int i = 0; i < RECORDS; i++){
+        char* record = data + i * RECORD;
+        struct iovec parts[] = {
+            { .iov_base = record, .iov_len = HEADER },
+            { .iov_base = record + HEADER, .iov_len = PAYLOAD },
+            { .iov_base = record + HEADER + PAYLOAD, .iov_len = TRAILER },
+        };
+        size_t offset = (size_t) i * RECORD;
+
+        before = lookups(fs);
+        ret = fs_writev_h(fs, fs_fd, parts, 3);
+        assert(ret == RECORD);
+        if (offset % BLOCK_SIZE != 0 && offset / BLOCK_SIZE == (offset + RECORD - 1) / BLOCK_SIZE)
+            assert(lookups(fs) - before == 1);
+    }
+    ret = fs_stat_h(fs, fs_fd);
+    assert(ret == sizeof(data));
+    ret = fs_lseek_h(fs, fs_fd, 0);
+    assert(ret == 0);
+    ret = fs_read_h(fs, fs_fd, buf, sizeof(buf));
+    assert(ret == sizeof(buf));
+    assert(memcmp(buf, data, sizeof(data)) == 0);
+
+    //read back into buffers that split blocks anywhere
+    for (size_t i = 0; i < BUFS; i++){
+        iov[i].iov_base = buf + total;
+        iov[i].iov_len = lengths[i];
+        total += lengths[i];
+    }
+    memset(buf, 0, sizeof(buf));
+    ret = fs_lseek_h(fs, fs_fd, 10);
+    assert(ret == 0);
+    ret = fs_readv_h(fs, fs_fd, iov, BUFS);
+    assert(ret == (int) total);
+    assert(memcmp(buf, data + 10, total) == 0);
+
+    //and the same buffers written over the middle of the file
+    fill(buf, total, 7);
+    ret = fs_lseek_h(fs, fs_fd, 10);
+    assert(ret == 0);
+    ret = fs_writev_h(fs, fs_fd, iov, BUFS);
+    assert(ret == (int) total);
+    memcpy(data + 10, buf, total);
+    ret = fs_close_h(fs, fs_fd);
+    assert(ret == 0);
+
+    ret = fs_writev_h(fs, fs_fd, iov, BUFS);
+    assert(ret == -1);
+    fs_fd = fs_open_h(fs, "records");
+    assert(fs_fd >= 0);
+    ret = fs_readv_h(fs, fs_fd, iov, -1);
+    assert(ret == -1);
+    ret = fs_readv_h(fs, fs_fd, iov, 0);
+    assert(ret == 0);
+    ret = fs_close_h(fs, fs_fd);
+    assert(ret == 0);
+    if (fs_umount_h(fs))
+        die("Cannot unmount");
+
+    //the data reached the disk
+    fs = fs_mount_h(argv[1], NULL);
+    assert(fs != NULL);
+    fs_fd = fs_open_h(fs, "records");
+    assert(fs_fd >= 0);
+    ret = fs_read_h(fs, fs_fd, buf, sizeof(buf));
+    assert(ret == sizeof(buf));
+    assert(memcmp(buf, data, sizeof(data)) == 0);
+    ret = fs_close_h(fs, fs_fd);
+    assert(ret == 0);
+    if (fs_umount_h(fs))
+        die("Cannot unmount");
+
+    printf("test_iov: OK\n");
+    return 0;
+}
@@ -0,0 +1,151 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <fs.h>
+
+#define test_fs_error(fmt, ...) \
+	fprintf(stderr, "%s: "fmt"\n", __func__, ##__VA_ARGS__)
+
+#define die(...)				\
+do {							\
+	test_fs_error(__VA_ARGS__);	\
+	exit(1);					\
+} while (0)
+
+//a few blocks plus a partial one
+#define FILE_SIZE (2 * 4096 + 321)
+//enough synced files to fill the journal several times
+#define SYNC_ROUNDS 200
+
+void fill(char* buf, int id){
+    for (int i = 0; i < FILE_SIZE; i++)
+        buf[i] = 'a' + (i + id) % 26;
+}
+
+void write_file(fs_t* fs, const char* filename, int id){
+    char buf[FILE_SIZE];
+    int fs_fd, ret;
+
+    fill(buf, id);
+    ret = fs_create_h(fs, filename);
+    assert(ret == 0);
+    fs_fd = fs_open_h(fs, filename);
+    assert(fs_fd >= 0);
+    ret = fs_write_h(fs, fs_fd, buf, FILE_SIZE);
+    assert(ret == FILE_SIZE);
+    ret = fs_close_h(fs, fs_fd);
+    assert(ret == 0);
+}
+
+void check_file(fs_t* fs, const char* filename, int id){
+    char expect[FILE_SIZE], buf[FILE_SIZE];
+    int fs_fd, ret;
+
+    fill(expect, id);
+    fs_fd = fs_open_h(fs, filename);
+    assert(fs_fd >= 0);
+    ret = fs_stat_h(fs, fs_fd);
+    assert(ret == FILE_SIZE);
+    ret = fs_read_h(fs, fs_fd, buf, FILE_SIZE);
+    assert(ret == FILE_SIZE);
+    assert(memcmp(buf, expect, FILE_SIZE) == 0);
+    ret = fs_close_h(fs, fs_fd);
+    assert(ret == 0);
+}
+
+//run a child that mounts the disk, calls crash() and exits without unmounting
+void run_crash(char* diskname, const struct fs_options* opts, void (*crash)(fs_t*)){
+    pid_t pid = fork();
+    int status;
+
+    if (pid < 0)
+        die("Cannot fork");
+    if (pid == 0){
+        fs_t* fs = fs_mount_h(diskname, opts);
+        if (fs == NULL)
+            die("Cannot mount %s", diskname);
+        crash(fs);
+        _exit(0);
+    }
+    if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        die("Child failed");
+}
+
+//synced files survive, the file created after the last sync doesn't
+void crash_after_sync(fs_t* fs){
+    int ret;
+
+    write_file(fs, "synced", 1);
+    ret = fs_delete_h(fs, "old");
+    assert(ret == 0);
+    ret = fs_sync_h(fs);
+    assert(ret == 0);
+    write_file(fs, "lost", 2);
+}
+
+//commits that don't fit in the journal anymore turn into checkpoints
+void crash_after_many_syncs(fs_t* fs){
+    char filename[FS_FILENAME_LEN];
+    int ret;
+
+    for (int i = 0; i < SYNC_ROUNDS; i++){
+        snprintf(filename, sizeof(filename), "f%d", i % 8);
+        if (i >= 8){
+            ret = fs_delete_h(fs, filename);
+            assert(ret == 0);
+        }
+        write_file(fs, filename, i);
+        ret = fs_sync_h(fs);
+        assert(ret == 0);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    struct fs_options opts = { .journal_blocks = 1 };
+    char filename[FS_FILENAME_LEN];
+    fs_t* fs;
+    int ret;
+
+    if (argc < 2)
+        die("Usage: %s <diskname>", argv[0]);
+
+    //add a journal, the smallest one, to an image with a file on it
+    fs = fs_mount_h(argv[1], NULL);
+    if (fs == NULL)
+        die("Cannot mount %s", argv[1]);
+    write_file(fs, "old", 0);
+    if (fs_umount_h(fs))
+        die("Cannot unmount %s", argv[1]);
+
+    run_crash(argv[1], &opts, crash_after_sync);
+    fs = fs_mount_h(argv[1], NULL);
+    if (fs == NULL)
+        die("Cannot mount %s", argv[1]);
+    check_file(fs, "synced", 1);
+    ret = fs_open_h(fs, "old");
+    assert(ret == -1);
+    ret = fs_open_h(fs, "lost");
+    assert(ret == -1);
+    if (fs_umount_h(fs))
+        die("Cannot unmount %s", argv[1]);
+
+    run_crash(argv[1], NULL, crash_after_many_syncs);
+    fs = fs_mount_h(argv[1], NULL);
+    if (fs == NULL)
+        die("Cannot mount %s", argv[1]);
+    for (int i = SYNC_ROUNDS - 8; i < SYNC_ROUNDS; i++){
+        snprintf(filename, sizeof(filename), "f%d", i % 8);
+        check_file(fs, filename, i);
+    }
+    check_file(fs, "synced", 1);
+    if (fs_umount_h(fs))
+        die("Cannot unmount %s", argv[1]);
+
+    printf("test_journal: OK\n");
+    return 0;
+}
@@ -0,0 +1,132 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <fs.h>
+
+#define test_fs_error(fmt, ...) \
+	fprintf(stderr, "%s: "fmt"\n", __func__, ##__VA_ARGS__)
+
+#define die(...)				\
+do {							\
+	test_fs_error(__VA_ARGS__);	\
+	exit(1);					\
+} while (0)
+
+//many times what a single root block holds
+#define FILE_COUNT 5000
+
+void name(char* filename, int i){
+    memset(filename, 0, FS_FILENAME_LEN);
+    snprintf(filename, FS_FILENAME_LEN, "file%d", i);
+}
+
+//every file holds its own name
+void create_file(fs_t* fs, int i){
+    char filename[FS_FILENAME_LEN];
+    int fs_fd, ret;
+
+    name(filename, i);
+    ret = fs_create_h(fs, filename);
+    assert(ret == 0);
+    fs_fd = fs_open_h(fs, filename);
+    assert(fs_fd >= 0);
+    ret = fs_write_h(fs, fs_fd, filename, FS_FILENAME_LEN);
+    assert(ret == FS_FILENAME_LEN);
+    ret = fs_close_h(fs, fs_fd);
+    assert(ret == 0);
+}
+
+void check_file(fs_t* fs, int i, int exists){
+    char filename[FS_FILENAME_LEN], buf[FS_FILENAME_LEN];
+    int fs_fd, ret;
+
+    name(filename, i);
+    fs_fd = fs_open_h(fs, filename);
+    if (!exists){
+        assert(fs_fd == -1);
+        return;
+    }
+    assert(fs_fd >= 0);
+    ret = fs_read_h(fs, fs_fd, buf, FS_FILENAME_LEN);
+    assert(ret == FS_FILENAME_LEN);
+    assert(memcmp(buf, filename, FS_FILENAME_LEN) == 0);
+    ret = fs_close_h(fs, fs_fd);
+    assert(ret == 0);
+}
+
+fs_t* mount(char* diskname, const struct fs_options* opts){
+    fs_t* fs = fs_mount_h(diskname, opts);
+    if (fs == NULL)
+        die("Cannot mount %s", diskname);
+    return fs;
+}
+
+void umount(fs_t* fs){
+    if (fs_umount_h(fs))
+        die("Cannot unmount");
+}
+
+int main(int argc, char **argv)
+{
+    struct fs_options opts = { .large_dir = 1, .journal_blocks = 256 };
+    pid_t pid;
+    int status, ret;
+    fs_t* fs;
+
+    if (argc < 2)
+        die("Usage: %s <diskname>", argv[0]);
+
+    //a single block root directory fills up
+    fs = mount(argv[1], NULL);
+    for (int i = 0; i < FS_FILE_MAX_COUNT; i++)
+        create_file(fs, i);
+    ret = fs_create_h(fs, "full");
+    assert(ret == -1);
+    umount(fs);
+
+    //until it is extended, its files stay where they are
+    fs = mount(argv[1], &opts);
+    for (int i = FS_FILE_MAX_COUNT; i < FILE_COUNT; i++)
+        create_file(fs, i);
+    umount(fs);
+
+    fs = mount(argv[1], NULL);
+    for (int i = 0; i < FILE_COUNT; i++)
+        check_file(fs, i, 1);
+    for (int i = 0; i < FILE_COUNT; i += 2){
+        char filename[FS_FILENAME_LEN];
+        name(filename, i);
+        ret = fs_delete_h(fs, filename);
+        assert(ret == 0);
+    }
+    umount(fs);
+
+    //deleted entries are reused, and the journal logs entries past the root block
+    pid = fork();
+    if (pid < 0)
+        die("Cannot fork");
+    if (pid == 0){
+        fs = mount(argv[1], NULL);
+        for (int i = 0; i < FILE_COUNT; i += 2)
+            create_file(fs, FILE_COUNT + i);
+        ret = fs_sync_h(fs);
+        assert(ret == 0);
+        _exit(0);
+    }
+    if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        die("Child failed");
+
+    fs = mount(argv[1], NULL);
+    for (int i = 0; i < FILE_COUNT; i++){
+        check_file(fs, i, i % 2);
+        check_file(fs, FILE_COUNT + i, i % 2 == 0);
+    }
+    umount(fs);
+
+    printf("test_large_dir: OK\n");
+    return 0;
+}
@@ -0,0 +1,138 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fs.h>
+
+#define test_fs_error(fmt, ...) \
+	fprintf(stderr, "%s: "fmt"\n", __func__, ##__VA_ARGS__)
+
+#define die(...)				\
+do {							\
+	test_fs_error(__VA_ARGS__);	\
+	exit(1);					\
+} while (0)
+
+//a few blocks plus a partial one
+#define SHARD_SIZE (3 * 4096 + 123)
+#define MAX_DISKS 16
+
+struct shard{
+    char* diskname;
+    int id;
+};
+
+void fill(char* buf, int id){
+    for (int i = 0; i < SHARD_SIZE; i++)
+        buf[i] = 'a' + (i + id) % 26;
+}
+
+//write a file whose content depends on the shard id
+void write_shard(fs_t* fs, int id){
+    char buf[SHARD_SIZE];
+    int fs_fd, ret;
+
+    fill(buf, id);
+    ret = fs_create_h(fs, "shard");
+    assert(ret == 0);
+    fs_fd = fs_open_h(fs, "shard");
+    assert(fs_fd >= 0);
+    ret = fs_write_h(fs, fs_fd, buf, SHARD_SIZE);
+    assert(ret == SHARD_SIZE);
+    ret = fs_close_h(fs, fs_fd);
+    assert(ret == 0);
+}
+
+//read the file back, check that no other shard leaked into it, then delete it
+void check_shard(fs_t* fs, int id){
+    char expect[SHARD_SIZE], buf[SHARD_SIZE];
+    int fs_fd, ret;
+
+    fill(expect, id);
+    fs_fd = fs_open_h(fs, "shard");
+    assert(fs_fd >= 0);
+    ret = fs_stat_h(fs, fs_fd);
+    assert(ret == SHARD_SIZE);
+    ret = fs_read_h(fs, fs_fd, buf, SHARD_SIZE);
+    assert(ret == SHARD_SIZE);
+    assert(memcmp(buf, expect, SHARD_SIZE) == 0);
+    ret = fs_close_h(fs, fs_fd);
+    assert(ret == 0);
+    ret = fs_delete_h(fs, "shard");
+    assert(ret == 0);
+}
+
+void* run_shard(void* arg){
+    struct shard* shard = arg;
+    fs_t* fs;
+
+    fs = fs_mount_h(shard->diskname, NULL);
+    if (fs == NULL)
+        die("Cannot mount %s", shard->diskname);
+    write_shard(fs, shard->id);
+    if (fs_umount_h(fs))
+        die("Cannot unmount %s", shard->diskname);
+
+    fs = fs_mount_h(shard->diskname, NULL);
+    if (fs == NULL)
+        die("Cannot mount %s", shard->diskname);
+    check_shard(fs, shard->id);
+    if (fs_umount_h(fs))
+        die("Cannot unmount %s", shard->diskname);
+    return NULL;
+}
+
+//every disk mounted at once in the main thread, file descriptors are per instance
+void test_interleaved(int count, char** disknames){
+    fs_t* fs[MAX_DISKS];
+    int ret;
+
+    for (int i = 0; i < count; i++){
+        fs[i] = fs_mount_h(disknames[i], NULL);
+        if (fs[i] == NULL)
+            die("Cannot mount %s", disknames[i]);
+    }
+
+    //the default instance is not mounted by fs_mount_h()
+    ret = fs_info();
+    assert(ret == -1);
+
+    for (int i = 0; i < count; i++)
+        write_shard(fs[i], i);
+    for (int i = count - 1; i >= 0; i--)
+        check_shard(fs[i], i);
+
+    for (int i = 0; i < count; i++)
+        if (fs_umount_h(fs[i]))
+            die("Cannot unmount %s", disknames[i]);
+}
+
+//one thread per disk
+void test_threads(int count, char** disknames){
+    pthread_t threads[MAX_DISKS];
+    struct shard shards[MAX_DISKS];
+
+    for (int i = 0; i < count; i++){
+        shards[i].diskname = disknames[i];
+        shards[i].id = i + 7;
+        if (pthread_create(&threads[i], NULL, run_shard, &shards[i]))
+            die("Cannot create thread");
+    }
+    for (int i = 0; i < count; i++)
+        pthread_join(threads[i], NULL);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2 || argc - 1 > MAX_DISKS)
+        die("Usage: %s <diskname> [<diskname>...]", argv[0]);
+
+    test_interleaved(argc - 1, argv + 1);
+
+    test_threads(argc - 1, argv + 1);
+
+    printf("test_multi: %d disks OK\n", argc - 1);
+    return 0;
+}
@@ -0,0 +1,148 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fs.h>
+
+#define test_fs_error(fmt, ...) \
+	fprintf(stderr, "%s: "fmt"\n", __func__, ##__VA_ARGS__)
+
+#define die(...)				\
+do {							\
+	test_fs_error(__VA_ARGS__);	\
+	exit(1);					\
+} while (0)
+
+#define BLOCK_SIZE 4096
+#define DATA_BLOCKS 4096
+#define FILE_SIZE (512 * BLOCK_SIZE + 123)
+//threads reading at random offsets through the same descriptor
+#define READERS 8
+#define READS 500
+//largest read, a few blocks and a partial one
+#define MAX_READ (5 * BLOCK_SIZE + 700)
+
+static fs_t* fs;
+static int shared_fd;
+
+void fill(char* buf, size_t len, size_t offset){
+    for (size_t i = 0; i < len; i++)
+        buf[i] = 'a' + (offset + i) % 23;
+}
+
+void* reader(void* arg){
+    unsigned int seed = (long) arg;
+    static __thread char buf[MAX_READ], expect[MAX_READ];
+    int ret;
+
+    for (int i = 0; i < READS; i++){
+        size_t offset = rand_r(&seed) % FILE_SIZE;
+        size_t count = rand_r(&seed) % MAX_READ + 1;
+        size_t want = FILE_SIZE - offset < count ? FILE_SIZE - offset : count;
+
+        ret = fs_pread_h(fs, shared_fd, buf, count, offset);
+        assert(ret == (int) want);
+        fill(expect, want, offset);
+        assert(memcmp(buf, expect, want) == 0);
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    pthread_t readers[READERS];
+    static char buf[FILE_SIZE], expect[FILE_SIZE];
+    int fs_fd, ret;
+
+    if (argc < 2)
+        die("Usage: %s <diskname>", argv[0]);
+    if (fs_format(argv[1], DATA_BLOCKS, NULL))
+        die("Cannot create %s", argv[1]);
+
+    fs = fs_mount_h(argv[1], NULL);
+    if (fs == NULL)
+        die("Cannot mount %s", argv[1]);
+    ret = fs_create_h(fs, "file");
+    assert(ret == 0);
+    shared_fd = fs_open_h(fs, "file");
+    assert(shared_fd >= 0);
+
+    //writing at the end of the file, without moving the descriptor
+    fill(buf, FILE_SIZE, 0);
+    ret = fs_pwrite_h(fs, shared_fd, buf, BLOCK_SIZE + 10, 0);
+    assert(ret == BLOCK_SIZE + 10);
+    ret = fs_pwrite_h(fs, shared_fd, buf + BLOCK_SIZE + 10, FILE_SIZE - BLOCK_SIZE - 10, BLOCK_SIZE + 10);
+    assert(ret == FILE_SIZE - BLOCK_SIZE - 10);
+    ret = fs_stat_h(fs, shared_fd);
+    assert(ret == FILE_SIZE);
+    ret = fs_pwrite_h(fs, shared_fd, buf, 1, FILE_SIZE + 1);
+    assert(ret == -1);
+
+    //the descriptor still reads from the start
+    ret = fs_read_h(fs, shared_fd, expect, 100);
+    assert(ret == 100);
+    assert(memcmp(expect, buf, 100) == 0);
+
+    //reads are cut at the end of the file
+    ret = fs_pread_h(fs, shared_fd, expect, 1000, FILE_SIZE - 10);
+    assert(ret == 10);
+    assert(memcmp(expect, buf + FILE_SIZE - 10, 10) == 0);
+    ret = fs_pread_h(fs, shared_fd, expect, 1000, FILE_SIZE);
+    assert(ret == 0);
+    ret = fs_pread_h(fs, shared_fd, expect, 1000, FILE_SIZE + 1);
+    assert(ret == -1);
+    ret = fs_pread_h(fs, FS_OPEN_MAX_COUNT, expect, 1000, 0);
+    assert(ret == -1);
+
+    //overwriting the middle of the file across blocks
+    memset(expect, 'z', 3 * BLOCK_SIZE);
+    ret = fs_pwrite_h(fs, shared_fd, expect, 3 * BLOCK_SIZE, 10 * BLOCK_SIZE - 1);
+    assert(ret == 3 * BLOCK_SIZE);
+    ret = fs_pread_h(fs, shared_fd, buf, 3 * BLOCK_SIZE + 2, 10 * BLOCK_SIZE - 2);
+    assert(ret == 3 * BLOCK_SIZE + 2);
+    assert(buf[0] == 'a' + (10 * BLOCK_SIZE - 2) % 23);
+    assert(memcmp(buf + 1, expect, 3 * BLOCK_SIZE) == 0);
+    assert(buf[3 * BLOCK_SIZE + 1] == 'a' + (13 * BLOCK_SIZE - 1) % 23);
+    fill(buf, 3 * BLOCK_SIZE, 10 * BLOCK_SIZE - 1);
+    ret = fs_pwrite_h(fs, shared_fd, buf, 3 * BLOCK_SIZE, 10 * BLOCK_SIZE - 1);
+    assert(ret == 3 * BLOCK_SIZE);
+
+    //random reads of the same descriptor from several threads
+    for (long i = 0; i < READERS; i++){
+        ret = pthread_create(&readers[i], NULL, reader, (void*) i);
+        assert(ret == 0);
+    }
+    for (int i = 0; i < READERS; i++){
+        ret = pthread_join(readers[i], NULL);
+        assert(ret == 0);
+    }
+
+    //and the descriptor carries on where it was
+    ret = fs_read_h(fs, shared_fd, buf, 100);
+    assert(ret == 100);
+    fill(expect, 100, 100);
+    assert(memcmp(buf, expect, 100) == 0);
+    ret = fs_close_h(fs, shared_fd);
+    assert(ret == 0);
+
+    //the data reached the disk
+    if (fs_umount_h(fs))
+        die("Cannot unmount");
+    fs = fs_mount_h(argv[1], NULL);
+    assert(fs != NULL);
+    fs_fd = fs_open_h(fs, "file");
+    assert(fs_fd >= 0);
+    ret = fs_pread_h(fs, fs_fd, buf, FILE_SIZE, 0);
+    assert(ret == FILE_SIZE);
+    fill(expect, FILE_SIZE, 0);
+    assert(memcmp(buf, expect, FILE_SIZE) == 0);
+    ret = fs_close_h(fs, fs_fd);
+    assert(ret == 0);
+    if (fs_umount_h(fs))
+        die("Cannot unmount");
+
+    printf("test_pread: OK\n");
+    return 0;
+}
@@ -0,0 +1,250 @@
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fs.h>
+
+#define test_fs_error(fmt, ...) \
+	fprintf(stderr, "%s: "fmt"\n", __func__, ##__VA_ARGS__)
+
+#define die(...)				\
+do {							\
+	test_fs_error(__VA_ARGS__);	\
+	exit(1);					\
+} while (0)
+
+#define BLOCK_SIZE 4096
+#define DATA_BLOCKS 8192
+//files read by the readers, each by several of them at once
+#define FILES 4
+#define READERS 8
+#define FILE_SIZE (256 * BLOCK_SIZE + 1000)
+//reads of a few blocks and a partial one, not aligned with the blocks
+#define CHUNK (3 * BLOCK_SIZE + 100)
+#define ROUNDS 20
+//blocks appended by the writer, while other files are created and deleted
+#define WRITES 200
+//descriptors closed and reopened on another file while a read runs on them
+#define REOPENS 1000
+#define REOPEN_READ (64 * BLOCK_SIZE)
+
+static fs_t* fs;
+static int shared_fd;
+static pthread_barrier_t turn;
+
+void fill(char* buf, size_t len, int id, size_t offset){
+    for (size_t i = 0; i < len; i++)
+        buf[i] = 'a' + (offset + i + id) % 26;
+}
+
+void name(char* filename, int id){
+    memset(filename, 0, FS_FILENAME_LEN);
+    snprintf(filename, FS_FILENAME_LEN, "file%d", id);
+}
+
+void* reader(void* arg){
+    int id = (long) arg % FILES;
+    char filename[FS_FILENAME_LEN];
+    static __thread char buf[CHUNK], expect[CHUNK];
+    int ret;
+
+    name(filename, id);
+    for (int round = 0; round < ROUNDS; round++){
+        int fs_fd = fs_open_h(fs, filename);
+        size_t offset = 0;
+        int n;
+
+        assert(fs_fd >= 0);
+        while (offset < FILE_SIZE){
+            n = FILE_SIZE - offset < CHUNK ? FILE_SIZE - offset : CHUNK;
+            ret = fs_read_h(fs, fs_fd, buf, n);
+            assert(ret == n);
+            fill(expect, n, id, offset);
+            assert(memcmp(buf, expect, n) == 0);
+            offset += n;
+        }
+        assert(offset == FILE_SIZE);
+        ret = fs_close_h(fs, fs_fd);
+        assert(ret == 0);
+    }
+    return NULL;
+}
+
+//follow the appended file while it is written, each read returns nothing at the old end
+//of the file or the bytes appended since, never the content of a block from before
+void* tail(void* arg){
+    static char buf[2 * BLOCK_SIZE], expect[2 * BLOCK_SIZE];
+    size_t offset = 0;
+    int fs_fd, ret;
+
+    (void) arg;
+    fs_fd = fs_open_h(fs, "appended");
+    assert(fs_fd >= 0);
+    while (offset < WRITES * BLOCK_SIZE){
+        //the next bytes at an offset first, then through the descriptor
+        ret = fs_pread_h(fs, fs_fd, buf, sizeof(buf), offset);
+        assert(ret >= 0);
+        fill(expect, ret, FILES, offset);
+        assert(memcmp(buf, expect, ret) == 0);
+
+        ret = fs_read_h(fs, fs_fd, buf, sizeof(buf));
+        assert(ret >= 0);
+        if (ret == 0){ //caught up with the writer
+            sched_yield();
+            continue;
+        }
+        fill(expect, ret, FILES, offset);
+        assert(memcmp(buf, expect, ret) == 0);
+        offset += ret;
+    }
+    assert(offset == WRITES * BLOCK_SIZE);
+    ret = fs_close_h(fs, fs_fd);
+    assert(ret == 0);
+    return NULL;
+}
+
+void* writer(void* arg){
+    char buf[BLOCK_SIZE];
+    int fs_fd, ret;
+
+    (void) arg;
+    fs_fd = fs_open_h(fs, "appended");
+    assert(fs_fd >= 0);
+    for (int i = 0; i < WRITES; i++){
+        fill(buf, BLOCK_SIZE, FILES, (size_t) i * BLOCK_SIZE);
+        ret = fs_write_h(fs, fs_fd, buf, BLOCK_SIZE);
+        assert(ret == BLOCK_SIZE);
+        ret = fs_create_h(fs, "temp");
+        assert(ret == 0);
+        ret = fs_delete_h(fs, "temp");
+        assert(ret == 0);
+    }
+    ret = fs_close_h(fs, fs_fd);
+    assert(ret == 0);
+    return NULL;
+}
+
+//read through a descriptor that main closes and reopens meanwhile, any result will do
+void* late_reader(void* arg){
+    static char buf[REOPEN_READ];
+
+    (void) arg;
+    for (int i = 0; i < REOPENS; i++){
+        pthread_barrier_wait(&turn);
+        fs_read_h(fs, shared_fd, buf, REOPEN_READ);
+        pthread_barrier_wait(&turn);
+    }
+    return NULL;
+}
+
+//a read still running when its descriptor is closed doesn't move the descriptor that
+//takes its place, which reads its own file from the start, or after the read if it
+//came late enough to read the new file
+void check_reopen(void){
+    char buf[100], expect[100], late[100];
+    pthread_t thread;
+    size_t offset;
+    int fs_fd, ret;
+
+    ret = pthread_barrier_init(&turn, NULL, 2);
+    assert(ret == 0);
+    ret = pthread_create(&thread, NULL, late_reader, NULL);
+    assert(ret == 0);
+    fill(expect, sizeof(expect), 1, 0);
+    fill(late, sizeof(late), 1, REOPEN_READ);
+    for (int i = 0; i < REOPENS; i++){
+        offset = (size_t) (i * 37 % ((FILE_SIZE - REOPEN_READ) / BLOCK_SIZE)) * BLOCK_SIZE;
+        shared_fd = fs_open_h(fs, "file0");
+        assert(shared_fd >= 0);
+        ret = fs_lseek_h(fs, shared_fd, offset);
+        assert(ret == 0);
+        pthread_barrier_wait(&turn);
+        for (volatile int spin = 0; spin < i % 40 * 1000; spin++) //close at different points of the read
+            ;
+        ret = fs_close_h(fs, shared_fd);
+        assert(ret == 0);
+        fs_fd = fs_open_h(fs, "file1");
+        assert(fs_fd == shared_fd);
+        pthread_barrier_wait(&turn);
+
+        ret = fs_read_h(fs, fs_fd, buf, sizeof(buf));
+        assert(ret == sizeof(buf));
+        assert(memcmp(buf, expect, sizeof(buf)) == 0 || memcmp(buf, late, sizeof(buf)) == 0);
+        ret = fs_close_h(fs, fs_fd);
+        assert(ret == 0);
+    }
+    ret = pthread_join(thread, NULL);
+    assert(ret == 0);
+    pthread_barrier_destroy(&turn);
+}
+
+int main(int argc, char **argv)
+{
+    pthread_t readers[READERS], appender, follower;
+    char filename[FS_FILENAME_LEN];
+    static char buf[FILE_SIZE], expect[FILE_SIZE];
+    int fs_fd, ret;
+
+    if (argc < 2)
+        die("Usage: %s <diskname>", argv[0]);
+    if (fs_format(argv[1], DATA_BLOCKS, NULL))
+        die("Cannot create %s", argv[1]);
+
+    fs = fs_mount_h(argv[1], NULL);
+    if (fs == NULL)
+        die("Cannot mount %s", argv[1]);
+    for (int i = 0; i < FILES; i++){
+        name(filename, i);
+        fill(buf, FILE_SIZE, i, 0);
+        ret = fs_create_h(fs, filename);
+        assert(ret == 0);
+        fs_fd = fs_open_h(fs, filename);
+        assert(fs_fd >= 0);
+        ret = fs_write_h(fs, fs_fd, buf, FILE_SIZE);
+        assert(ret == FILE_SIZE);
+        ret = fs_close_h(fs, fs_fd);
+        assert(ret == 0);
+    }
+    ret = fs_create_h(fs, "appended");
+    assert(ret == 0);
+
+    //readers of the same files through their own descriptors, next to a writer
+    //and a reader of the file it appends to
+    for (long i = 0; i < READERS; i++){
+        ret = pthread_create(&readers[i], NULL, reader, (void*) i);
+        assert(ret == 0);
+    }
+    ret = pthread_create(&follower, NULL, tail, NULL);
+    assert(ret == 0);
+    ret = pthread_create(&appender, NULL, writer, NULL);
+    assert(ret == 0);
+    for (int i = 0; i < READERS; i++){
+        ret = pthread_join(readers[i], NULL);
+        assert(ret == 0);
+    }
+    ret = pthread_join(appender, NULL);
+    assert(ret == 0);
+    ret = pthread_join(follower, NULL);
+    assert(ret == 0);
+
+    fs_fd = fs_open_h(fs, "appended");
+    assert(fs_fd >= 0);
+    ret = fs_stat_h(fs, fs_fd);
+    assert(ret == WRITES * BLOCK_SIZE);
+    ret = fs_read_h(fs, fs_fd, buf, WRITES * BLOCK_SIZE);
+    assert(ret == WRITES * BLOCK_SIZE);
+    fill(expect, WRITES * BLOCK_SIZE, FILES, 0);
+    assert(memcmp(buf, expect, WRITES * BLOCK_SIZE) == 0);
+    ret = fs_close_h(fs, fs_fd);
+    assert(ret == 0);
+
+    check_reopen();
+    if (fs_umount_h(fs))
+        die("Cannot unmount");
+
+    printf("test_threads: OK\n");
+    return 0;
+}
@@ -0,0 +1,317 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <disk.h>
+#include <fs.h>
+
+#define test_fs_error(fmt, ...) \
+	fprintf(stderr, "%s: "fmt"\n", __func__, ##__VA_ARGS__)
+
+#define die(...)				\
+do {							\
+	test_fs_error(__VA_ARGS__);	\
+	exit(1);					\
+} while (0)
+
+#define BLOCK_SIZE 4096
+//larger blocks, recorded in the super block
+#define LARGE_BLOCK_SIZE (64 * 1024)
+//more data blocks than 16-bit fat entries can address
+#define DATA_BLOCKS 100000
+//reserved by a first file, so that the next one lands past block 65535
+#define RESERVED_BLOCKS 70000
+//a few blocks and a partial one, of the largest blocks
+#define MAX_FILE_SIZE (3 * LARGE_BLOCK_SIZE + 123)
+
+//size of the test files, for the block size of the image
+static size_t file_size;
+
+//the image file backend, recording the blocks written and the flushes in their order,
+//whose reads fail on demand
+#define FLUSHED ((size_t) -1)
+#define MAX_EVENTS 100000
+static size_t events[MAX_EVENTS];
+static size_t nevents;
+static pthread_mutex_t events_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool fail_reads;
+
+void record(size_t event){
+    pthread_mutex_lock(&events_lock);
+    assert(nevents < MAX_EVENTS);
+    events[nevents++] = event;
+    pthread_mutex_unlock(&events_lock);
+}
+
+void* recording_open(const char* diskname){
+    return disk_file_backend.open(diskname);
+}
+
+int recording_close(void* ctx){
+    return disk_file_backend.close(ctx);
+}
+
+size_t recording_count(void* ctx){
+    return disk_file_backend.count(ctx);
+}
+
+int recording_read(void* ctx, size_t block, const struct iovec* iov, int iovcnt){
+    if (fail_reads)
+        return -1;
+    return disk_file_backend.read(ctx, block, iov, iovcnt);
+}
+
+int recording_write(void* ctx, size_t block, const struct iovec* iov, int iovcnt){
+    record(block);
+    return disk_file_backend.write(ctx, block, iov, iovcnt);
+}
+
+int recording_flush(void* ctx){
+    record(FLUSHED);
+    return disk_file_backend.flush(ctx);
+}
+
+static const struct disk_backend recording_backend = {
+    .name = "recording",
+    .open = recording_open,
+    .close = recording_close,
+    .count = recording_count,
+    .read = recording_read,
+    .write = recording_write,
+    .flush = recording_flush,
+};
+
+void fill(char* buf, int id){
+    for (size_t i = 0; i < file_size; i++)
+        buf[i] = 'a' + (i + id) % 26;
+}
+
+void write_file(fs_t* fs, const char* filename, int id){
+    static char buf[MAX_FILE_SIZE];
+    int fs_fd, ret;
+
+    fill(buf, id);
+    ret = fs_create_h(fs, filename);
+    assert(ret == 0);
+    fs_fd = fs_open_h(fs, filename);
+    assert(fs_fd >= 0);
+    ret = fs_write_h(fs, fs_fd, buf, file_size);
+    assert(ret == (int) file_size);
+    ret = fs_close_h(fs, fs_fd);
+    assert(ret == 0);
+}
+
+void check_file(fs_t* fs, const char* filename, int id){
+    static char expect[MAX_FILE_SIZE], buf[MAX_FILE_SIZE];
+    long long size;
+    int fs_fd, ret;
+
+    fill(expect, id);
+    fs_fd = fs_open_h(fs, filename);
+    assert(fs_fd >= 0);
+    size = fs_stat_h(fs, fs_fd);
+    assert(size == (long long) file_size);
+    ret = fs_read_h(fs, fs_fd, buf, file_size);
+    assert(ret == (int) file_size);
+    assert(memcmp(buf, expect, file_size) == 0);
+    ret = fs_close_h(fs, fs_fd);
+    assert(ret == 0);
+}
+
+fs_t* mount(char* diskname, const struct fs_options* opts){
+    fs_t* fs = fs_mount_h(diskname, opts);
+    if (fs == NULL)
+        die("Cannot mount %s", diskname);
+    return fs;
+}
+
+void umount(fs_t* fs){
+    if (fs_umount_h(fs))
+        die("Cannot unmount");
+}
+
+//largest number of blocks a new file can reserve, a failed reservation takes none
+size_t free_blocks(fs_t* fs, size_t block_size){
+    size_t lo = 0, hi = DATA_BLOCKS;
+
+    while (lo < hi){
+        size_t mid = (lo + hi + 1) / 2;
+        int fs_fd, fits, ret;
+
+        ret = fs_create_h(fs, "probe");
+        assert(ret == 0);
+        fs_fd = fs_open_h(fs, "probe");
+        assert(fs_fd >= 0);
+        fits = fs_fallocate_h(fs, fs_fd, mid * block_size) == 0;
+        ret = fs_close_h(fs, fs_fd);
+        assert(ret == 0);
+        ret = fs_delete_h(fs, "probe");
+        assert(ret == 0);
+        if (fits)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    return lo;
+}
+
+//more data blocks than the original format counts make a wide image
+void run(char* diskname, size_t block_size){
+    struct fs_format_options format = { .block_size = block_size };
+    struct fs_options opts = { .journal_blocks = 64 };
+    struct fs_options lazy = { .lazy_fat = 1 };
+    size_t free, left;
+    pid_t pid;
+    int status, fs_fd, ret;
+    fs_t* fs;
+
+    if (fs_format(diskname, DATA_BLOCKS, &format))
+        die("Cannot create %s", diskname);
+    file_size = 3 * block_size + 123;
+
+    fs = mount(diskname, NULL);
+    ret = fs_create_h(fs, "reserved");
+    assert(ret == 0);
+    fs_fd = fs_open_h(fs, "reserved");
+    assert(fs_fd >= 0);
+    ret = fs_fallocate_h(fs, fs_fd, (size_t) RESERVED_BLOCKS * block_size);
+    assert(ret == 0);
+    ret = fs_close_h(fs, fs_fd);
+    assert(ret == 0);
+    write_file(fs, "past", 1);
+    umount(fs);
+
+    fs = mount(diskname, NULL);
+    check_file(fs, "past", 1);
+    umount(fs);
+
+    //the journal logs 32-bit fat entries
+    pid = fork();
+    if (pid < 0)
+        die("Cannot fork");
+    if (pid == 0){
+        fs = mount(diskname, &opts);
+        ret = fs_delete_h(fs, "past");
+        assert(ret == 0);
+        write_file(fs, "synced", 2);
+        ret = fs_sync_h(fs);
+        assert(ret == 0);
+        _exit(0);
+    }
+    if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        die("Child failed");
+
+    fs = mount(diskname, NULL);
+    check_file(fs, "synced", 2);
+    ret = fs_open_h(fs, "past");
+    assert(ret == -1);
+    free = free_blocks(fs, block_size);
+    umount(fs);
+
+    //a clean unmount records the free block count, so the fat can be read as it is used
+    fs = mount(diskname, &lazy);
+    check_file(fs, "synced", 2);
+    write_file(fs, "lazy", 3);
+    left = free_blocks(fs, block_size);
+    assert(left == free - 4);
+    umount(fs);
+    fs = mount(diskname, &lazy);
+    left = free_blocks(fs, block_size);
+    assert(left == free - 4);
+    umount(fs);
+
+    //a lazy mount that doesn't unmount leaves no count, the next mount reads the whole fat
+    pid = fork();
+    if (pid < 0)
+        die("Cannot fork");
+    if (pid == 0){
+        fs = mount(diskname, &lazy);
+        ret = fs_delete_h(fs, "lazy");
+        assert(ret == 0);
+        ret = fs_sync_h(fs);
+        assert(ret == 0);
+        _exit(0);
+    }
+    if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        die("Child failed");
+
+    fs = mount(diskname, &lazy);
+    ret = fs_open_h(fs, "lazy");
+    assert(ret == -1);
+    check_file(fs, "synced", 2);
+    left = free_blocks(fs, block_size);
+    assert(left == free);
+    umount(fs);
+}
+
+//the super block, whose free block count describes the fat, is only written once the
+//blocks written before it are on disk, and is on disk before anything else is written
+void check_super_order(char* diskname){
+    struct fs_options opts = { .backend = &recording_backend };
+    fs_t* fs;
+
+    if (fs_format(diskname, DATA_BLOCKS, NULL))
+        die("Cannot create %s", diskname);
+    file_size = 3 * BLOCK_SIZE + 123;
+    fs = mount(diskname, &opts);
+    write_file(fs, "ordered", 1);
+    umount(fs);
+
+    for (size_t i = 0; i < nevents; i++){
+        if (events[i] != 0)
+            continue;
+        assert(i == 0 || events[i - 1] == FLUSHED);
+        assert(i + 1 < nevents && events[i + 1] == FLUSHED);
+    }
+}
+
+//a reservation that can't read the part of the fat it needs fails and reserves nothing
+void check_fallocate_error(char* diskname){
+    struct fs_options opts = { .backend = &recording_backend, .lazy_fat = 1 };
+    size_t free, left;
+    int fs_fd, ret;
+    fs_t* fs;
+
+    if (fs_format(diskname, DATA_BLOCKS, NULL))
+        die("Cannot create %s", diskname);
+    file_size = 3 * BLOCK_SIZE + 123;
+    fs = mount(diskname, NULL);
+    write_file(fs, "first", 1);
+    umount(fs);
+
+    //every data block but the first one and those of the file, the fat is not read yet
+    free = DATA_BLOCKS - 1 - (file_size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    fs = mount(diskname, &opts);
+    check_file(fs, "first", 1);
+    fs_fd = fs_open_h(fs, "first");
+    assert(fs_fd >= 0);
+    fail_reads = true;
+    ret = fs_fallocate_h(fs, fs_fd, (size_t) RESERVED_BLOCKS * BLOCK_SIZE);
+    fail_reads = false;
+    assert(ret == -1);
+    ret = fs_close_h(fs, fs_fd);
+    assert(ret == 0);
+    check_file(fs, "first", 1);
+    left = free_blocks(fs, BLOCK_SIZE);
+    assert(left == free);
+    umount(fs);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+        die("Usage: %s <diskname>", argv[0]);
+
+    run(argv[1], BLOCK_SIZE);
+    run(argv[1], LARGE_BLOCK_SIZE);
+    check_super_order(argv[1]);
+    check_fallocate_error(argv[1]);
+
+    printf("test_wide: OK\n");
+    return 0;
+}